@@ -0,0 +1,428 @@
+/// Микробенчмарки конвейера разбор -> очередь -> выполнение.
+/// Результаты в JSON: bench_bulk --benchmark_out=bench_bulk.json --benchmark_out_format=json
+/// (или цель bench_bulk_json)
+
+#include <benchmark/benchmark.h>
+
+#include <streambuf>
+#include <thread>
+
+#include "bulk_arena.h"
+#include "bulk_async.h"
+#include "bulk_exec.h"
+#include "bulk_pipeline.h"
+#include "bulk_ring.h"
+#include "bulk_sinks.h"
+
+using namespace otus_hw7;
+
+namespace {
+
+    constexpr size_t kQueueCapacity = 1024;
+    constexpr size_t kBatch = 16;
+    constexpr size_t kInputLines = 1 << 14;
+
+    /// @brief Буфер потока, читающий готовую строку без копирования
+    class MemoryBuf : public std::streambuf
+    {
+    public:
+        explicit MemoryBuf(std::string const& data)
+        {
+            char* p = const_cast<char*>(data.data());
+            setg(p, p, p + data.size());
+        }
+    };
+
+    /// @brief Буфер потока, отбрасывающий вывод
+    class NullBuf : public std::streambuf
+    {
+    protected:
+        int_type        overflow(int_type c) override { return traits_type::not_eof(c); }
+        std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+    };
+
+    /// @brief Приемник, отбрасывающий пакеты, чтобы ввод-вывод не заслонял обработку
+    class DiscardBulkSink : public IBulkSink
+    {
+    public:
+        void write(BulkBuffer const&, std::string_view text) override { bytes_ += text.size(); benchmark::DoNotOptimize(bytes_); }
+    private:
+        size_t bytes_ = 0;
+    };
+
+    /// @brief То же для статического конвейера: конкретный тип без виртуальных методов
+    class StaticDiscardSink
+    {
+    public:
+        void write(BulkBuffer const&, std::string_view text) { bytes_ += text.size(); benchmark::DoNotOptimize(bytes_); }
+        void flush() {}
+    private:
+        size_t bytes_ = 0;
+    };
+
+    /// @brief Процессор без журнала: команды выполняются только в поток вывода
+    class DiscardLogProcessor : public Processor
+    {
+    public:
+        using Processor::Processor;
+    protected:
+        void exec_queue() override
+        {
+            ctx_->bulk_size_ = cmd_queue_->size();
+            ctx_->cmd_idx_ = 0;
+            ctx_->cmd_created_at_ = cmd_queue_->created_at_;
+            executor_->execute(*cmd_queue_, cmd_executor_, *ctx_);
+        }
+    private:
+        CommandExecutor cmd_executor_;
+    };
+
+    /// @brief Синтетический ввод: lines команд длины line_len; при dynamic каждые 16 команд
+    ///        оборачиваются в динамический блок с вложенным блоком внутри
+    std::string make_input(size_t lines, size_t line_len, bool dynamic)
+    {
+        std::string out;
+        out.reserve(lines * (line_len + 3));
+        std::string const pad(line_len > 8 ? line_len - 8 : 0, 'x');
+        for( size_t i = 0; i < lines; ++i )
+        {
+            if( dynamic && i % 16 == 0 )
+                out += "{\n";
+            if( dynamic && i % 16 == 4 )
+                out += "{\n";
+            char num[16];
+            std::snprintf(num, sizeof(num), "%08zu", i % 100000000);
+            out.append(num, std::min<size_t>(8, line_len ? line_len : 1));
+            out += pad;
+            out += '\n';
+            if( dynamic && i % 16 == 8 )
+                out += "}\n";
+            if( dynamic && i % 16 == 15 )
+                out += "}\n";
+        }
+        return out;
+    }
+
+    IInputParserPtr_t make_parser(size_t chunk_size, std::istream& is)
+    {
+        return IInputParserPtr_t{ new InputParser(chunk_size, is, ICommandCreatorPtr_t(new CommandCreator)) };
+    }
+
+    IInputParserPtr_t make_parser(size_t chunk_size, std::istream& is, ICommandCreatorPtr_t cmd_creator)
+    {
+        return IInputParserPtr_t{ new InputParser(chunk_size, is, std::move(cmd_creator)) };
+    }
+
+    void set_input_counters(benchmark::State& state, std::string const& input)
+    {
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kInputLines));
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+    }
+
+    /// @brief Разбор по одной команде: read_next_command (read_command + создание команды)
+    void BM_read_next_command(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(1));
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            auto parser = make_parser(3, is);
+            ICommandPtr_t cmd;
+            while( parser->read_next_command(cmd) != IInputParser::Status::kStop )
+                benchmark::DoNotOptimize(cmd);
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Разбор пакетами в очередь команд
+    void BM_read_next_bulk_queue(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(1));
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            auto parser = make_parser(3, is);
+            CommandQueue q;
+            while( parser->read_next_bulk(q) != IInputParser::Status::kStop )
+                q.reset();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Разбор пакетами в непрерывный буфер
+    void BM_read_next_bulk_buffer(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(1));
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            auto parser = make_parser(3, is);
+            BulkBuffer bulk;
+            while( parser->read_next_bulk(bulk) != IInputParser::Status::kStop )
+                bulk.clear();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Вставка и извлечение пакета команд
+    template <typename Queue>
+    void BM_command_queue_push_pop(benchmark::State& state)
+    {
+        size_t const n = static_cast<size_t>(state.range(0));
+        Queue q(n);
+        CommandCreator creator;
+        std::vector<ICommandPtr_t> cmds;
+        for( size_t i = 0; i < n; ++i )
+            cmds.push_back(creator.create_command("cmd" + std::to_string(i)));
+        for( auto _ : state )
+        {
+            for( auto& c : cmds )
+                q.push(std::move(c));
+            for( auto& c : cmds )
+                q.pop(c);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+    }
+
+    /// @brief CommandQueue с конструктором емкости для общего шаблона
+    struct SizedCommandQueue : CommandQueue
+    {
+        explicit SizedCommandQueue(size_t) {}
+    };
+
+    /// @brief Форматирование пакета командами SimpleCommand::execute
+    void BM_simple_command_execute(benchmark::State& state)
+    {
+        size_t const n = static_cast<size_t>(state.range(0));
+        std::vector<ICommandPtr_t> cmds;
+        for( size_t i = 0; i < n; ++i )
+            cmds.push_back(CommandCreator().create_command("command" + std::to_string(i)));
+        NullBuf null_buf;
+        std::ostream os(&null_buf);
+        ICommandContext ctx(n, 0, os, 0);
+        for( auto _ : state )
+        {
+            for( size_t i = 0; i < n; ++i )
+            {
+                ctx.cmd_idx_ = i;
+                cmds[i]->execute(ctx);
+            }
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+    }
+
+    /// @brief Сквозная обработка Processor::process: очередь команд и вывод в отбрасывающий поток без журнала
+    void BM_processor_process(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(2));
+        size_t const chunk_size = static_cast<size_t>(state.range(1));
+        NullBuf null_buf;
+        std::ostream os(&null_buf);
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            DiscardLogProcessor(make_parser(chunk_size, is), create_command_queue(), create_queue_executor(), os).process();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief То же, что BM_processor_process, но команды пакета размещаются в арене из общего пула
+    void BM_processor_process_arena(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(2));
+        size_t const chunk_size = static_cast<size_t>(state.range(1));
+        NullBuf null_buf;
+        std::ostream os(&null_buf);
+        auto pool = std::make_shared<ArenaPool>();
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            DiscardLogProcessor(make_parser(chunk_size, is, ICommandCreatorPtr_t(new ArenaCommandCreator(pool))), 
+                                create_command_queue(), create_queue_executor(), os).process();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Сквозная обработка BulkProcessor::process с отбрасывающим приемником
+    void BM_bulk_processor_process(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(2));
+        size_t const chunk_size = static_cast<size_t>(state.range(1));
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            std::vector<IBulkSinkPtr_t> sinks;
+            sinks.emplace_back(new DiscardBulkSink);
+            BulkProcessor(make_parser(chunk_size, is), std::move(sinks)).process();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Сквозная обработка статическим конвейером Pipeline с отбрасывающим приемником
+    void BM_pipeline_process(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(2));
+        size_t const chunk_size = static_cast<size_t>(state.range(1));
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            Pipeline<IstreamLineSource, StaticDiscardSink>(chunk_size, std::make_unique<IstreamLineSource>(is), StaticDiscardSink()).process();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Встраиваемый разбор: ввод подается порциями по 64 КиБ, обработчик только считает команды.
+    ///        state.range(3) - копирующий PushParser (0) или IBulkFeeder без копирования команд (1)
+    void BM_bulk_feeder(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, static_cast<size_t>(state.range(0)), state.range(2));
+        size_t const chunk_size = static_cast<size_t>(state.range(1));
+        static constexpr size_t kPortion = size_t(64) << 10;
+        size_t cmds = 0;
+        auto feed_all = [&input](auto& parser)
+        {
+            for( size_t pos = 0; pos < input.size(); pos += kPortion )
+                parser.feed(input.data() + pos, std::min(kPortion, input.size() - pos));
+            parser.finish();
+        };
+        if( state.range(3) )
+        {
+            IBulkFeederPtr_t feeder = create_feeder(chunk_size, [&cmds](BulkBuffer const& bulk){ cmds += bulk.size(); });
+            for( auto _ : state )
+                feed_all(*feeder);
+        }
+        else
+        {
+            PushParser parser(chunk_size, [&cmds](BulkBuffer& bulk){ cmds += bulk.size(); });
+            for( auto _ : state )
+                feed_all(parser);
+        }
+        benchmark::DoNotOptimize(cmds);
+        set_input_counters(state, input);
+    }
+
+    /// @brief Выполнение пакетов с тяжелым обработчиком (hash:64 на каждую команду) на пуле из state.range(0) потоков
+    ///        с восстановлением порядка
+    void BM_parallel_exec(benchmark::State& state)
+    {
+        std::string const input = make_input(kInputLines, 64, false);
+        auto pool = std::make_shared<WorkStealingPool>(static_cast<size_t>(state.range(0)));
+        auto handlers = std::make_shared<HandlerRegistry>();
+        handlers->add("0=hash:64");
+        for( auto _ : state )
+        {
+            MemoryBuf buf(input);
+            std::istream is(&buf);
+            std::vector<IBulkSinkPtr_t> out;
+            out.emplace_back(new DiscardBulkSink);
+            std::vector<IBulkSinkPtr_t> sinks;
+            sinks.emplace_back(new ParallelBulkSink(pool, handlers, std::move(out)));
+            BulkProcessor(make_parser(16, is), std::move(sinks)).process();
+        }
+        set_input_counters(state, input);
+    }
+
+    /// @brief Пропускная способность: поток-производитель передает state.range(0) элементов потребителю
+    template <typename Queue>
+    void BM_handoff_throughput(benchmark::State& state)
+    {
+        size_t const count = static_cast<size_t>(state.range(0));
+        for( auto _ : state )
+        {
+            Queue q(kQueueCapacity);
+            std::thread producer([&q, count]{
+                for( size_t i = 1; i <= count; ++i )
+                    q.push(i);
+                q.close();
+            });
+            size_t v = 0, sum = 0;
+            while( q.pop(v) )
+                sum += v;
+            producer.join();
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+    }
+
+    /// @brief То же с передачей пачками по kBatch элементов
+    template <typename Queue>
+    void BM_handoff_batch_throughput(benchmark::State& state)
+    {
+        size_t const count = static_cast<size_t>(state.range(0));
+        for( auto _ : state )
+        {
+            Queue q(kQueueCapacity);
+            std::thread producer([&q, count]{
+                size_t batch[kBatch];
+                for( size_t i = 0; i < count; i += kBatch )
+                {
+                    for( size_t j = 0; j < kBatch; ++j )
+                        batch[j] = i + j;
+                    q.push_batch(batch, std::min(kBatch, count - i));
+                }
+                q.close();
+            });
+            size_t batch[kBatch], sum = 0;
+            while( size_t n = q.pop_batch(batch, kBatch) )
+                for( size_t j = 0; j < n; ++j )
+                    sum += batch[j];
+            producer.join();
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+    }
+
+    /// @brief Задержка передачи: время полного оборота элемента между двумя потоками
+    template <typename Queue>
+    void BM_handoff_roundtrip(benchmark::State& state)
+    {
+        Queue ping(kQueueCapacity), pong(kQueueCapacity);
+        std::thread echo([&]{
+            size_t v = 0;
+            while( ping.pop(v) )
+                pong.push(v);
+            pong.close();
+        });
+        size_t v = 0;
+        for( auto _ : state )
+        {
+            ping.push(v);
+            pong.pop(v);
+            ++v;
+        }
+        ping.close();
+        echo.join();
+    }
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_handoff_throughput, BoundedQueue<size_t>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_throughput, SpscQueue<size_t>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_throughput, MpmcQueue<size_t>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_batch_throughput, SpscQueue<size_t>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_batch_throughput, MpmcQueue<size_t>)->Arg(1 << 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_roundtrip, BoundedQueue<size_t>)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_roundtrip, SpscQueue<size_t>)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_handoff_roundtrip, MpmcQueue<size_t>)->UseRealTime();
+
+BENCHMARK(BM_read_next_command)->ArgNames({"line_len", "dynamic"})->ArgsProduct({{8, 64}, {0, 1}});
+BENCHMARK(BM_read_next_bulk_queue)->ArgNames({"line_len", "dynamic"})->ArgsProduct({{8, 64}, {0, 1}});
+BENCHMARK(BM_read_next_bulk_buffer)->ArgNames({"line_len", "dynamic"})->ArgsProduct({{8, 64}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_command_queue_push_pop, SizedCommandQueue)->Arg(64);
+BENCHMARK_TEMPLATE(BM_command_queue_push_pop, SpscCommandQueue)->Arg(64);
+BENCHMARK(BM_simple_command_execute)->Arg(3)->Arg(64);
+BENCHMARK(BM_processor_process)->ArgNames({"line_len", "chunk", "dynamic"})->ArgsProduct({{8, 64, 256}, {3, 64}, {0, 1}});
+BENCHMARK(BM_processor_process_arena)->ArgNames({"line_len", "chunk", "dynamic"})->ArgsProduct({{8, 64, 256}, {3, 64}, {0, 1}});
+BENCHMARK(BM_bulk_processor_process)->ArgNames({"line_len", "chunk", "dynamic"})->ArgsProduct({{8, 64, 256}, {3, 64}, {0, 1}});
+BENCHMARK(BM_parallel_exec)->ArgName("threads")->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+BENCHMARK(BM_bulk_feeder)->ArgNames({"line_len", "chunk", "dynamic", "borrow"})->ArgsProduct({{8, 64, 256}, {3, 64}, {0}, {0, 1}});
+BENCHMARK(BM_pipeline_process)->ArgNames({"line_len", "chunk", "dynamic"})->ArgsProduct({{8, 64, 256}, {3, 64}, {0, 1}});
+
+BENCHMARK_MAIN();
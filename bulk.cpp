@@ -1,10 +1,21 @@
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
-#include <map>
-
-#include "bulk_internal.h"
+#include "bulk_arena.h"
+#include "bulk_async.h"
+#include "bulk_binlog.h"
+#include "bulk_checkpoint.h"
+#include "bulk_compress.h"
+#include "bulk_durable.h"
+#include "bulk_exec.h"
+#include "bulk_metrics.h"
+#include "bulk_pipeline.h"
+#include "bulk_server.h"
+#include "bulk_sharded.h"
+#include "bulk_sinks.h"
+#include "bulk_uring.h"
 
 namespace otus_hw7{
     IInputParser::Status   InputParser::read_next_bulk(ICommandQueue& cmd_queue)
@@ -36,6 +47,124 @@ namespace otus_hw7{
         return st;
     }    
 
+    IInputParser::Status   InputParser::read_next_bulk(BulkBuffer& bulk)
+    {
+        if( spill_ready_ )
+            return next_spilled_part(bulk);
+
+		Status st{};
+        if( bulk.empty() )
+            bulk.stamp_now(); 
+
+        for(bool end_of_work = false; !end_of_work;)
+        {
+            read_command();
+			switch( st = last_stat_ )
+			{
+				default:
+				case Status::kIgnore:
+					break;
+				case Status::kReading:
+                    if( discarding_ )
+                        break;
+					push_command(bulk, last_cmd_, interner_.get());
+                    if( budget_ )
+                        check_budget(bulk);
+					break;
+				case Status::kReady:
+                    end_of_work = true;
+                    discarding_ = false;
+                    if( spill_ )
+                    {
+                        spill_->append(bulk);
+                        spill_->rewind();
+                        spill_ready_ = true;
+                        return next_spilled_part(bulk);
+                    }
+                    break;
+				case Status::kStop:
+                    end_of_work = true;
+					bulk.clear();
+                    spill_.reset();
+                    discarding_ = false;
+					break;
+			}
+		}
+        return st;
+    }    
+
+    void   InputParser::check_budget(BulkBuffer& bulk)
+    {
+        if( !budget_->over(bulk.footprint()) )
+            return;
+        if( !block_count_ )
+        {
+            budget_->wait_for_room(bulk.footprint());
+            return;
+        }
+        switch( budget_->policy() )
+        {
+            case OverflowPolicy::kDiscard:
+                BULK_METRIC_ADD(kDiscardedBlocks, 1);
+                bulk.clear();
+                discarding_ = true;
+                return;
+            case OverflowPolicy::kStall:
+                if( budget_->wait_for_room(bulk.footprint()) )
+                    return;
+                // блок не помещается и в пустые очереди - выгружается
+                break;
+            default:
+            case OverflowPolicy::kSpill:
+                break;
+        }
+        if( !spill_ )
+        {
+            spill_.reset(new SpillFile(spill_dir_));
+            spill_parts_ = 0;
+            spill_created_at_ = bulk.created_at_;
+            spill_created_us_ = bulk.created_us_;
+            BULK_METRIC_ADD(kSpilledBlocks, 1);
+        }
+        BULK_METRIC_ADD(kSpilledBytes, bulk.bytes());
+        spill_->append(bulk);
+        bulk.clear();
+    }
+
+    IInputParser::Status   InputParser::next_spilled_part(BulkBuffer& bulk)
+    {
+        bulk.clear();
+        bulk.created_at_ = spill_created_at_;
+        bulk.created_us_ = spill_created_us_;
+        spill_->read_part(bulk, std::max<size_t>(budget_->cap() / 2, 1));
+        bool const first = !spill_parts_++;
+        if( spill_->exhausted() )
+        {
+            bulk.part_ = first ? BulkPart::kWhole : BulkPart::kLast;
+            spill_.reset();
+            spill_ready_ = false;
+        }
+        else
+            bulk.part_ = first ? BulkPart::kFirst : BulkPart::kMiddle;
+        return Status::kReady;
+    }
+
+    template class BasicPushParser<std::function<void(BulkBuffer&)>>;
+
+    void BulkFeeder::deliver(BulkBuffer& bulk)
+    {
+        bulk.seq_ = ++seq_;
+        BULK_METRIC_BULK(bulk.size());
+        on_bulk_(bulk);
+    }
+
+    IBulkFeederPtr_t create_feeder(size_t chunk_size, IBulkFeeder::BulkCallback_t on_bulk, std::chrono::milliseconds max_latency)
+    {
+        if( !chunk_size )
+            throw std::runtime_error("chunk_size must be positive");
+        return IBulkFeederPtr_t{ new BulkFeeder(chunk_size, std::move(on_bulk), max_latency) };
+    }
+
     void     InputParser::set_status(Status new_st)
     {
         if( new_st == last_stat_ )
@@ -59,43 +188,73 @@ namespace otus_hw7{
         last_stat_ = new_st;
     }
 
-    istream& InputParser::read_command()
+    void InputParser::resume(uint64_t offset, size_t depth)
+    {
+        src_->seek(offset);
+        block_count_ = depth;
+        cmd_count_ = 0;
+        last_tok_ = Token::kEnd_Block;
+        last_stat_ = Status::kReady;
+    }
+
+    void InputParser::static_bulk_ready()
     {
-        using token_map_t = std::map<std::string, Token>;
-        static token_map_t tok_values = {{"{", Token::kBegin_Block}, {"}", Token::kEnd_Block}};
+        if( chunk_ctl_ && cmd_count_ )
+            chunk_ctl_->bulk_ready(cmd_count_, first_cmd_at_, std::chrono::steady_clock::now(), src_->waited_ns());
+    }
 
-        if( cmd_count_ == chunk_size_ && !block_count_ )
+    bool InputParser::static_bulk_expired()
+    {
+        if( !max_latency_.count() || !cmd_count_ || block_count_ )
+            return false;
+        auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(first_cmd_at_ + max_latency_ - std::chrono::steady_clock::now());
+        return left.count() <= 0 || !src_->wait_line(left);
+    }
+
+    void InputParser::read_command()
+    {
+        if( (cmd_count_ >= static_chunk() && !block_count_) || static_bulk_expired() )
         {
+            static_bulk_ready();
             last_tok_ = Token::kEnd_Block;
             set_status(Status::kReady);
-            return is_; 
+            return; 
         }
 
-        std::string inp_str;
-        if( !std::getline(is_, inp_str) )
+        if( !src_->next_line(last_cmd_) )
         {
             last_tok_ = block_count_ ? Token::kEnd_Of_File : Token::kEnd_Block;
+            if( !block_count_ )
+                static_bulk_ready();
             set_status(block_count_ || (Status::kReady == last_stat_) ? Status::kStop : Status::kReady);
         }
         else
         {
+            BULK_METRIC_ADD(kLinesRead, 1);
             last_tok_ = Token::kCommand; 
-            auto const p_tok = tok_values.find(inp_str);
-            if( p_tok != tok_values.end() )
-                last_tok_ = p_tok->second;
+            if( last_cmd_.size() == 1 )
+            {
+                if( last_cmd_[0] == '{' )
+                    last_tok_ = Token::kBegin_Block;
+                else if( last_cmd_[0] == '}' )
+                    last_tok_ = Token::kEnd_Block;
+            }
 
             switch( last_tok_ )
             {
                 default:
                 case Token::kCommand:
-                    ++cmd_count_;
-                    last_cmd_ = inp_str;
+                    if( !cmd_count_++ && (max_latency_.count() || chunk_ctl_) )
+                        first_cmd_at_ = std::chrono::steady_clock::now();
                     set_status(Status::kReading);
                     break;
 
                 case Token::kBegin_Block:
                     if( !block_count_++ )
+                    {
+                        static_bulk_ready();
                         set_status(Status::kReady);
+                    }
                     else
                         set_status(Status::kIgnore);
                     break;
@@ -108,10 +267,11 @@ namespace otus_hw7{
                         else
                             set_status(Status::kIgnore);
                     }
+                    else
+                        set_status(Status::kIgnore);
                     break;
             }
         }
-        return is_;
     }
 
     bool     CommandQueue::pop(ICommandPtr_t& cmd) 
@@ -139,11 +299,22 @@ namespace otus_hw7{
             ctx.os_ << std::endl; 
     }
 
+    void InternedCommand::execute(ICommandContext& ctx)
+    {
+        ctx.os_ << (!ctx.cmd_idx_ ? "bulk: ": ", ") << cmd_; 
+        if( ctx.bulk_size_ - ctx.cmd_idx_ < 2 )
+            ctx.os_ << std::endl; 
+    }
+
     void Processor::process()
     {
 		for(bool end_of_work = false; !end_of_work;)
         {
-			IInputParser::Status st = parser_->read_next_bulk(*cmd_queue_);
+			IInputParser::Status st;
+            {
+                BULK_METRIC_TIMER(kParse);
+                st = parser_->read_next_bulk(*cmd_queue_);
+            }
 			switch( st )
 			{
 				default:
@@ -159,23 +330,218 @@ namespace otus_hw7{
 					break;
 			}
 		}
+        executor_->wait();
     }
 
     void    Processor::exec_queue( )
     {
         ctx_->bulk_size_ = cmd_queue_->size(); 
+        BULK_METRIC_BULK(ctx_->bulk_size_);
         ctx_->cmd_idx_ = 0;
         ctx_->cmd_created_at_ = cmd_queue_->created_at_;
         ICommandExecutorPtr_t cmd_executor{ new CommandExecutorWithLog(ICommandExecutorPtr_t{ new CommandExecutor() }) };
         executor_->execute(*cmd_queue_, *cmd_executor, *ctx_);
     }
 
+    void BulkProcessor::process()
+    {
+		for(bool end_of_work = false; !end_of_work;)
+        {
+			IInputParser::Status st;
+            {
+                BULK_METRIC_TIMER(kParse);
+                st = parser_->read_next_bulk(bulk_);
+            }
+			switch( st )
+			{
+				default:
+				case IInputParser::Status::kIgnore:
+				case IInputParser::Status::kReading:
+					break;
+				case IInputParser::Status::kReady:
+					exec_bulk();
+					break;
+				case IInputParser::Status::kStop:
+                    end_of_work = true;
+					bulk_.clear();
+					break;
+			}
+		}
+        flush_sinks();
+    }
+
+    void    BulkProcessor::exec_bulk( )
+    {
+        if( !bulk_.empty() )
+        {
+            if( bulk_.opens() )
+                ++bulk_seq_;
+            bulk_.seq_ = bulk_seq_;
+            BULK_METRIC_BULK(bulk_.size());
+            text_.clear();
+            format_bulk(bulk_, text_);
+            for( auto& sink : sinks_ )
+                sink->write(bulk_, text_);
+        }
+        bulk_.clear();
+    }
+
+    void    BulkProcessor::flush_sinks( )
+    {
+        for( auto& sink : sinks_ )
+            sink->flush();
+    }
+
+    /// @brief Фабрика источника строк: файл через mmap или стандартный ввод
+    /// @param options 
+    /// @return 
+    ILineSourcePtr_t create_line_source(Options& options)
+    {
+        if( !options.input_path.empty() )
+        {
+#ifndef _WIN32
+            return ILineSourcePtr_t{ new MappedLineSource(options.input_path) };
+#else
+            throw std::runtime_error("--input is not supported on this platform");
+#endif
+        }
+        return ILineSourcePtr_t{ new FdLineSource(0) };
+    }
+
+    /// @brief Настройки сброса вывода из опций командной строки
+    static FlushOptions get_flush_options(Options const& options)
+    {
+        FlushOptions opts;
+        opts.policy_ = options.flush_policy;
+        opts.interval_ = std::chrono::milliseconds(options.flush_interval_ms);
+        return opts;
+    }
+
+    /// @brief При политике сброса по интервалу добавляет сброс по таймеру: иначе пакеты простаивающего
+    ///        потока ждали бы в буфере следующего пакета
+    static IBulkSinkPtr_t with_timed_flush(Options const& options, IBulkSinkPtr_t sink)
+    {
+        if( options.flush_policy != FlushPolicy::kInterval )
+            return sink;
+        return std::make_unique<TimedFlushSink>(std::move(sink), std::chrono::milliseconds(options.flush_interval_ms));
+    }
+
+    /// @brief Фабрика приемников пакетов: консоль и файлы журнала
+    /// @param options 
+    /// @return Приемник для консоли
+    IBulkSinkPtr_t create_console_sink(Options& options)
+    {
+#ifndef _WIN32
+        return with_timed_flush(options, IBulkSinkPtr_t{ new FdBulkSink(1, get_flush_options(options)) });
+#else
+        return with_timed_flush(options, IBulkSinkPtr_t{ new OstreamBulkSink(std::cout, get_flush_options(options)) });
+#endif
+    }
+
+    /// @brief Фабрика кодировщика журнала
+    /// @param options 
+    /// @return nullptr, если сжатие не задано
+    /// @throw std::runtime_error, если сжатие отключено при сборке
+    static ILogEncoderPtr_t create_log_encoder(Options& options)
+    {
+        if( options.log_compress == LogCompression::kNone )
+            return nullptr;
+#ifdef BULK_ZSTD
+        return ILogEncoderPtr_t{ new ZstdLogEncoder(options.log_compress_level, 
+                                                    options.log_dict.empty() ? std::string() : load_log_dictionary(options.log_dict)) };
+#else
+        throw std::runtime_error("zstd compression is disabled at build time");
+#endif
+    }
+
+    /// @brief Настройки ротации сегментов из опций командной строки
+    static SegmentOptions get_segment_options(Options const& options)
+    {
+        SegmentOptions seg_opts;
+        seg_opts.max_bytes_ = options.segment_size;
+        seg_opts.max_age_ = std::chrono::seconds(options.segment_seconds);
+        seg_opts.durable_ = options.durable;
+        return seg_opts;
+    }
+
+    /// @brief Таблица интернирования команд, если интернирование включено
+    static StringInternerPtr_t create_interner(Options const& options)
+    {
+        return options.intern ? std::make_shared<StringInterner>(options.intern_capacity) : nullptr;
+    }
+
+    /// @brief Приемник журнала по формату, режиму и способу записи из опций
+    static IBulkSinkPtr_t create_log_writer(Options& options)
+    {
+        ILogEncoderPtr_t encoder = create_log_encoder(options);
+        if( options.log_format == LogFormat::kBinary )
+        {
+            if( encoder )
+                throw std::runtime_error("binary log format does not support compression");
+            return IBulkSinkPtr_t{ new BinaryLogSink(get_segment_options(options), get_flush_options(options)) };
+        }
+        if( options.log_mode == LogMode::kSegment )
+            return IBulkSinkPtr_t{ new SegmentLogSink(get_segment_options(options), get_flush_options(options), std::move(encoder)) };
+        if( encoder )
+            return IBulkSinkPtr_t{ new LogFileBulkSink(get_flush_options(options), std::move(encoder)) };
+#ifdef __linux__
+        if( options.log_backend == LogBackend::kUring )
+        {
+            try
+            {
+                UringOptions uring_opts;
+                uring_opts.direct_ = options.log_direct;
+                return IBulkSinkPtr_t{ new UringLogSink(uring_opts, get_flush_options(options)) };
+            }
+            catch(const std::system_error& e)
+            {
+                std::cerr << e.what() << ", io_uring is unavailable, falling back to stream log" << std::endl;
+            }
+        }
+#endif
+        return IBulkSinkPtr_t{ new LogFileBulkSink(get_flush_options(options)) };
+    }
+
+    /// @brief Фабрика приемника для записи пакетов в файлы журнала
+    /// @param options 
+    /// @return 
+    IBulkSinkPtr_t create_log_sink(Options& options)
+    {
+        return with_timed_flush(options, create_log_writer(options));
+    }
+
+    /// @brief Фабрика последовательного парсера
+    static std::unique_ptr<InputParser> create_input_parser(Options& options, MemoryBudgetPtr_t budget, ChunkControllerPtr_t chunk_ctl = nullptr)
+    {
+        StringInternerPtr_t interner = create_interner(options);
+        ICommandCreatorPtr_t cmd_creator{ interner ? static_cast<ICommandCreator*>(new InterningCommandCreator(interner)) : new ArenaCommandCreator };
+        std::chrono::milliseconds max_latency(options.max_latency_ms);
+        // при подборе под цель p99 пакет, застрявший на медленном вводе, не ждет дольше цели
+        if( chunk_ctl && !max_latency.count() && options.target_p99_us )
+            max_latency = std::chrono::milliseconds((options.target_p99_us + 999) / 1000);
+        auto parser = std::make_unique<InputParser>(options.cmd_chunk_sz, create_line_source(options), std::move(cmd_creator), max_latency);
+        parser->set_interner(std::move(interner));
+        if( budget )
+            parser->set_budget(std::move(budget), options.spill_dir);
+        if( chunk_ctl )
+            parser->set_chunk_controller(std::move(chunk_ctl));
+        return parser;
+    }
+
     /// @brief Фабрика для парсера. Опции нужны для выбора типа парсера
     /// @param options 
     /// @return 
-    IInputParserPtr_t create_parser(Options& options)
+    IInputParserPtr_t create_parser(Options& options, MemoryBudgetPtr_t budget, ChunkControllerPtr_t chunk_ctl)
     {
-        return IInputParserPtr_t{ new InputParser(options.cmd_chunk_sz, std::cin, ICommandCreatorPtr_t(new CommandCreator)) };
+#ifndef _WIN32
+        if( !options.input_path.empty() && options.parse_threads > 1 )
+        {
+            if( budget )
+                throw std::runtime_error("--memory_cap is not supported with --parse_threads");
+            return IInputParserPtr_t{ new ShardedInputParser(options.cmd_chunk_sz, options.input_path, options.parse_threads) };
+        }
+#endif
+        return create_input_parser(options, std::move(budget), std::move(chunk_ctl));
     }
     
     /// @brief Фабрика очереди команд
@@ -192,12 +558,271 @@ namespace otus_hw7{
         return  IQueueExecutorPtr_t{  new QueueExecutor() };
     }
 
+    /// @brief Оборачивает приемник замером времени этапа, если метрики включены при сборке
+    static IBulkSinkPtr_t with_stage_timer(IBulkSinkPtr_t sink, [[maybe_unused]] MetricStage stage)
+    {
+#ifdef BULK_METRICS
+        return IBulkSinkPtr_t{ new TimedBulkSink(std::move(sink), stage) };
+#else
+        return sink;
+#endif
+    }
+
+    static bool exec_enabled(Options const& options)
+    {
+        return options.exec_threads || !options.handlers.empty();
+    }
+
+    static bool adaptive_chunk(Options const& options)
+    {
+        return options.target_p99_us || options.min_chunk;
+    }
+
+    /// @brief Передает приемники пулу выполнения пакетов, если он нужен по настройкам
+    /// @return Приемник пула над sinks или sinks без изменений
+    static std::vector<IBulkSinkPtr_t> with_executor(Options& options, std::vector<IBulkSinkPtr_t> sinks, MemoryBudgetPtr_t budget = nullptr)
+    {
+        if( !exec_enabled(options) )
+            return sinks;
+        auto handlers = std::make_shared<HandlerRegistry>();
+        for( auto const& binding : options.handlers )
+            handlers->add(binding);
+        auto exec_sink = std::make_unique<ParallelBulkSink>(std::make_shared<WorkStealingPool>(options.exec_threads), std::move(handlers),
+                                                            std::move(sinks), !options.exec_unordered, options.queue_capacity);
+        exec_sink->set_budget(std::move(budget));
+        std::vector<IBulkSinkPtr_t> exec_sinks;
+        exec_sinks.push_back(std::move(exec_sink));
+        return exec_sinks;
+    }
+
+    /// @brief Бюджет памяти ожидающих пакетов по настройкам
+    /// @return nullptr, если лимит не задан
+    /// @throw std::runtime_error, если вывод не поддерживает пакеты, выводимые порциями
+    static MemoryBudgetPtr_t create_memory_budget(Options const& options)
+    {
+        if( !options.memory_cap )
+            return nullptr;
+        // при stall блок, не помещающийся и в пустые очереди, тоже выгружается
+        if( options.overflow_policy != OverflowPolicy::kDiscard )
+        {
+            if( options.log_format == LogFormat::kBinary || options.log_backend == LogBackend::kUring )
+                throw std::runtime_error("--overflow=spill/stall requires the text log with the stream backend");
+            if( options.log_threads > 1 || options.exec_unordered )
+                throw std::runtime_error("--overflow=spill/stall requires ordered output: --log_threads <= 1, no --exec_unordered");
+        }
+        return std::make_shared<MemoryBudget>(options.memory_cap, options.overflow_policy);
+    }
+
+    namespace {
+#ifndef _WIN32
+        using ConsoleSink_t = FdBulkSink;
+        std::unique_ptr<ConsoleSink_t> make_console_sink(Options& options) { return std::make_unique<FdBulkSink>(1, get_flush_options(options)); }
+#else
+        using ConsoleSink_t = OstreamBulkSink;
+        std::unique_ptr<ConsoleSink_t> make_console_sink(Options& options) { return std::make_unique<OstreamBulkSink>(std::cout, get_flush_options(options)); }
+#endif
+
+        template<class Source, class LogSink>
+        IProcessorPtr_t make_pipeline(Options& options, std::unique_ptr<Source> src, std::unique_ptr<LogSink> log_sink)
+        {
+            using Console_t = Timed<ConsoleSink_t, MetricStage::kConsoleWrite>;
+            using Log_t = Timed<LogSink, MetricStage::kFileWrite>;
+            using Sink_t = Tee<Console_t, Log_t>;
+            return IProcessorPtr_t{ new Pipeline<Source, Sink_t>(options.cmd_chunk_sz, std::move(src), 
+                                                                 Sink_t(Console_t(make_console_sink(options)), Log_t(std::move(log_sink))),
+                                                                 create_interner(options)) };
+        }
+
+        template<class Source>
+        IProcessorPtr_t make_pipeline(Options& options, std::unique_ptr<Source> src)
+        {
+            ILogEncoderPtr_t encoder = create_log_encoder(options);
+            if( options.log_format == LogFormat::kBinary )
+            {
+                if( encoder )
+                    throw std::runtime_error("binary log format does not support compression");
+                return make_pipeline(options, std::move(src), std::make_unique<BinaryLogSink>(get_segment_options(options), get_flush_options(options)));
+            }
+            if( options.log_mode == LogMode::kSegment )
+                return make_pipeline(options, std::move(src), 
+                                     std::make_unique<SegmentLogSink>(get_segment_options(options), get_flush_options(options), std::move(encoder)));
+            return make_pipeline(options, std::move(src), std::make_unique<LogFileBulkSink>(get_flush_options(options), std::move(encoder)));
+        }
+    }
+
+    IProcessorPtr_t create_static_pipeline(Options& options)
+    {
+        if( !options.socket_path.empty() || options.log_threads || options.max_latency_ms || 
+            (!options.input_path.empty() && options.parse_threads > 1) || options.log_backend == LogBackend::kUring || exec_enabled(options) ||
+            options.memory_cap || options.durable || !options.checkpoint_path.empty() || adaptive_chunk(options) ||
+            options.flush_policy == FlushPolicy::kInterval )
+            return nullptr;
+        if( !options.input_path.empty() )
+        {
+#ifndef _WIN32
+            return make_pipeline(options, std::make_unique<MappedLineSource>(options.input_path));
+#else
+            throw std::runtime_error("--input is not supported on this platform");
+#endif
+        }
+        return make_pipeline(options, std::make_unique<FdLineSource>(0));
+    }
+
+    /// @brief Приемники вывода пакетов: консоль и журнал либо, в надежном режиме, групповая фиксация,
+    ///        выводящая в консоль только записанные на носитель пакеты
+    static std::vector<IBulkSinkPtr_t> create_output_sinks(Options& options)
+    {
+        std::vector<IBulkSinkPtr_t> sinks;
+        if( options.durable )
+        {
+            std::vector<IBulkSinkPtr_t> log_sinks, release_sinks;
+            log_sinks.push_back(with_stage_timer(create_log_sink(options), MetricStage::kFileWrite));
+            release_sinks.push_back(with_stage_timer(create_console_sink(options), MetricStage::kConsoleWrite));
+            GroupCommitOptions commit_opts;
+            commit_opts.max_delay_ = std::chrono::microseconds(options.commit_delay_us);
+            commit_opts.max_batch_ = options.queue_capacity;
+            sinks.push_back(std::make_unique<GroupCommitSink>(std::move(log_sinks), std::move(release_sinks), commit_opts));
+            return sinks;
+        }
+        sinks.push_back(with_stage_timer(create_console_sink(options), MetricStage::kConsoleWrite));
+        sinks.push_back(with_stage_timer(create_log_sink(options), MetricStage::kFileWrite));
+        return sinks;
+    }
+
+    /// @brief Проверяет, совместим ли надежный режим с остальными настройками
+    /// @throw std::runtime_error при несовместимых настройках
+    static void check_durable(Options const& options)
+    {
+        if( !options.durable )
+            return;
+#ifdef _WIN32
+        throw std::runtime_error("--durable is not supported on this platform");
+#else
+        if( options.log_threads )
+            throw std::runtime_error("--durable uses its own commit thread and does not support --log_threads");
+        if( options.log_backend == LogBackend::kUring )
+            throw std::runtime_error("--durable does not support the uring log backend");
+#endif
+    }
+
+    /// @brief Подбор размера статического пакета; приемники вызываются синхронно в потоке разбора,
+    ///        иначе время вывода пакета не измерить
+    /// @return nullptr, если подбор не задан
+    /// @throw std::runtime_error при несовместимых настройках
+    static ChunkControllerPtr_t create_chunk_controller(Options& options)
+    {
+        if( !adaptive_chunk(options) )
+            return nullptr;
+        if( options.log_threads || exec_enabled(options) || options.durable )
+            throw std::runtime_error("adaptive chunk size requires synchronous output: no --log_threads, --exec_threads, --handlers or --durable");
+        if( !options.input_path.empty() && options.parse_threads > 1 )
+            throw std::runtime_error("adaptive chunk size does not support --parse_threads");
+        ChunkTargets targets;
+        targets.p99_ = std::chrono::microseconds(options.target_p99_us);
+        targets.min_ = options.min_chunk;
+        targets.max_ = options.max_chunk;
+        return std::make_shared<ChunkController>(targets, options.cmd_chunk_sz);
+    }
+
+    /// @brief Добавляет к приемникам обратную связь подбора размера пакета
+    static std::vector<IBulkSinkPtr_t> with_chunk_feedback(std::vector<IBulkSinkPtr_t> sinks, ChunkControllerPtr_t chunk_ctl)
+    {
+        if( chunk_ctl )
+            sinks.push_back(std::make_unique<ChunkFeedbackSink>(std::move(chunk_ctl)));
+        return sinks;
+    }
+
+    /// @brief Процессор с контрольными точками: продолжает с сохраненной точки или начинает заново
+    /// @throw std::runtime_error при несовместимых настройках
+    static IProcessorPtr_t create_checkpoint_processor(Options& options)
+    {
+        if( options.log_threads )
+            throw std::runtime_error("--checkpoint does not support --log_threads");
+        if( options.memory_cap )
+            throw std::runtime_error("--checkpoint does not support --memory_cap");
+        if( !options.input_path.empty() && options.parse_threads > 1 )
+            throw std::runtime_error("--checkpoint does not support --parse_threads");
+        ChunkControllerPtr_t chunk_ctl = create_chunk_controller(options);
+        auto processor = std::make_unique<CheckpointProcessor>(create_input_parser(options, nullptr, chunk_ctl),
+                                                               with_chunk_feedback(with_executor(options, create_output_sinks(options)), chunk_ctl),
+                                                               std::make_unique<CheckpointFile>(options.checkpoint_path, options.durable),
+                                                               options.checkpoint_every);
+        if( !options.resume || !processor->resume() )
+            processor->reset();
+        return processor;
+    }
+
     /// @brief  Фабрика для процессора, сама по настройкам выбирает какой тип процессора создать
     /// @param options 
     /// @return Интерфейс созданного объекта  
     IProcessorPtr_t create_processor(Options& options)
     {
-        return IProcessorPtr_t{new Processor(create_parser(options), create_command_queue(), create_queue_executor() ) };
+        check_durable(options);
+        if( options.resume && options.checkpoint_path.empty() )
+            throw std::runtime_error("--resume requires --checkpoint");
+        if( !options.socket_path.empty() )
+        {
+#ifdef __linux__
+            if( options.memory_cap )
+                throw std::runtime_error("--memory_cap is not supported in socket server mode");
+            if( !options.checkpoint_path.empty() )
+                throw std::runtime_error("--checkpoint is not supported in socket server mode");
+            if( adaptive_chunk(options) )
+                throw std::runtime_error("adaptive chunk size is not supported in socket server mode");
+            ServerOptions server_opts;
+            server_opts.path_ = options.socket_path;
+            server_opts.threads_ = options.server_threads;
+            server_opts.chunk_size_ = options.cmd_chunk_sz;
+            server_opts.max_latency_ = std::chrono::milliseconds(options.max_latency_ms);
+            server_opts.intern_capacity_ = options.intern ? options.intern_capacity : 0;
+            return IProcessorPtr_t{new BulkServer(server_opts, with_executor(options, create_output_sinks(options))) };
+#else
+            throw std::runtime_error("socket server mode is supported on Linux only");
+#endif
+        }
+        // Сжатие не должно задерживать разбор: журнал пишется в отдельном потоке.
+        // В надежном режиме журнал и так пишет поток фиксации, а контрольным точкам и подбору размера пакета
+        // нужен синхронный вывод
+        if( options.log_compress != LogCompression::kNone && !options.log_threads && !options.durable && 
+            options.checkpoint_path.empty() && !adaptive_chunk(options) )
+            options.log_threads = 1;
+        if( !options.dynamic_pipeline )
+            if( IProcessorPtr_t pipeline = create_static_pipeline(options) )
+                return pipeline;
+        if( !options.checkpoint_path.empty() )
+            return create_checkpoint_processor(options);
+        MemoryBudgetPtr_t budget = create_memory_budget(options);
+        // Пул выполнения сам выводит готовые пакеты, отдельные потоки записи ему не нужны
+        if( options.log_threads && !exec_enabled(options) )
+        {
+            std::vector<IBulkSinkPtr_t> log_sinks;
+            for( size_t i = 0; i < options.log_threads; ++i )
+                log_sinks.push_back(with_stage_timer(create_log_sink(options), MetricStage::kFileWrite));
+            auto processor = std::make_unique<AsyncProcessor>(create_parser(options, budget), 
+                                                              with_stage_timer(create_console_sink(options), MetricStage::kConsoleWrite), 
+                                                              std::move(log_sinks), options.queue_capacity);
+            processor->set_budget(std::move(budget));
+            return processor;
+        }
+
+        ChunkControllerPtr_t chunk_ctl = create_chunk_controller(options);
+        return IProcessorPtr_t{new BulkProcessor(create_parser(options, budget, chunk_ctl), 
+                                                 with_chunk_feedback(with_executor(options, create_output_sinks(options), budget), chunk_ctl)) };
+    }
+
+    /// @brief Фабрика вывода метрик
+    /// @param options 
+    /// @return nullptr, если файл статистики не задан или метрики отключены при сборке
+    IStatsReporterPtr_t create_stats_reporter(Options& options)
+    {
+        if( options.stats_file.empty() )
+            return nullptr;
+#ifdef BULK_METRICS
+        return IStatsReporterPtr_t{ new StatsReporter(options.stats_file, std::chrono::milliseconds(options.stats_interval_ms)) };
+#else
+        std::cerr << "metrics are disabled at build time, --stats_file is ignored" << std::endl;
+        return nullptr;
+#endif
     }
     
 };
\ No newline at end of file
@@ -1,19 +1,115 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <ctime>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <memory>
 #include <queue>
+#include <string_view>
+#include <vector>
 
 
 namespace otus_hw7{
     using std::istream;
     using std::ostream;
+
+    /// @brief Политика сброса буферизованного вывода в консоль и файлы
+    enum class FlushPolicy : uint8_t
+    {
+        kPerBulk,       ///< после каждого пакета
+        kInterval,      ///< не чаще заданного интервала
+        kOnExit         ///< при завершении работы (и при переполнении буфера)
+    };
+
+    /// @brief Способ сохранения пакетов в файлы
+    enum class LogMode : uint8_t
+    {
+        kFilePerBulk,   ///< отдельный файл на каждый пакет
+        kSegment        ///< пакеты дописываются в сегменты с ротацией по размеру или времени и индексом
+    };
+
+    /// @brief Механизм записи файлов журнала
+    enum class LogBackend : uint8_t
+    {
+        kStream,        ///< синхронные open/write/close в потоке вывода
+        kUring          ///< асинхронно через io_uring, при недоступности - kStream
+    };
+
+    /// @brief Формат журнала
+    enum class LogFormat : uint8_t
+    {
+        kText,          ///< строки "bulk: a, b, c"
+        kBinary         ///< двоичные сегменты .blg с заголовками пакетов и индексом по времени
+    };
+
+    /// @brief Сжатие файлов журнала
+    enum class LogCompression : uint8_t
+    {
+        kNone,
+        kZstd           ///< потоковое сжатие в кадры zstd, файлы получают расширение .zst
+    };
+
+    /// @brief Действие при превышении лимита памяти динамическим блоком
+    enum class OverflowPolicy : uint8_t
+    {
+        kStall,         ///< ждать, пока потоки вывода освободят память; если блок один больше лимита - kSpill
+        kSpill,         ///< выгружать блок во временный файл и выводить его частями по завершении
+        kDiscard        ///< отбросить блок сразу, не дожидаясь его конца
+    };
+
+    /// @brief Часть пакета, выводимого порциями (блок, выгруженный во временный файл)
+    enum class BulkPart : uint8_t
+    {
+        kWhole,         ///< пакет целиком
+        kFirst,
+        kMiddle,
+        kLast
+    };
+
     struct Options
     {
         bool   show_help;
         size_t cmd_chunk_sz;
+        size_t log_threads;         ///< Число потоков записи в файлы, 0 - синхронный вывод в потоке чтения
+        size_t queue_capacity;      ///< Емкость очередей пакетов между потоком чтения и потоками вывода
+        std::string input_path;     ///< Файл с командами, читается через отображение в память. Пусто - стандартный ввод
+        size_t parse_threads;       ///< Число потоков параллельного разбора файла input_path, 0 и 1 - последовательный разбор
+        FlushPolicy flush_policy;   ///< Политика сброса вывода
+        size_t flush_interval_ms;   ///< Интервал сброса для FlushPolicy::kInterval
+        LogMode log_mode;           ///< Способ сохранения пакетов в файлы
+        size_t segment_size;        ///< Размер сегмента в байтах, по достижении которого начинается новый
+        size_t segment_seconds;     ///< Время жизни сегмента в секундах, 0 - без ротации по времени
+        LogBackend log_backend;     ///< Механизм записи файлов пакетов
+        bool   log_direct;          ///< Запись файлов пакетов с O_DIRECT (только для LogBackend::kUring)
+        std::string stats_file;     ///< Файл статистики (строки JSON), "-" - поток ошибок. Пусто - метрики не выводятся
+        size_t stats_interval_ms;   ///< Период вывода статистики, 0 - только по SIGUSR1 и при завершении
+        std::string socket_path;    ///< Unix-сокет для режима сервера. Пусто - чтение стандартного ввода или input_path
+        size_t server_threads;      ///< Число потоков цикла событий сервера
+        size_t max_latency_ms;      ///< Предельное время ожидания статического пакета, 0 - без ограничения
+        LogCompression log_compress; ///< Сжатие файлов журнала
+        int    log_compress_level;  ///< Уровень сжатия
+        std::string log_dict;       ///< Файл словаря сжатия (bulk-cat --train). Пусто - без словаря
+        LogFormat log_format;       ///< Формат журнала
+        bool   intern;              ///< Интернирование команд: повторяющиеся команды хранятся один раз
+        size_t intern_capacity;     ///< Число ячеек таблицы интернирования
+        bool   dynamic_pipeline;    ///< Не использовать статический конвейер, собирать обработку из интерфейсов
+        size_t exec_threads;        ///< Число потоков пула выполнения пакетов, 0 - без пула (или по числу ядер при обработчиках)
+        std::vector<std::string> handlers; ///< Обработчики команд "PREFIX=SPEC"
+        bool   exec_unordered;      ///< Пакеты пула выводятся по готовности, а не в порядке поступления
+        size_t memory_cap;          ///< Лимит памяти пакетов, ожидающих вывода, в байтах. 0 - без ограничения
+        OverflowPolicy overflow_policy; ///< Действие при превышении memory_cap
+        std::string spill_dir;      ///< Каталог временных файлов для OverflowPolicy::kSpill. Пусто - системный
+        bool   durable;             ///< Пакет выводится в консоль только после записи журнала на носитель (групповая фиксация)
+        size_t commit_delay_us;     ///< Наибольшая задержка групповой фиксации ради накопления группы, мкс
+        std::string checkpoint_path; ///< Файл контрольной точки. Пусто - без контрольных точек
+        size_t checkpoint_every;    ///< Число пакетов между контрольными точками
+        bool   resume;              ///< Продолжить с контрольной точки checkpoint_path, а не с начала ввода
+        size_t target_p99_us;       ///< Цель p99 задержки статического пакета для подбора его размера, мкс. 0 - без цели
+        size_t min_chunk;           ///< Наименьший подбираемый размер статического пакета. 0 и target_p99_us 0 - без подбора
+        size_t max_chunk;           ///< Наибольший подбираемый размер статического пакета
     };
     bool parse_command_line(int argc, const char* argv[], Options& parsed_options);
 
@@ -25,6 +121,8 @@ namespace otus_hw7{
     struct ICommand;
     struct ICommandQueue;
     struct IProcessor;
+    struct IBulkSink;
+    class  BulkBuffer;
 
     using IQueueExecutorPtr_t = std::unique_ptr<IQueueExecutor>;
     using ICommandExecutorPtr_t = std::unique_ptr<ICommandExecutor>;
@@ -33,6 +131,7 @@ namespace otus_hw7{
     using ICommandQueuePtr_t = std::unique_ptr<ICommandQueue>;
     using IProcessorPtr_t = std::unique_ptr<IProcessor>;
     using ICommandContextPtr_t = std::unique_ptr<ICommandContext>;
+    using IBulkSinkPtr_t = std::unique_ptr<IBulkSink>;
 
     //---------------------------------------------------------------------------------------------------
     
@@ -51,8 +150,126 @@ namespace otus_hw7{
         virtual          ~IInputParser() = default;
         virtual Status   read_next_command(ICommandPtr_t& cmd) = 0;
         virtual Status   read_next_bulk(ICommandQueue& cmd_queue) = 0;        
+        virtual Status   read_next_bulk(BulkBuffer& bulk) = 0;        
+    };
+
+    /// @brief Пакет команд в непрерывном буфере: байты всех команд подряд плюс индекс (смещение, длина).
+    ///        Команды доступны как string_view, емкость буферов сохраняется между пакетами
+    class BulkBuffer
+    {
+    public:
+        using cmd_view_t = std::string_view;
+
+        class const_iterator
+        {
+        public:
+            const_iterator(BulkBuffer const& bulk, size_t idx) : bulk_(&bulk), idx_(idx) {}
+            cmd_view_t       operator*() const { return (*bulk_)[idx_]; }
+            const_iterator&  operator++() { ++idx_; return *this; }
+            bool             operator!=(const_iterator const& other) const { return idx_ != other.idx_; }
+            bool             operator==(const_iterator const& other) const { return idx_ == other.idx_; }
+        private:
+            BulkBuffer const* bulk_;
+            size_t            idx_;
+        };
+
+        time_t   created_at_ = 0;      ///< Время получения первой команды, секунды
+        uint64_t created_us_ = 0;      ///< То же время в микросекундах
+        uint64_t seq_ = 0;             ///< Порядковый номер пакета, назначается процессором при выполнении
+        BulkPart part_ = BulkPart::kWhole; ///< Порция пакета, выводимого частями; у всех порций один номер и время
+
+        /// @brief Запоминает текущее время как время получения первой команды
+        void stamp_now()
+        {
+            using namespace std::chrono;
+            created_us_ = static_cast<uint64_t>(duration_cast<microseconds>(system_clock::now().time_since_epoch()).count());
+            created_at_ = static_cast<time_t>(created_us_ / 1000000);
+        }
+
+        void push(cmd_view_t cmd)
+        {
+            index_.push_back({arena_.size(), cmd.size(), nullptr});
+            arena_.append(cmd.data(), cmd.size());
+        }
+        /// @brief Добавляет команду без копирования: буфер cmd должен жить дольше пакета
+        ///        (например, строка из таблицы интернирования)
+        void push_ref(cmd_view_t cmd)
+        {
+            index_.push_back({0, cmd.size(), cmd.data()});
+            ref_bytes_ += cmd.size();
+        }
+        cmd_view_t operator[](size_t i) const 
+        { 
+            Slice const& s = index_[i];
+            return {s.ref_ ? s.ref_ : arena_.data() + s.offset_, s.length_}; 
+        }
+        size_t  size() const { return index_.size(); }
+        bool    empty() const { return index_.empty(); }
+        /// @brief Суммарная длина команд
+        size_t  bytes() const { return arena_.size() + ref_bytes_; }
+        /// @brief Порция начинает пакет (первая или пакет целиком)
+        bool    opens() const { return part_ == BulkPart::kWhole || part_ == BulkPart::kFirst; }
+        /// @brief Порция завершает пакет (последняя или пакет целиком)
+        bool    closes() const { return part_ == BulkPart::kWhole || part_ == BulkPart::kLast; }
+        /// @brief Оценка памяти под команды пакета: байты команд и индекс
+        size_t  footprint() const { return bytes() + index_.size() * sizeof(Slice); }
+        /// @brief Копирует в пакет команды, добавленные push_ref: пакет больше не ссылается на внешние буферы
+        void    own()
+        {
+            if( !ref_bytes_ )
+                return;
+            for( Slice& s : index_ )
+                if( s.ref_ )
+                {
+                    s.offset_ = arena_.size();
+                    arena_.append(s.ref_, s.length_);
+                    s.ref_ = nullptr;
+                }
+            ref_bytes_ = 0;
+        }
+        void    clear() { arena_.clear(); index_.clear(); ref_bytes_ = 0; part_ = BulkPart::kWhole; }
+        void    swap(BulkBuffer& other) noexcept
+        {
+            std::swap(created_at_, other.created_at_);
+            std::swap(created_us_, other.created_us_);
+            std::swap(seq_, other.seq_);
+            std::swap(part_, other.part_);
+            std::swap(ref_bytes_, other.ref_bytes_);
+            arena_.swap(other.arena_);
+            index_.swap(other.index_);
+        }
+
+        const_iterator begin() const { return {*this, 0}; }
+        const_iterator end() const { return {*this, size()}; }
+
+    private:
+        struct Slice
+        {
+            size_t      offset_, length_;
+            const char* ref_;           ///< Внешний буфер команды, nullptr - команда в arena_
+        };
+        std::string         arena_;
+        std::vector<Slice>  index_;
+        size_t              ref_bytes_ = 0;
     };
 
+    /// @brief Приемник готовых пакетов: консоль, файл и т.п. Пакет приходит уже отформатированным
+    ///        в text ("bulk: a, b, c\n"), форматирование выполняется один раз на все приемники
+    struct IBulkSink
+    {
+        virtual      ~IBulkSink() = default;
+        virtual void write(BulkBuffer const& bulk, std::string_view text) = 0;
+        /// @brief Сбрасывает накопленный вывод, вызывается по окончании работы
+        virtual void flush() {}
+        /// @brief Сбрасывает вывод и дожидается его записи на носитель. Журналы на диске
+        ///        синхронизируют файлы, остальным приемникам достаточно сброса
+        virtual void sync() { flush(); }
+    };
+
+    /// @brief Форматирует пакет в текстовый вид "bulk: a, b, c\n", дописывая его в out.
+    ///        Порция пакета продолжает строку предыдущей: "bulk: a, b" + ", c" + ", d\n"
+    void format_bulk(BulkBuffer const& bulk, std::string& out);
+
     /// @brief Очередь команд. Формируется парсером, затем выполняется исполнителем под управлением процессора.
     struct ICommandQueue
     {
@@ -84,6 +301,8 @@ namespace otus_hw7{
     {
         virtual      ~IQueueExecutor() = default;
         virtual void execute(ICommandQueue& cmd_q, ICommandExecutor& cmd_executor, ICommandContext& ctx) = 0;
+        /// @brief Дожидается выполнения переданных очередей (для исполнителей, выполняющих их асинхронно)
+        virtual void wait() {}
     };
 
     /// @brief Контекст выполнения команды
@@ -109,5 +328,44 @@ namespace otus_hw7{
     /// @param options 
     /// @return Интерфейс созданного объекта  
     IProcessorPtr_t create_processor(Options& options);
+
+    /// @brief Встраиваемый разбор команд без потоков ввода и отдельного процесса: байты подаются порциями,
+    ///        готовые пакеты передаются обработчику. Пакеты формируются по тем же правилам, что и у процессора:
+    ///        статические по chunk_size, динамические между { и }
+    struct IBulkFeeder
+    {
+        /// @brief Обработчик готового пакета. Команды пакета могут ссылаться на порцию, переданную в feed,
+        ///        поэтому они действительны только до возврата из обработчика
+        using BulkCallback_t = std::function<void(BulkBuffer const& bulk)>;
+
+        virtual ~IBulkFeeder() = default;
+        /// @brief Разбирает очередную порцию; строка может продолжаться в следующей порции.
+        ///        Обработчик вызывается из feed для каждого пакета, завершенного порцией
+        virtual void feed(const char* data, size_t size) = 0;
+        /// @brief Конец ввода: отдает статический пакет, незавершенный динамический блок отбрасывается.
+        ///        После finish можно подавать новый ввод, номера пакетов продолжаются
+        virtual void finish() = 0;
+        /// @brief Отдает статический пакет, ожидающий дольше max_latency. Вызывается периодически,
+        ///        если ввод может надолго прерываться
+        virtual void poll() = 0;
+    };
+    using IBulkFeederPtr_t = std::unique_ptr<IBulkFeeder>;
+
+    /// @brief Фабрика встраиваемого разбора
+    /// @param max_latency Предельное время ожидания статического пакета, 0 - без ограничения
+    IBulkFeederPtr_t create_feeder(size_t chunk_size, IBulkFeeder::BulkCallback_t on_bulk, std::chrono::milliseconds max_latency = {});
+
+    /// @brief Вывод метрик работы в файл статистики; при разрушении выводит итоговые метрики
+    struct IStatsReporter
+    {
+        virtual ~IStatsReporter() = default;
+        virtual void dump(const char* reason) = 0;
+    };
+    using IStatsReporterPtr_t = std::unique_ptr<IStatsReporter>;
+
+    /// @brief Фабрика вывода метрик
+    /// @param options 
+    /// @return nullptr, если файл статистики не задан или метрики отключены при сборке
+    IStatsReporterPtr_t create_stats_reporter(Options& options);
 } // otus_hw7
 
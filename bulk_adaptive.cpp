@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+
+#include "bulk_adaptive.h"
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    namespace {
+        constexpr double kAlpha = 0.125;        ///< Вес нового замера в скользящих средних
+        constexpr double kHeadroom = 1.25;      ///< Запас пропускной способности вывода над темпом ввода
+
+        double seconds(ChunkController::clock_t::duration d)
+        {
+            return std::chrono::duration<double>(d).count();
+        }
+
+        void smooth(double& avg, double v, bool first)
+        {
+            avg = first ? v : avg + kAlpha * (v - avg);
+        }
+    }
+
+    ChunkController::ChunkController(ChunkTargets const& targets, size_t initial) : targets_(targets)
+    {
+        targets_.min_ = std::max<size_t>(targets_.min_, 1);
+        targets_.max_ = std::max(targets_.max_, targets_.min_);
+        chunk_ = std::min(std::max(initial, targets_.min_), targets_.max_);
+        latency_us_.reserve(kWindow);
+        BULK_METRIC_GAUGE(kChunkSize, chunk_);
+    }
+
+    void ChunkController::bulk_ready(size_t n, clock_t::time_point first_at, clock_t::time_point now, uint64_t waited_ns)
+    {
+        if( has_ready_ )
+        {
+            // интервал включает вывод предыдущего пакета и разбор этого; ожидание ввода - простой
+            double const interval = seconds(now - last_ready_);
+            double const busy = std::max(interval - double(waited_ns - last_waited_ns_) * 1e-9, 0.);
+            bool const first = !has_cost_;
+            smooth(cmds_, double(n), first);
+            smooth(dt_, interval, first);
+            smooth(sn_, double(n), first);
+            smooth(sc_, busy, first);
+            smooth(snn_, double(n) * double(n), first);
+            smooth(snc_, double(n) * busy, first);
+            has_cost_ = true;
+        }
+        has_ready_ = true;
+        last_ready_ = now;
+        last_waited_ns_ = waited_ns;
+        pending_ = true;
+        pending_first_ = first_at;
+    }
+
+    void ChunkController::bulk_done(clock_t::time_point now)
+    {
+        if( !pending_ )
+            return;
+        pending_ = false;
+
+        uint64_t const latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - pending_first_).count());
+        if( latency_us_.size() < kWindow )
+            latency_us_.push_back(latency);
+        else
+            latency_us_[latency_pos_] = latency;
+        latency_pos_ = (latency_pos_ + 1) % kWindow;
+
+        if( ++since_adjust_ >= kAdjustEvery )
+            adjust();
+    }
+
+    uint64_t ChunkController::p99_us() const
+    {
+        if( latency_us_.empty() )
+            return 0;
+        std::vector<uint64_t> window(latency_us_);
+        size_t const idx = std::min(window.size() - 1, static_cast<size_t>(std::ceil(0.99 * double(window.size()))) - 1);
+        std::nth_element(window.begin(), window.begin() + static_cast<std::ptrdiff_t>(idx), window.end());
+        return window[idx];
+    }
+
+    void ChunkController::adjust()
+    {
+        since_adjust_ = 0;
+        double const rate = input_rate();
+        if( rate <= 0 )
+            return;
+
+        // занятость a + b * N по методу наименьших квадратов; пока размер не менялся,
+        // вся занятость считается накладными расходами пакета - это толкает размер вверх, а не вниз
+        double b = 0, a = sc_;
+        double const var = snn_ - sn_ * sn_;
+        if( var > 1e-6 * snn_ )
+        {
+            b = std::max((snc_ - sn_ * sc_) / var, 0.);
+            a = std::max(sc_ - b * sn_, 0.);
+        }
+
+        // обработка должна успевать за вводом: (a / N + b) * rate * kHeadroom <= 1; округление вверх,
+        // иначе при насыщении малый размер не вырастет (1 * kHeadroom округлилось бы в 1)
+        double const per_cmd = 1. / (rate * kHeadroom);
+        double target = b < per_cmd ? std::ceil(a / (per_cmd - b)) : double(targets_.max_);
+
+        uint64_t const p99 = p99_us();
+        BULK_METRIC_GAUGE(kInputRate, static_cast<uint64_t>(rate));
+        BULK_METRIC_GAUGE(kBulkP99Us, p99);
+        if( targets_.p99_.count() )
+        {
+            double const goal = double(targets_.p99_.count());
+            if( double(p99) > goal )
+                scale_ = std::max(scale_ * 0.8, 0.05);
+            else if( double(p99) < 0.8 * goal )
+                scale_ = std::min(scale_ * 1.1, 1.);
+            // первая команда ждет еще N - 1 команд и вывод: (N - 1) / rate + a + b * N <= p99
+            double const budget = goal * 1e-6 * scale_;
+            double const fits = (budget - a + 1. / rate) / (1. / rate + b);
+            target = std::max(target, std::min(fits, double(targets_.max_)));
+        }
+
+        // не больше чем вдвое за шаг, чтобы одиночный выброс замеров не раскачивал размер
+        double const limited = std::min(std::max(target, double(chunk_) / 2), double(chunk_) * 2);
+        size_t const next = std::min(std::max(static_cast<size_t>(std::llround(limited)), targets_.min_), targets_.max_);
+        if( next != chunk_ )
+        {
+            chunk_ = next;
+            BULK_METRIC_GAUGE(kChunkSize, chunk_);
+        }
+    }
+
+    void ChunkFeedbackSink::write(BulkBuffer const&, std::string_view)
+    {
+        ctl_->bulk_done(ChunkController::clock_t::now());
+    }
+
+} // otus_hw7
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    /// @brief Цели подбора размера статического пакета
+    struct ChunkTargets
+    {
+        std::chrono::microseconds   p99_{0};    ///< Целевой p99 задержки первой команды пакета до его вывода, 0 - без цели
+        size_t                      min_ = 1;   ///< Наименьший размер пакета
+        size_t                      max_ = 4096; ///< Наибольший размер пакета
+    };
+
+    /// @brief Подбор размера статического пакета по темпу ввода и стоимости вывода.
+    ///        Занятость между готовыми пакетами (интервал без ожидания ввода: разбор и вывод) оценивается
+    ///        как a + b * N - накладные расходы пакета и команды, темп ввода - по интервалам между готовыми
+    ///        пакетами. Пока вывод не успевает, измеренный темп равен пропускной способности, и запас
+    ///        kHeadroom растит размер, пока ожидание ввода не появится снова. Размер выбирается наименьшим, при котором
+    ///        вывод с запасом успевает за вводом; при цели p99 - наибольшим, при котором ожидание
+    ///        заполнения пакета и его вывод укладываются в цель, но не меньше нужного для пропускной
+    ///        способности. Оценка по модели поправляется по измеренному p99 последних пакетов.
+    ///        Динамические блоки не затрагиваются: они не учитываются и не ограничиваются размером.
+    ///        Парсер и приемники вызывают контроллер из одного потока
+    class ChunkController
+    {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        static constexpr size_t kWindow = 128;          ///< Пакетов в окне расчета p99
+        static constexpr size_t kAdjustEvery = 16;      ///< Пакетов между пересчетами размера
+
+        ChunkController(ChunkTargets const& targets, size_t initial);
+
+        /// @brief Текущий размер статического пакета
+        size_t  chunk() const { return chunk_; }
+
+        /// @brief Статический пакет из n команд готов; первая команда получена в first_at
+        /// @param waited_ns Суммарное время ожидания ввода к моменту now (ILineSource::waited_ns)
+        void    bulk_ready(size_t n, clock_t::time_point first_at, clock_t::time_point now, uint64_t waited_ns);
+        /// @brief Последний готовый пакет выведен всеми приемниками
+        void    bulk_done(clock_t::time_point now);
+
+        /// @brief Оценка темпа ввода, команд в секунду
+        double  input_rate() const { return dt_ > 0 ? cmds_ / dt_ : 0; }
+        /// @brief p99 задержки пакетов окна, мкс
+        uint64_t p99_us() const;
+
+    private:
+        void    adjust();
+
+        ChunkTargets    targets_;
+        size_t          chunk_;
+
+        bool                pending_ = false, has_ready_ = false;
+        clock_t::time_point pending_first_, last_ready_;
+        uint64_t            last_waited_ns_ = 0;
+
+        double      cmds_ = 0, dt_ = 0;                     ///< Скользящие средние команд пакета и интервала, с
+        double      sn_ = 0, sc_ = 0, snn_ = 0, snc_ = 0;   ///< Скользящие моменты размера и занятости для МНК
+        bool        has_cost_ = false;
+        double      scale_ = 1;                             ///< Поправка модели по измеренному p99
+
+        std::vector<uint64_t>   latency_us_;                ///< Кольцо задержек окна
+        size_t                  latency_pos_ = 0, since_adjust_ = 0;
+    };
+    using ChunkControllerPtr_t = std::shared_ptr<ChunkController>;
+
+    /// @brief Замыкающий приемник: сообщает контроллеру, что пакет выведен
+    class ChunkFeedbackSink final : public IBulkSink
+    {
+    public:
+        explicit ChunkFeedbackSink(ChunkControllerPtr_t ctl) : ctl_(std::move(ctl)) {}
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override {}
+    private:
+        ChunkControllerPtr_t ctl_;
+    };
+
+} // otus_hw7
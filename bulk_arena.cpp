@@ -0,0 +1,108 @@
+#include <cstring>
+#include <iostream>
+
+#include "bulk_arena.h"
+
+namespace otus_hw7{
+
+    CommandArena::CommandArena()
+        : block_(new std::byte[kBlockSize]), res_(block_.get(), kBlockSize)
+    {
+    }
+
+    void* CommandArena::allocate(size_t size)
+    {
+        void* const p = res_.allocate(sizeof(Header) + size, alignof(Header));
+        used_ += sizeof(Header) + size;
+        static_cast<Header*>(p)->arena_ = this;
+        add_ref();
+        return static_cast<Header*>(p) + 1;
+    }
+
+    void CommandArena::release(void* p) noexcept
+    {
+        if( p )
+            (static_cast<Header*>(p) - 1)->arena_->remove_ref();
+    }
+
+    std::string_view CommandArena::store(std::string_view s)
+    {
+        if( s.empty() )
+            return {};
+        auto const dst = static_cast<char*>(res_.allocate(s.size(), 1));
+        used_ += s.size();
+        std::memcpy(dst, s.data(), s.size());
+        return std::string_view(dst, s.size());
+    }
+
+    void CommandArena::remove_ref() noexcept
+    {
+        if( refs_.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+        {
+            // пул может держать только эта арена: после recycle он и арена разрушатся вместе
+            ArenaPoolPtr_t pool = std::move(pool_);
+            pool->recycle(this);
+        }
+    }
+
+    CommandArena* ArenaPool::acquire()
+    {
+        std::unique_ptr<CommandArena> arena;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if( !free_.empty() )
+            {
+                arena = std::move(free_.back());
+                free_.pop_back();
+            }
+        }
+        if( !arena )
+        {
+            arena.reset(new CommandArena);
+            created_.fetch_add(1, std::memory_order_relaxed);
+        }
+        arena->pool_ = shared_from_this();
+        arena->refs_.store(1, std::memory_order_relaxed);
+        return arena.release();
+    }
+
+    size_t ArenaPool::free_count()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return free_.size();
+    }
+
+    void ArenaPool::recycle(CommandArena* arena) noexcept
+    {
+        std::unique_ptr<CommandArena> holder(arena);
+        holder->res_.release();
+        holder->used_ = 0;
+        std::lock_guard<std::mutex> lk(mtx_);
+        if( free_.size() < kMaxFree )
+            free_.push_back(std::move(holder));
+    }
+
+    void ArenaCommand::execute(ICommandContext& ctx)
+    {
+        ctx.os_ << (!ctx.cmd_idx_ ? "bulk: ": ", ") << cmd_;
+        if( ctx.bulk_size_ - ctx.cmd_idx_ < 2 )
+            ctx.os_ << std::endl;
+    }
+
+    ICommandPtr_t ArenaCommandCreator::create_command(const command_data_t& cmd) const
+    {
+        if( !current_ )
+            current_ = pool_->acquire();
+        return ICommandPtr_t{ new (*current_) ArenaCommand(current_->store(cmd)) };
+    }
+
+    void ArenaCommandCreator::end_bulk()
+    {
+        if( current_ )
+        {
+            current_->remove_ref();
+            current_ = nullptr;
+        }
+    }
+
+} // otus_hw7
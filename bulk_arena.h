@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "bulk_internal.h"
+
+namespace otus_hw7{
+
+    class ArenaPool;
+    using ArenaPoolPtr_t = std::shared_ptr<ArenaPool>;
+
+    /// @brief Монотонная арена команд одного пакета: команды и их строки размещаются подряд
+    ///        (std::pmr::monotonic_buffer_resource поверх собственного блока) и по отдельности не освобождаются.
+    ///        Арена считает ссылки: по одной на каждую живую команду и одну у фабрики, пока пакет читается.
+    ///        Когда ссылок не остается, арена целиком за O(1) сбрасывается и возвращается в пул
+    class CommandArena
+    {
+    public:
+        static constexpr size_t kBlockSize = size_t(16) << 10;
+
+        CommandArena();
+        CommandArena(CommandArena const&) = delete;
+        CommandArena& operator=(CommandArena const&) = delete;
+
+        /// @brief Память под объект; перед объектом хранится указатель на арену, поэтому
+        ///        освобождение по указателю на объект (release) находит свою арену
+        void*               allocate(size_t size);
+        /// @brief Освобождение объекта, размещенного allocate: снимает ссылку объекта на арену
+        static void         release(void* p) noexcept;
+        /// @brief Копия строки в арене, живет до сброса арены
+        std::string_view    store(std::string_view s);
+
+        void    add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+        void    remove_ref() noexcept;
+        /// @brief Занято байт с последнего сброса
+        size_t  used() const { return used_; }
+
+    private:
+        friend class ArenaPool;
+        struct alignas(std::max_align_t) Header
+        {
+            CommandArena* arena_;
+        };
+
+        std::unique_ptr<std::byte[]>        block_;
+        std::pmr::monotonic_buffer_resource res_;
+        std::atomic<size_t>                 refs_{0};
+        size_t                              used_ = 0;
+        ArenaPoolPtr_t                      pool_;      ///< Пул, куда вернуть арену; задан, пока арена выдана
+    };
+
+    /// @brief Пул арен со списком свободных: сброшенные арены переиспользуются вместе с блоками,
+    ///        поэтому в установившемся режиме пакеты команд не обращаются к куче.
+    ///        Выданная арена держит пул, так что команды могут пережить фабрику
+    class ArenaPool : public std::enable_shared_from_this<ArenaPool>
+    {
+    public:
+        static constexpr size_t kMaxFree = 64;
+
+        ArenaPool() { free_.reserve(kMaxFree); }
+
+        /// @brief Свободная или новая арена с одной ссылкой у вызывающего
+        CommandArena*   acquire();
+        /// @brief Число арен в списке свободных
+        size_t          free_count();
+        /// @brief Число созданных арен
+        size_t          created() const { return created_.load(std::memory_order_relaxed); }
+
+    private:
+        friend class CommandArena;
+        void recycle(CommandArena* arena) noexcept;
+
+        std::mutex                                  mtx_;
+        std::vector<std::unique_ptr<CommandArena>>  free_;
+        std::atomic<size_t>                         created_{0};
+    };
+
+    /// @brief Команда, размещенная в арене пакета вместе со строкой. delete только снимает ссылку на арену
+    class ArenaCommand : public ICommand
+    {
+    public:
+        explicit ArenaCommand(std::string_view cmd) : cmd_(cmd) {}
+        virtual void execute(ICommandContext& ctx) override;
+
+        static void* operator new(size_t size, CommandArena& arena) { return arena.allocate(size); }
+        static void  operator delete(void* p, CommandArena&) noexcept { CommandArena::release(p); }
+        static void  operator delete(void* p) noexcept { CommandArena::release(p); }
+    private:
+        std::string_view cmd_;
+    };
+
+    /// @brief Фабрика команд, размещающая команды каждого пакета в отдельной арене из пула.
+    ///        Арена пакета сменяется по end_bulk, ее память освобождается, когда выполнены все команды пакета
+    class ArenaCommandCreator : public ICommandCreator
+    {
+    public:
+        explicit ArenaCommandCreator(ArenaPoolPtr_t pool = std::make_shared<ArenaPool>()) : pool_(std::move(pool)) {}
+        ~ArenaCommandCreator() { end_bulk(); }
+        ArenaCommandCreator(ArenaCommandCreator const&) = delete;
+        ArenaCommandCreator& operator=(ArenaCommandCreator const&) = delete;
+
+        virtual ICommandPtr_t create_command(const command_data_t& cmd) const override;
+        virtual void          end_bulk() override;
+
+        ArenaPool&            pool() const { return *pool_; }
+
+    private:
+        ArenaPoolPtr_t          pool_;
+        mutable CommandArena*   current_ = nullptr;
+    };
+
+} // otus_hw7
@@ -0,0 +1,92 @@
+#include <iostream>
+
+#include "bulk_async.h"
+
+namespace otus_hw7{
+
+    ostream& operator<<(ostream& os, WorkerStats const& st)
+    {
+        return os << st.name_ << " - bulks: " << st.bulks_ << ", commands: " << st.cmds_;
+    }
+
+    void BulkWorker::run()
+    {
+        FormattedBulkPtr_t batch[kPopBatch];
+        while( size_t const n = pop_(batch, kPopBatch) )
+        {
+            for( size_t i = 0; i < n; ++i )
+            {
+                BULK_METRIC_RECORD(kQueueWait, metrics_now_ns() - batch[i]->enqueued_ns_);
+                sink_->write(batch[i]->bulk_, batch[i]->text_);
+                stats_.bulks_ += batch[i]->bulk_.closes();
+                stats_.cmds_ += batch[i]->bulk_.size();
+                batch[i].reset();
+            }
+        }
+        sink_->flush();
+    }
+
+    AsyncProcessor::AsyncProcessor(IInputParserPtr_t parser, IBulkSinkPtr_t console_sink, std::vector<IBulkSinkPtr_t> log_sinks,
+                                   size_t queue_capacity, ostream& stats_os)
+        : BulkProcessor(std::move(parser), {}),
+          console_q_(queue_capacity), log_q_(queue_capacity), stats_os_(stats_os)
+    {
+        main_stats_.name_ = "main";
+        workers_.emplace_back(new BulkWorker("console", make_pop_batch(console_q_), std::move(console_sink)));
+        for( size_t i = 0; i < log_sinks.size(); ++i )
+            workers_.emplace_back(new BulkWorker("file" + std::to_string(i + 1), make_pop_batch(log_q_), std::move(log_sinks[i])));
+        for( auto& w : workers_ )
+            w->start();
+    }
+
+    AsyncProcessor::~AsyncProcessor()
+    {
+        shutdown();
+    }
+
+    void AsyncProcessor::process()
+    {
+        BulkProcessor::process();
+        shutdown();
+    }
+
+    void AsyncProcessor::shutdown()
+    {
+        if( stopped_ )
+            return;
+        stopped_ = true;
+
+        console_q_.close();
+        log_q_.close();
+        for( auto& w : workers_ )
+            w->join();
+
+        stats_os_ << main_stats_ << std::endl;
+        for( auto& w : workers_ )
+            stats_os_ << w->stats() << std::endl;
+    }
+
+    void AsyncProcessor::exec_bulk()
+    {
+        if( bulk_.empty() )
+            return;
+
+        if( bulk_.opens() )
+            ++bulk_seq_;
+        bulk_.seq_ = bulk_seq_;
+        FormattedBulkPtr_t bulk = pool_.acquire();
+        bulk->bulk_.swap(bulk_);
+        format_bulk(bulk->bulk_, bulk->text_);
+        if( budget_ )
+            bulk->charge(*budget_);
+
+        main_stats_.bulks_ += bulk->bulk_.closes();
+        main_stats_.cmds_ += bulk->bulk_.size();
+        BULK_METRIC_BULK(bulk->bulk_.size());
+        BULK_METRIC_ONLY(bulk->enqueued_ns_ = metrics_now_ns();)
+
+        console_q_.push(bulk);
+        log_q_.push(std::move(bulk));
+    }
+
+} // otus_hw7
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bulk_internal.h"
+#include "bulk_metrics.h"
+#include "bulk_ring.h"
+
+namespace otus_hw7{
+
+    /// @brief Ограниченная блокирующая очередь на мьютексе и условных переменных.
+    ///        Конвейер использует очереди на кольцах (bulk_ring.h), эта оставлена для сравнения
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+        /// @brief Помещает элемент в очередь, ожидая освобождения места
+        /// @return false, если очередь уже закрыта
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            not_full_.wait(lk, [this]{ return closed_ || q_.size() < capacity_; });
+            if( closed_ )
+                return false;
+            q_.push_back(std::move(item));
+            lk.unlock();
+            not_empty_.notify_one();
+            return true;
+        }
+
+        /// @brief Извлекает элемент, ожидая его появления
+        /// @return false, если очередь закрыта и все элементы уже извлечены
+        bool pop(T& item)
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            not_empty_.wait(lk, [this]{ return closed_ || !q_.empty(); });
+            if( q_.empty() )
+                return false;
+            item = std::move(q_.front());
+            q_.pop_front();
+            lk.unlock();
+            not_full_.notify_one();
+            return true;
+        }
+
+        /// @brief Закрывает очередь: новые элементы не принимаются, оставшиеся дочитываются
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lk(mtx_);
+                closed_ = true;
+            }
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            return q_.size();
+        }
+
+    private:
+        size_t                  capacity_;
+        bool                    closed_ = false;
+        std::deque<T>           q_;
+        mutable std::mutex      mtx_;
+        std::condition_variable not_empty_, not_full_;
+    };
+
+    /// @brief Пул объектов: объект, освобожденный всеми владельцами, очищается вызовом clear()
+    ///        с сохранением емкости и возвращается в пул для повторного использования
+    template <typename T>
+    class ObjectPool
+    {
+    public:
+        ObjectPool() = default;
+        ObjectPool(ObjectPool const&) = delete;
+        ObjectPool& operator=(ObjectPool const&) = delete;
+
+        std::shared_ptr<T> acquire()
+        {
+            std::unique_ptr<T> obj;
+            {
+                std::lock_guard<std::mutex> lk(mtx_);
+                if( !free_.empty() )
+                {
+                    obj = std::move(free_.back());
+                    free_.pop_back();
+                }
+            }
+            if( !obj )
+                obj.reset(new T);
+            return std::shared_ptr<T>(obj.release(), [this](T* p){ release(p); });
+        }
+
+    private:
+        void release(T* p)
+        {
+            std::unique_ptr<T> holder(p);
+            holder->clear();
+            std::lock_guard<std::mutex> lk(mtx_);
+            free_.push_back(std::move(holder));
+        }
+
+        std::mutex                      mtx_;
+        std::vector<std::unique_ptr<T>> free_;
+    };
+
+    /// @brief Пакет вместе с его текстовым представлением, передается потокам вывода
+    struct FormattedBulk
+    {
+        BulkBuffer  bulk_;
+        std::string text_;
+        BULK_METRIC_ONLY(uint64_t enqueued_ns_ = 0;)   ///< Момент постановки в очередь, для задержки ожидания
+        MemoryBudget* budget_ = nullptr;                ///< Бюджет, учитывающий пакет, пока он в очереди
+        size_t        charged_ = 0;
+
+        /// @brief Учитывает пакет в бюджете до возврата в пул
+        void charge(MemoryBudget& budget)
+        {
+            budget_ = &budget;
+            charged_ = bulk_.footprint() + text_.size();
+            budget.charge(charged_);
+        }
+        void clear()
+        {
+            if( budget_ )
+                budget_->release(charged_);
+            budget_ = nullptr;
+            bulk_.clear();
+            text_.clear();
+        }
+    };
+    using FormattedBulkPtr_t = std::shared_ptr<FormattedBulk>;
+    using ConsoleQueue_t = SpscQueue<FormattedBulkPtr_t>;   ///< Поток чтения -> поток консоли
+    using LogQueue_t = MpmcQueue<FormattedBulkPtr_t>;       ///< Поток чтения -> пул потоков записи в файлы
+
+    /// @brief Извлечение пачки пакетов из очереди: возвращает число извлеченных, 0 - очередь закрыта
+    using BulkPopBatch_t = std::function<size_t(FormattedBulkPtr_t*, size_t)>;
+
+    template <typename Queue>
+    BulkPopBatch_t make_pop_batch(Queue& q)
+    {
+        return [&q](FormattedBulkPtr_t* out, size_t max){ return q.pop_batch(out, max); };
+    }
+
+    /// @brief Счетчики потока обработки пакетов
+    struct WorkerStats
+    {
+        std::string name_;
+        size_t      bulks_ = 0, cmds_ = 0;
+    };
+    ostream& operator<<(ostream& os, WorkerStats const& st);
+
+    /// @brief Поток вывода: забирает пакеты из очереди пачками и отдает их своему приемнику
+    class BulkWorker
+    {
+    public:
+        static constexpr size_t kPopBatch = 16;
+
+        BulkWorker(std::string name, BulkPopBatch_t pop, IBulkSinkPtr_t sink)
+            : pop_(std::move(pop)), sink_(std::move(sink)) { stats_.name_ = std::move(name); }
+        ~BulkWorker() { join(); }
+
+        void start() { thread_ = std::thread(&BulkWorker::run, this); }
+        void join() { if( thread_.joinable() ) thread_.join(); }
+        WorkerStats const& stats() const { return stats_; }
+
+    private:
+        void run();
+
+        BulkPopBatch_t      pop_;
+        IBulkSinkPtr_t      sink_;
+        WorkerStats         stats_;
+        std::thread         thread_;
+    };
+    using BulkWorkerPtr_t = std::unique_ptr<BulkWorker>;
+
+    /// @brief Процессор с конвейерным выводом: поток чтения только формирует пакеты,
+    ///        консоль и файлы обслуживаются отдельными потоками через ограниченные очереди
+    class AsyncProcessor : public BulkProcessor
+    {
+    public:
+        /// @param console_sink Приемник для потока консоли
+        /// @param log_sinks    Приемники для потоков записи в файлы, по одному на поток
+        AsyncProcessor(IInputParserPtr_t parser, IBulkSinkPtr_t console_sink, std::vector<IBulkSinkPtr_t> log_sinks,
+                       size_t queue_capacity, ostream& stats_os = std::cerr);
+        ~AsyncProcessor();
+
+        void process() override;
+
+        /// @brief Дожидается вывода всех пакетов, останавливает потоки и выводит их счетчики
+        void shutdown();
+        /// @brief Учет пакетов в очередях в бюджете памяти; бюджет передается и парсеру
+        void set_budget(MemoryBudgetPtr_t budget) { budget_ = std::move(budget); }
+
+    protected:
+        void exec_bulk() override;
+
+    private:
+        MemoryBudgetPtr_t               budget_;        ///< Объявлен до пула: пакеты пула снимают учет при разрушении
+        ObjectPool<FormattedBulk>       pool_;
+        ConsoleQueue_t                  console_q_;
+        LogQueue_t                      log_q_;
+        std::vector<BulkWorkerPtr_t>    workers_;
+        WorkerStats                     main_stats_;
+        ostream&                        stats_os_;
+        bool                            stopped_ = false;
+    };
+
+} // otus_hw7
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+
+#include "bulk_binlog.h"
+
+namespace otus_hw7{
+
+    namespace {
+        void put_u32(std::string& out, uint32_t v)
+        {
+            char b[4];
+            for( size_t i = 0; i < sizeof(b); ++i )
+                b[i] = static_cast<char>(v >> (8 * i));
+            out.append(b, sizeof(b));
+        }
+
+        void put_u64(std::string& out, uint64_t v)
+        {
+            char b[8];
+            for( size_t i = 0; i < sizeof(b); ++i )
+                b[i] = static_cast<char>(v >> (8 * i));
+            out.append(b, sizeof(b));
+        }
+
+        uint32_t get_u32(const char* p)
+        {
+            uint32_t v = 0;
+            for( size_t i = 0; i < 4; ++i )
+                v |= uint32_t(static_cast<unsigned char>(p[i])) << (8 * i);
+            return v;
+        }
+
+        uint64_t get_u64(const char* p)
+        {
+            uint64_t v = 0;
+            for( size_t i = 0; i < 8; ++i )
+                v |= uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+            return v;
+        }
+
+        bool entry_less(binlog::IndexEntry const& a, binlog::IndexEntry const& b)
+        {
+            return a.created_us_ != b.created_us_ ? a.created_us_ < b.created_us_ : a.seq_ < b.seq_;
+        }
+    }
+
+    BinaryLogSink::~BinaryLogSink()
+    {
+        try
+        {
+            close_segment();
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    bool BinaryLogSink::rotate_due(size_t size) const
+    {
+        if( data_fd_ < 0 )
+            return true;
+        if( !index_.empty() && seg_bytes_ + size > seg_opts_.max_bytes_ )
+            return true;
+        return seg_opts_.max_age_.count() && std::chrono::steady_clock::now() - opened_at_ >= seg_opts_.max_age_;
+    }
+
+    void BinaryLogSink::open_segment(BulkBuffer const& bulk)
+    {
+        data_fd_ = open_for_append(get_bulk_file_stem(bulk) + binlog::kExtension);
+        new_segment_ = true;
+        buf_.append(binlog::kFileMagic, sizeof(binlog::kFileMagic));
+        seg_bytes_ = sizeof(binlog::kFileMagic);
+        opened_at_ = std::chrono::steady_clock::now();
+    }
+
+    void BinaryLogSink::close_segment()
+    {
+        if( data_fd_ < 0 )
+            return;
+        std::sort(index_.begin(), index_.end(), entry_less);
+        for( auto const& e : index_ )
+        {
+            put_u64(buf_, e.created_us_);
+            put_u64(buf_, e.seq_);
+            put_u64(buf_, e.offset_);
+        }
+        put_u64(buf_, seg_bytes_);
+        put_u64(buf_, index_.size());
+        buf_.append(binlog::kIndexMagic, sizeof(binlog::kIndexMagic));
+        flush();
+        if( seg_opts_.durable_ )
+            sync_fd(data_fd_);
+        close_fd(data_fd_);
+        data_fd_ = -1;
+        index_.clear();
+    }
+
+    void BinaryLogSink::write(BulkBuffer const& bulk, std::string_view)
+    {
+        size_t const payload = bulk.bytes() + 4 * bulk.size();
+        if( rotate_due(binlog::kBulkHeaderSize + payload) )
+        {
+            close_segment();
+            open_segment(bulk);
+        }
+
+        index_.push_back({bulk.created_us_, bulk.seq_, seg_bytes_});
+        put_u64(buf_, bulk.seq_);
+        put_u64(buf_, bulk.created_us_);
+        put_u32(buf_, static_cast<uint32_t>(bulk.size()));
+        put_u32(buf_, static_cast<uint32_t>(payload));
+        for( auto cmd : bulk )
+        {
+            put_u32(buf_, static_cast<uint32_t>(cmd.size()));
+            buf_.append(cmd.data(), cmd.size());
+        }
+        seg_bytes_ += binlog::kBulkHeaderSize + payload;
+
+        if( flush_ctl_.due(buf_.size()) )
+            flush();
+    }
+
+    void BinaryLogSink::flush()
+    {
+        if( data_fd_ >= 0 )
+            write_all(data_fd_, buf_.data(), buf_.size());
+        buf_.clear();
+        flush_ctl_.flushed();
+    }
+
+    void BinaryLogSink::sync()
+    {
+        flush();
+        if( data_fd_ < 0 )
+            return;
+        sync_fd(data_fd_);
+        if( new_segment_ )
+            sync_dir(".");
+        new_segment_ = false;
+    }
+
+    BinaryLogReader::BinaryLogReader(std::string const& path) : path_(path), is_(path, std::ios_base::in | std::ios_base::binary)
+    {
+        if( !is_ )
+            throw std::system_error(errno, std::generic_category(), "open " + path_);
+        is_.seekg(0, std::ios_base::end);
+        file_size_ = static_cast<uint64_t>(is_.tellg());
+
+        char magic[sizeof(binlog::kFileMagic)];
+        if( file_size_ < sizeof(magic) )
+            throw std::runtime_error(path_ + ": not a binary bulk log");
+        read_at(0, magic, sizeof(magic));
+        if( std::memcmp(magic, binlog::kFileMagic, sizeof(magic)) )
+            throw std::runtime_error(path_ + ": not a binary bulk log");
+
+        if( file_size_ >= sizeof(magic) + binlog::kTrailerSize )
+        {
+            char trailer[binlog::kTrailerSize];
+            read_at(file_size_ - sizeof(trailer), trailer, sizeof(trailer));
+            uint64_t const index_offset = get_u64(trailer), count = get_u64(trailer + 8);
+            if( !std::memcmp(trailer + 16, binlog::kIndexMagic, sizeof(binlog::kIndexMagic)) &&
+                index_offset <= file_size_ && count <= (file_size_ - index_offset) / binlog::kIndexEntrySize &&
+                index_offset + count * binlog::kIndexEntrySize + sizeof(trailer) == file_size_ )
+            {
+                index_offset_ = index_offset;
+                count_ = static_cast<size_t>(count);
+                index_on_disk_ = true;
+                return;
+            }
+        }
+        scan();
+    }
+
+    void BinaryLogReader::scan()
+    {
+        char header[binlog::kBulkHeaderSize];
+        for( uint64_t offset = sizeof(binlog::kFileMagic); offset + sizeof(header) <= file_size_; )
+        {
+            read_at(offset, header, sizeof(header));
+            uint64_t const next = offset + sizeof(header) + get_u32(header + 20);
+            if( next > file_size_ )
+                break;
+            index_.push_back({get_u64(header + 8), get_u64(header), offset});
+            offset = next;
+        }
+        std::sort(index_.begin(), index_.end(), entry_less);
+        count_ = index_.size();
+    }
+
+    void BinaryLogReader::read_at(uint64_t offset, char* dst, size_t size)
+    {
+        is_.clear();
+        is_.seekg(static_cast<std::streamoff>(offset));
+        is_.read(dst, static_cast<std::streamsize>(size));
+        if( static_cast<size_t>(is_.gcount()) != size )
+            throw std::runtime_error(path_ + ": unexpected end of file");
+    }
+
+    binlog::IndexEntry BinaryLogReader::entry(size_t pos)
+    {
+        if( !index_on_disk_ )
+            return index_.at(pos);
+        if( pos >= count_ )
+            throw std::out_of_range(path_ + ": index position out of range");
+        char e[binlog::kIndexEntrySize];
+        read_at(index_offset_ + pos * sizeof(e), e, sizeof(e));
+        return {get_u64(e), get_u64(e + 8), get_u64(e + 16)};
+    }
+
+    size_t BinaryLogReader::lower_bound(uint64_t created_us)
+    {
+        size_t first = 0, count = count_;
+        while( count )
+        {
+            size_t const half = count / 2;
+            if( entry(first + half).created_us_ < created_us )
+            {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else
+                count = half;
+        }
+        return first;
+    }
+
+    std::pair<size_t, size_t> BinaryLogReader::find_range(uint64_t from_us, uint64_t to_us)
+    {
+        if( from_us > to_us )
+            return {0, 0};
+        size_t const first = lower_bound(from_us);
+        size_t const last = to_us == std::numeric_limits<uint64_t>::max() ? count_ : lower_bound(to_us + 1);
+        return {first, std::max(first, last)};
+    }
+
+    void BinaryLogReader::read_bulk(size_t pos, BulkBuffer& bulk)
+    {
+        binlog::IndexEntry const e = entry(pos);
+        char header[binlog::kBulkHeaderSize];
+        read_at(e.offset_, header, sizeof(header));
+        uint32_t const count = get_u32(header + 16), payload = get_u32(header + 20);
+        cmds_.resize(payload);
+        read_at(e.offset_ + sizeof(header), &cmds_[0], payload);
+
+        bulk.clear();
+        bulk.seq_ = get_u64(header);
+        bulk.created_us_ = get_u64(header + 8);
+        bulk.created_at_ = static_cast<time_t>(bulk.created_us_ / 1000000);
+        size_t at = 0;
+        for( uint32_t i = 0; i < count; ++i )
+        {
+            if( at + 4 > cmds_.size() || get_u32(&cmds_[at]) > cmds_.size() - at - 4 )
+                throw std::runtime_error(path_ + ": corrupted bulk record");
+            size_t const len = get_u32(&cmds_[at]);
+            bulk.push(std::string_view(&cmds_[at + 4], len));
+            at += 4 + len;
+        }
+    }
+
+} // otus_hw7
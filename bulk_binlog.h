@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bulk_sinks.h"
+
+namespace otus_hw7{
+
+    /// @brief Двоичный журнал пакетов .blg. Числа записываются в little-endian:
+    ///        заголовок файла   "BULKLOG1";
+    ///        пакет             <номер u64> <время, мкс u64> <число команд u32> <длина команд u32>,
+    ///                          затем команды как <длина u32> <байты>;
+    ///        индекс            записи <время, мкс u64> <номер u64> <смещение пакета u64>,
+    ///                          упорядоченные по времени (и номеру);
+    ///        окончание         <смещение индекса u64> <число записей u64> "BULKIDX1".
+    ///        Индекс пишется при закрытии сегмента, файл без индекса читается полным проходом
+    namespace binlog {
+        constexpr char      kFileMagic[8] = {'B', 'U', 'L', 'K', 'L', 'O', 'G', '1'};
+        constexpr char      kIndexMagic[8] = {'B', 'U', 'L', 'K', 'I', 'D', 'X', '1'};
+        constexpr size_t    kBulkHeaderSize = 8 + 8 + 4 + 4;
+        constexpr size_t    kIndexEntrySize = 8 + 8 + 8;
+        constexpr size_t    kTrailerSize = 8 + 8 + sizeof(kIndexMagic);
+        constexpr const char* kExtension = ".blg";
+
+        struct IndexEntry
+        {
+            uint64_t created_us_, seq_, offset_;
+        };
+    }
+
+    /// @brief Приемник, дописывающий пакеты в двоичные сегменты bulk<время>_<мкс>_<номер>.blg,
+    ///        названные по первому пакету. Ротация как у SegmentLogSink, индекс по времени
+    ///        дописывается в конец сегмента при его закрытии
+    class BinaryLogSink final : public IBulkSink
+    {
+    public:
+        BinaryLogSink(SegmentOptions const& seg_opts, FlushOptions const& opts = {}) : seg_opts_(seg_opts), flush_ctl_(opts) {}
+        ~BinaryLogSink();
+        BinaryLogSink(BinaryLogSink const&) = delete;
+        BinaryLogSink& operator=(BinaryLogSink const&) = delete;
+
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+        void sync() override;
+
+    private:
+        bool rotate_due(size_t size) const;
+        void open_segment(BulkBuffer const& bulk);
+        void close_segment();
+
+        SegmentOptions                          seg_opts_;
+        int                                     data_fd_ = -1;
+        bool                                    new_segment_ = false;  ///< Сегмент создан после последней синхронизации
+        uint64_t                                seg_bytes_ = 0;
+        std::chrono::steady_clock::time_point   opened_at_;
+        std::string                             buf_;
+        std::vector<binlog::IndexEntry>         index_;
+        FlushController                         flush_ctl_;
+    };
+
+    /// @brief Чтение двоичного журнала. Поиск пакетов по времени - двоичный поиск по индексу
+    ///        в конце файла, записи индекса читаются с диска по мере поиска. Для файла без индекса
+    ///        (сегмент еще пишется или запись прервана) индекс строится проходом по пакетам,
+    ///        оборванный последний пакет пропускается
+    class BinaryLogReader
+    {
+    public:
+        /// @throw std::system_error, если файл не открыт; std::runtime_error, если это не двоичный журнал
+        explicit BinaryLogReader(std::string const& path);
+
+        /// @brief Число пакетов в индексе
+        size_t size() const { return count_; }
+        /// @brief true, если индекс прочитан из файла, а не построен проходом
+        bool   indexed() const { return index_on_disk_; }
+
+        /// @brief Запись индекса по позиции, позиции упорядочены по времени пакета
+        binlog::IndexEntry entry(size_t pos);
+
+        /// @brief Позиции индекса [first, last) пакетов со временем создания в [from_us, to_us]
+        std::pair<size_t, size_t> find_range(uint64_t from_us, uint64_t to_us);
+
+        /// @brief Читает пакет по позиции индекса
+        void read_bulk(size_t pos, BulkBuffer& bulk);
+
+    private:
+        void    scan();
+        void    read_at(uint64_t offset, char* dst, size_t size);
+        size_t  lower_bound(uint64_t created_us);
+
+        std::string                     path_;
+        std::ifstream                   is_;
+        uint64_t                        file_size_ = 0, index_offset_ = 0;
+        size_t                          count_ = 0;
+        bool                            index_on_disk_ = false;
+        std::vector<binlog::IndexEntry> index_;     ///< Индекс, построенный проходом по файлу без индекса
+        std::string                     cmds_;
+    };
+
+} // otus_hw7
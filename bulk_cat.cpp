@@ -0,0 +1,172 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include "bulk_binlog.h"
+#include "bulk_compress.h"
+
+namespace po = boost::program_options;
+using namespace otus_hw7;
+
+namespace {
+
+    bool has_suffix(std::string const& s, std::string const& suffix)
+    {
+        return s.size() >= suffix.size() && !s.compare(s.size() - suffix.size(), suffix.size(), suffix);
+    }
+
+    /// @brief Отбор пакетов по времени создания, в микросекундах
+    struct TimeRange
+    {
+        uint64_t from_us_ = 0, to_us_ = std::numeric_limits<uint64_t>::max();
+    };
+
+    /// @brief Выводит текстом пакеты двоичного журнала из диапазона времени
+    void cat_binary(std::string const& path, TimeRange const& range)
+    {
+        BinaryLogReader reader(path);
+        if( !reader.indexed() )
+            std::cerr << path << ": no index, scanned " << reader.size() << " bulks" << std::endl;
+        auto const positions = reader.find_range(range.from_us_, range.to_us_);
+        BulkBuffer bulk;
+        std::string text;
+        for( size_t pos = positions.first; pos < positions.second; ++pos )
+        {
+            reader.read_bulk(pos, bulk);
+            text.clear();
+            format_bulk(bulk, text);
+            std::cout.write(text.data(), static_cast<std::streamsize>(text.size()));
+        }
+    }
+
+    /// @brief Выводит файл журнала в std::cout: сжатый распаковывается, двоичный выводится текстом, 
+    ///        текстовый копируется
+    /// @return false, если файл не открыт или сжатый файл оборван
+    bool cat_file(std::string const& path, std::string const& dict, TimeRange const& range)
+    {
+        if( has_suffix(path, binlog::kExtension) )
+        {
+            cat_binary(path, range);
+            return true;
+        }
+        std::ifstream is(path, std::ios_base::in | std::ios_base::binary);
+        if( !is )
+        {
+            std::cerr << path << ": cannot open" << std::endl;
+            return false;
+        }
+        if( !has_suffix(path, ".zst") )
+        {
+            std::cout << is.rdbuf();
+            return true;
+        }
+#ifdef BULK_ZSTD
+        if( !decompress_log(is, std::cout, dict) )
+        {
+            std::cerr << path << ": truncated frame" << std::endl;
+            return false;
+        }
+        return true;
+#else
+        (void)dict;
+        std::cerr << path << ": zstd support is disabled at build time" << std::endl;
+        return false;
+#endif
+    }
+
+    uint64_t seconds_to_us(double seconds)
+    {
+        return seconds <= 0 ? 0 : static_cast<uint64_t>(std::llround(seconds * 1e6));
+    }
+
+#ifdef BULK_ZSTD
+    /// @brief Обучает словарь на строках файлов: каждая строка - отдельный образец
+    void train(std::vector<std::string> const& files, std::string const& dict_path, size_t dict_size)
+    {
+        std::vector<std::string> samples;
+        for( auto const& path : files )
+        {
+            std::ifstream is(path, std::ios_base::in | std::ios_base::binary);
+            if( !is )
+                throw std::runtime_error(path + ": cannot open");
+            for( std::string line; std::getline(is, line); )
+                samples.push_back(line + '\n');
+        }
+        std::string const dict = train_log_dictionary(samples, dict_size);
+        std::ofstream os(dict_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        os.write(dict.data(), static_cast<std::streamsize>(dict.size()));
+        if( !os )
+            throw std::runtime_error(dict_path + ": cannot write");
+        std::cerr << dict_path << ": " << dict.size() << " bytes from " << samples.size() << " samples" << std::endl;
+    }
+#endif
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        std::string dict_path, train_path;
+        size_t dict_size = 0;
+        double from = 0, to = 0;
+        std::vector<std::string> files;
+
+        po::options_description desc("bulk-cat [--dict FILE] FILE... - вывод журналов bulk (сжатые .zst распаковываются,\n"
+                                     "                                двоичные .blg выводятся текстом)\n"
+                                     "bulk-cat [--from T1] [--to T2] FILE.blg... - пакеты двоичного журнала за интервал времени\n"
+                                     "bulk-cat --train DICT FILE...  - обучение словаря сжатия на строках файлов\n"
+                                     "Аргументы командной строки");
+        desc.add_options()
+            ("help", "Отображение справки")
+            ("dict", po::value<std::string>(&dict_path), "Словарь, с которым сжимался журнал (--log_dict)")
+            ("train", po::value<std::string>(&train_path), "Обучить словарь на строках файлов и сохранить в файл")
+            ("dict_size", po::value<size_t>(&dict_size)->default_value(size_t(16) << 10), "Размер обучаемого словаря в байтах")
+            ("from", po::value<double>(&from), "Начало интервала для .blg, секунды Unix-времени (можно с дробной частью)")
+            ("to", po::value<double>(&to), "Конец интервала для .blg включительно, секунды Unix-времени")
+            ("files", po::value<std::vector<std::string>>(&files), "Файлы журнала");
+        po::positional_options_description pos_desc;
+        pos_desc.add("files", -1);
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos_desc).run(), vm);
+        po::notify(vm);
+
+        if( vm.count("help") || files.empty() )
+        {
+            std::cout << desc << std::endl;
+            return files.empty() && !vm.count("help") ? 1 : 0;
+        }
+
+        if( !train_path.empty() )
+        {
+#ifdef BULK_ZSTD
+            train(files, train_path, dict_size);
+            return 0;
+#else
+            std::cerr << "zstd support is disabled at build time" << std::endl;
+            return 1;
+#endif
+        }
+
+        TimeRange range;
+        if( vm.count("from") )
+            range.from_us_ = seconds_to_us(from);
+        if( vm.count("to") )
+            range.to_us_ = seconds_to_us(to);
+        std::string const dict = dict_path.empty() ? std::string() : load_log_dictionary(dict_path);
+        bool ok = true;
+        for( auto const& path : files )
+            ok = cat_file(path, dict, range) && ok;
+        std::cout.flush();
+        return ok ? 0 : 1;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,151 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "bulk_checkpoint.h"
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    namespace {
+        constexpr const char* const kMagic = "bulkckpt";
+
+        /// @brief FNV-1a полей записи: оборванная или чужая запись не примется за контрольную точку
+        uint32_t checksum(Checkpoint const& ckpt)
+        {
+            uint32_t h = 2166136261u;
+            for( uint64_t v : {ckpt.offset_, ckpt.seq_, static_cast<uint64_t>(ckpt.depth_)} )
+                for( int i = 0; i < 8; ++i, v >>= 8 )
+                    h = (h ^ static_cast<uint32_t>(v & 0xff)) * 16777619u;
+            return h;
+        }
+    }
+
+#ifndef _WIN32
+    CheckpointFile::CheckpointFile(std::string path, bool durable) : path_(std::move(path)), durable_(durable)
+    {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + path_);
+    }
+
+    CheckpointFile::~CheckpointFile()
+    {
+        if( fd_ >= 0 )
+            ::close(fd_);
+    }
+
+    bool CheckpointFile::load(Checkpoint& ckpt) const
+    {
+        char buf[kRecordSize + 1] = {};
+        ssize_t const n = ::pread(fd_, buf, kRecordSize, 0);
+        if( n < 0 )
+            throw std::system_error(errno, std::generic_category(), "read " + path_);
+        if( !n )
+            return false;
+        char magic[16] = {};
+        unsigned version = 0, sum = 0;
+        uint64_t depth = 0;
+        if( n != static_cast<ssize_t>(kRecordSize) ||
+            std::sscanf(buf, "%15s %u %" SCNu64 " %" SCNu64 " %" SCNu64 " %x", magic, &version,
+                        &ckpt.offset_, &ckpt.seq_, &depth, &sum) != 6 ||
+            std::strcmp(magic, kMagic) || version != 1 )
+            throw std::runtime_error(path_ + ": not a checkpoint file");
+        ckpt.depth_ = static_cast<size_t>(depth);
+        if( sum != checksum(ckpt) )
+            throw std::runtime_error(path_ + ": checkpoint is corrupted");
+        return true;
+    }
+
+    void CheckpointFile::save(Checkpoint const& ckpt)
+    {
+        char buf[kRecordSize + 1];
+        int const len = std::snprintf(buf, sizeof(buf), "%s 1 %" PRIu64 " %" PRIu64 " %" PRIu64 " %08x", kMagic,
+                                      ckpt.offset_, ckpt.seq_, static_cast<uint64_t>(ckpt.depth_), checksum(ckpt));
+        std::memset(buf + len, ' ', kRecordSize - static_cast<size_t>(len));
+        buf[kRecordSize - 1] = '\n';
+        for(;;)
+        {
+            ssize_t const n = ::pwrite(fd_, buf, kRecordSize, 0);
+            if( n == static_cast<ssize_t>(kRecordSize) )
+                break;
+            if( n >= 0 || errno != EINTR )
+                throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "write " + path_);
+        }
+#ifdef __APPLE__
+        if( durable_ && ::fsync(fd_) )
+#else
+        if( durable_ && ::fdatasync(fd_) )
+#endif
+            throw std::system_error(errno, std::generic_category(), "sync " + path_);
+        BULK_METRIC_ADD(kCheckpoints, 1);
+    }
+#else
+    CheckpointFile::CheckpointFile(std::string path, bool durable) : path_(std::move(path)), durable_(durable)
+    {
+        throw std::runtime_error("checkpoints are not supported on this platform");
+    }
+
+    CheckpointFile::~CheckpointFile() = default;
+    bool CheckpointFile::load(Checkpoint&) const { return false; }
+    void CheckpointFile::save(Checkpoint const&) {}
+#endif
+
+    CheckpointProcessor::CheckpointProcessor(std::unique_ptr<InputParser> parser, std::vector<IBulkSinkPtr_t> sinks,
+                                             CheckpointFilePtr_t file, size_t every)
+        : BulkProcessor(nullptr, std::move(sinks)), input_(*parser), file_(std::move(file)), every_(every ? every : 1)
+    {
+        parser_ = std::move(parser);
+    }
+
+    bool CheckpointProcessor::resume()
+    {
+        Checkpoint ckpt;
+        if( !file_->load(ckpt) )
+            return false;
+        input_.resume(ckpt.offset_, ckpt.depth_);
+        bulk_seq_ = ckpt.seq_;
+        last_ = ckpt;
+        return true;
+    }
+
+    void CheckpointProcessor::reset()
+    {
+        last_ = {};
+        file_->save(last_);
+    }
+
+    void CheckpointProcessor::process()
+    {
+        BulkProcessor::process();
+        // блок, оборванный концом ввода, отброшен: при продолжении он читается заново с начала
+        if( !input_.depth() )
+            last_ = {input_.consumed(), bulk_seq_, 0};
+        save();
+    }
+
+    void CheckpointProcessor::exec_bulk()
+    {
+        BulkProcessor::exec_bulk();
+        last_ = {input_.consumed(), bulk_seq_, input_.depth()};
+        if( ++since_ >= every_ )
+            save();
+    }
+
+    void CheckpointProcessor::save()
+    {
+        // точка записывается только после вывода всех пакетов до нее
+        flush_sinks();
+        file_->save(last_);
+        since_ = 0;
+    }
+
+} // otus_hw7
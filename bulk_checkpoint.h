@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bulk_internal.h"
+
+namespace otus_hw7{
+
+    /// @brief Состояние обработки на границе пакетов
+    struct Checkpoint
+    {
+        uint64_t    offset_ = 0;    ///< Байты ввода, разобранные до границы
+        uint64_t    seq_ = 0;       ///< Номер последнего выведенного пакета
+        size_t      depth_ = 0;     ///< Вложенность открытых динамических блоков
+    };
+
+    /// @brief Файл контрольной точки: одна запись фиксированного размера с контрольной суммой,
+    ///        перезаписываемая на месте одним pwrite
+    class CheckpointFile
+    {
+    public:
+        static constexpr size_t kRecordSize = 64;
+
+        /// @param durable Синхронизировать запись с носителем
+        /// @throw std::system_error, если файл не открыт
+        CheckpointFile(std::string path, bool durable = false);
+        ~CheckpointFile();
+        CheckpointFile(CheckpointFile const&) = delete;
+        CheckpointFile& operator=(CheckpointFile const&) = delete;
+
+        /// @return false, если файл пуст (контрольных точек еще не было)
+        /// @throw std::runtime_error, если запись повреждена
+        bool    load(Checkpoint& ckpt) const;
+        void    save(Checkpoint const& ckpt);
+
+        std::string const& path() const { return path_; }
+
+    private:
+        std::string path_;
+        bool        durable_;
+        int         fd_ = -1;
+    };
+    using CheckpointFilePtr_t = std::unique_ptr<CheckpointFile>;
+
+    /// @brief Процессор с контрольными точками: после каждых every пакетов приемники сбрасываются
+    ///        и в файл записываются смещение ввода, вложенность блоков и номер последнего пакета.
+    ///        Перезапуск с resume переходит прямо к сохраненному смещению и продолжает нумерацию,
+    ///        поэтому выведенные пакеты не повторяются. После сбоя повторно выводятся только пакеты,
+    ///        выведенные после последней контрольной точки (не больше every - 1)
+    class CheckpointProcessor final : public BulkProcessor
+    {
+    public:
+        CheckpointProcessor(std::unique_ptr<InputParser> parser, std::vector<IBulkSinkPtr_t> sinks,
+                            CheckpointFilePtr_t file, size_t every = 1);
+
+        /// @brief Продолжает с сохраненной контрольной точки
+        /// @return false, если контрольной точки нет и обработка начнется с начала ввода
+        bool resume();
+        /// @brief Начинает обработку заново: записывает начальную контрольную точку
+        void reset();
+        void process() override;
+
+    protected:
+        void exec_bulk() override;
+
+    private:
+        void save();
+
+        InputParser&        input_;
+        CheckpointFilePtr_t file_;
+        size_t              every_, since_ = 0;
+        Checkpoint          last_;          ///< Последняя граница пакетов
+    };
+
+} // otus_hw7
@@ -0,0 +1,136 @@
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef BULK_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+#include "bulk_compress.h"
+
+namespace otus_hw7{
+
+    std::string load_log_dictionary(std::string const& path)
+    {
+        std::ifstream is(path, std::ios_base::in | std::ios_base::binary);
+        if( !is )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        std::ostringstream oss;
+        oss << is.rdbuf();
+        return oss.str();
+    }
+
+#ifdef BULK_ZSTD
+    namespace {
+        constexpr size_t kDecompressChunk = size_t(64) << 10;
+
+        size_t check_zstd(size_t ret, const char* what)
+        {
+            if( ZSTD_isError(ret) )
+                throw std::runtime_error(std::string(what) + ": " + ZSTD_getErrorName(ret));
+            return ret;
+        }
+    }
+
+    void ZstdDeleter::operator()(ZSTD_CCtx_s* p) const { ZSTD_freeCCtx(p); }
+    void ZstdDeleter::operator()(ZSTD_CDict_s* p) const { ZSTD_freeCDict(p); }
+    void ZstdDeleter::operator()(ZSTD_DCtx_s* p) const { ZSTD_freeDCtx(p); }
+
+    ZstdLogEncoder::ZstdLogEncoder(int level, std::string const& dict) : cctx_(ZSTD_createCCtx())
+    {
+        if( !cctx_ )
+            throw std::bad_alloc();
+        check_zstd(ZSTD_CCtx_setParameter(cctx_.get(), ZSTD_c_compressionLevel, level), "zstd level");
+        check_zstd(ZSTD_CCtx_setParameter(cctx_.get(), ZSTD_c_checksumFlag, 1), "zstd checksum");
+        if( !dict.empty() )
+        {
+            cdict_.reset(ZSTD_createCDict(dict.data(), dict.size(), level));
+            if( !cdict_ )
+                throw std::runtime_error("zstd dictionary: cannot load");
+            check_zstd(ZSTD_CCtx_refCDict(cctx_.get(), cdict_.get()), "zstd dictionary");
+        }
+    }
+
+    void ZstdLogEncoder::encode(std::string_view in, std::string& out, bool end)
+    {
+        ZSTD_inBuffer src{in.data(), in.size(), 0};
+        size_t const chunk = ZSTD_CStreamOutSize();
+        for( size_t left = 1; left; )
+        {
+            size_t const old_size = out.size();
+            out.resize(old_size + chunk);
+            ZSTD_outBuffer dst{&out[old_size], chunk, 0};
+            left = ZSTD_compressStream2(cctx_.get(), &dst, &src, end ? ZSTD_e_end : ZSTD_e_flush);
+            out.resize(old_size + dst.pos);
+            check_zstd(left, "zstd compress");
+        }
+    }
+
+    ZstdLogDecoder::ZstdLogDecoder(std::string const& dict) : dctx_(ZSTD_createDCtx())
+    {
+        if( !dctx_ )
+            throw std::bad_alloc();
+        if( !dict.empty() )
+            check_zstd(ZSTD_DCtx_loadDictionary(dctx_.get(), dict.data(), dict.size()), "zstd dictionary");
+    }
+
+    bool ZstdLogDecoder::decode(std::string_view in, std::string& out)
+    {
+        if( in.empty() )
+            return complete_;
+        ZSTD_inBuffer src{in.data(), in.size(), 0};
+        size_t const chunk = ZSTD_DStreamOutSize();
+        for( bool out_full = true; src.pos < src.size || out_full; )
+        {
+            size_t const old_size = out.size();
+            out.resize(old_size + chunk);
+            ZSTD_outBuffer dst{&out[old_size], chunk, 0};
+            size_t const ret = check_zstd(ZSTD_decompressStream(dctx_.get(), &dst, &src), "zstd decompress");
+            out.resize(old_size + dst.pos);
+            out_full = dst.pos == dst.size;
+            complete_ = !ret;
+        }
+        return complete_;
+    }
+
+    bool decompress_log(istream& is, ostream& os, std::string const& dict)
+    {
+        ZstdLogDecoder decoder(dict);
+        std::string in(kDecompressChunk, '\0'), out;
+        bool complete = true;
+        while( is )
+        {
+            is.read(&in[0], static_cast<std::streamsize>(in.size()));
+            auto const n = static_cast<size_t>(is.gcount());
+            if( !n )
+                break;
+            out.clear();
+            complete = decoder.decode(std::string_view(in.data(), n), out);
+            os.write(out.data(), static_cast<std::streamsize>(out.size()));
+        }
+        return complete;
+    }
+
+    std::string train_log_dictionary(std::vector<std::string> const& samples, size_t dict_size)
+    {
+        std::string joined;
+        std::vector<size_t> sizes;
+        sizes.reserve(samples.size());
+        for( auto const& s : samples )
+        {
+            joined += s;
+            sizes.push_back(s.size());
+        }
+        std::string dict(dict_size, '\0');
+        size_t const n = ZDICT_trainFromBuffer(&dict[0], dict.size(), joined.data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+        if( ZDICT_isError(n) )
+            throw std::runtime_error(std::string("zstd dictionary training: ") + ZDICT_getErrorName(n));
+        dict.resize(n);
+        return dict;
+    }
+#endif
+
+} // otus_hw7
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bulk_sinks.h"
+
+#ifdef BULK_ZSTD
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DCtx_s;
+#endif
+
+namespace otus_hw7{
+
+    /// @brief Загружает словарь сжатия из файла целиком
+    /// @throw std::system_error, если файл не удалось прочитать
+    std::string load_log_dictionary(std::string const& path);
+
+#ifdef BULK_ZSTD
+    struct ZstdDeleter
+    {
+        void operator()(ZSTD_CCtx_s* p) const;
+        void operator()(ZSTD_CDict_s* p) const;
+        void operator()(ZSTD_DCtx_s* p) const;
+    };
+
+    /// @brief Сжатие журнала в формате кадров zstd. Каждый сброс завершает блок zstd, поэтому
+    ///        все записанное на диск раскодируется и без конца кадра (например, открытый сегмент)
+    class ZstdLogEncoder : public ILogEncoder
+    {
+    public:
+        /// @param level Уровень сжатия zstd
+        /// @param dict  Словарь, обученный на характерных командах (train_log_dictionary), пусто - без словаря
+        /// @throw std::runtime_error при недопустимых параметрах или словаре
+        explicit ZstdLogEncoder(int level, std::string const& dict = {});
+
+        const char* extension() const override { return ".zst"; }
+        void        encode(std::string_view in, std::string& out, bool end) override;
+
+    private:
+        std::unique_ptr<ZSTD_CCtx_s, ZstdDeleter>   cctx_;
+        std::unique_ptr<ZSTD_CDict_s, ZstdDeleter>  cdict_;
+    };
+
+    /// @brief Потоковая распаковка кадров zstd, записанных ZstdLogEncoder
+    class ZstdLogDecoder
+    {
+    public:
+        /// @param dict Словарь, с которым сжимался журнал
+        explicit ZstdLogDecoder(std::string const& dict = {});
+
+        /// @brief Дописывает в out распакованные данные очередной порции in
+        /// @return true, если все кадры, начатые во входных данных, завершены
+        /// @throw std::runtime_error при поврежденных данных или неподходящем словаре
+        bool decode(std::string_view in, std::string& out);
+
+    private:
+        std::unique_ptr<ZSTD_DCtx_s, ZstdDeleter>   dctx_;
+        bool                                        complete_ = true;
+    };
+
+    /// @brief Распаковывает поток кадров zstd из is в os
+    /// @return false, если последний кадр оборван (сегмент еще пишется или запись прервана)
+    bool decompress_log(istream& is, ostream& os, std::string const& dict = {});
+
+    /// @brief Обучает словарь zstd на образцах текста журнала (например, строках пакетов)
+    /// @throw std::runtime_error, если образцов недостаточно для обучения
+    std::string train_log_dictionary(std::vector<std::string> const& samples, size_t dict_size);
+#endif
+
+} // otus_hw7
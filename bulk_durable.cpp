@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "bulk_durable.h"
+
+namespace otus_hw7{
+
+    GroupCommitSink::GroupCommitSink(std::vector<IBulkSinkPtr_t> log_sinks, std::vector<IBulkSinkPtr_t> release_sinks,
+                                     GroupCommitOptions const& opts)
+        : log_sinks_(std::move(log_sinks)), release_sinks_(std::move(release_sinks)), opts_(opts)
+    {
+        if( !opts_.max_batch_ )
+            opts_.max_batch_ = 1;
+        thread_ = std::thread(&GroupCommitSink::run, this);
+    }
+
+    GroupCommitSink::~GroupCommitSink()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+            ++flush_req_;
+        }
+        ready_.notify_one();
+        thread_.join();
+    }
+
+    void GroupCommitSink::write(BulkBuffer const& bulk, std::string_view text)
+    {
+        FormattedBulkPtr_t item = bulks_.acquire();
+        item->bulk_ = bulk;
+        item->text_.assign(text.data(), text.size());
+        BULK_METRIC_ONLY(item->enqueued_ns_ = metrics_now_ns();)
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            room_.wait(lk, [this]{ return pending_.size() < opts_.max_batch_ || error_; });
+            rethrow_error();
+            if( pending_.empty() )
+                first_at_ = std::chrono::steady_clock::now();
+            pending_.push_back(std::move(item));
+        }
+        ready_.notify_one();
+    }
+
+    void GroupCommitSink::flush()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        uint64_t const req = ++flush_req_;
+        ready_.notify_one();
+        done_.wait(lk, [this, req]{ return flush_done_ >= req; });
+        rethrow_error();
+    }
+
+    GroupCommitStats GroupCommitSink::stats() const
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return stats_;
+    }
+
+    void GroupCommitSink::rethrow_error()
+    {
+        if( error_ )
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+    void GroupCommitSink::run()
+    {
+        std::vector<FormattedBulkPtr_t> batch;
+        batch.reserve(opts_.max_batch_);
+        std::unique_lock<std::mutex> lk(mtx_);
+        for(;;)
+        {
+            ready_.wait(lk, [this]{ return stop_ || !pending_.empty() || flush_req_ != flush_done_; });
+            // группа пополняется до max_delay с поступления первого пакета, сброс и остановка не ждут
+            if( !pending_.empty() && opts_.max_delay_.count() )
+                ready_.wait_until(lk, first_at_ + opts_.max_delay_, [this]
+                {
+                    return stop_ || flush_req_ != flush_done_ || pending_.size() >= opts_.max_batch_;
+                });
+
+            size_t const n = std::min(pending_.size(), opts_.max_batch_);
+            std::move(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(n), std::back_inserter(batch));
+            pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(n));
+            if( !pending_.empty() )
+                first_at_ = std::chrono::steady_clock::now();
+            lk.unlock();
+            room_.notify_all();
+
+            if( !batch.empty() )
+                commit(batch);
+            batch.clear();
+
+            lk.lock();
+            if( pending_.empty() && flush_req_ != flush_done_ )
+            {
+                uint64_t const req = flush_req_;
+                lk.unlock();
+                std::exception_ptr error;
+                try
+                {
+                    for( auto& sink : release_sinks_ )
+                        sink->flush();
+                }
+                catch(...)
+                {
+                    error = std::current_exception();
+                }
+                lk.lock();
+                if( error && !error_ )
+                    error_ = error;
+                flush_done_ = req;
+                done_.notify_all();
+            }
+            if( stop_ && pending_.empty() && flush_req_ == flush_done_ )
+                break;
+        }
+    }
+
+    void GroupCommitSink::commit(std::vector<FormattedBulkPtr_t>& batch)
+    {
+        uint64_t sync_ns = 0;
+        BULK_METRIC_ONLY(uint64_t const now = metrics_now_ns();)
+        BULK_METRIC_ONLY(for( auto const& item : batch ) BULK_METRIC_RECORD(kQueueWait, now - item->enqueued_ns_);)
+        try
+        {
+            for( auto& sink : log_sinks_ )
+                for( auto const& item : batch )
+                    sink->write(item->bulk_, item->text_);
+            uint64_t const start = metrics_now_ns();
+            for( auto& sink : log_sinks_ )
+                sink->sync();
+            sync_ns = metrics_now_ns() - start;
+            BULK_METRIC_RECORD(kSync, sync_ns);
+            BULK_METRIC_COMMIT(batch.size());
+
+            // пакеты группы на носителе - их можно выводить
+            for( auto& sink : release_sinks_ )
+                for( auto const& item : batch )
+                    sink->write(item->bulk_, item->text_);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if( !error_ )
+                error_ = std::current_exception();
+            room_.notify_all();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lk(mtx_);
+        ++stats_.commits_;
+        stats_.bulks_ += batch.size();
+        stats_.max_batch_ = std::max(stats_.max_batch_, batch.size());
+        stats_.sync_ns_ += sync_ns;
+    }
+
+} // otus_hw7
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bulk_async.h"
+
+namespace otus_hw7{
+
+    /// @brief Настройки групповой фиксации
+    struct GroupCommitOptions
+    {
+        std::chrono::microseconds   max_delay_{0};  ///< Сколько ждать пополнения группы после первого пакета; 0 - фиксировать сразу
+        size_t                      max_batch_ = 1024;  ///< Наибольшее число пакетов группы, столько же пакетов ждут в очереди
+    };
+
+    /// @brief Счетчики групповой фиксации
+    struct GroupCommitStats
+    {
+        size_t      commits_ = 0, bulks_ = 0, max_batch_ = 0;
+        uint64_t    sync_ns_ = 0;       ///< Суммарное время синхронизации журналов
+    };
+
+    /// @brief Надежный вывод с групповой фиксацией. write копирует пакет в очередь и возвращается,
+    ///        поток фиксации забирает накопившиеся пакеты группой, пишет их в журналы log_sinks и
+    ///        синхронизирует журналы с носителем одним вызовом sync на группу. Только после этого пакеты
+    ///        группы передаются приемникам release_sinks (консоль, уведомления), так что выведенный пакет
+    ///        уже не потеряется при сбое. Пока идет синхронизация, копится следующая группа; max_delay
+    ///        позволяет подождать пополнения группы ценой задержки вывода.
+    ///        Все приемники вызываются только потоком фиксации, write можно вызывать из разных потоков
+    class GroupCommitSink final : public IBulkSink
+    {
+    public:
+        GroupCommitSink(std::vector<IBulkSinkPtr_t> log_sinks, std::vector<IBulkSinkPtr_t> release_sinks,
+                        GroupCommitOptions const& opts = {});
+        /// @brief Фиксирует оставшиеся пакеты и останавливает поток фиксации
+        ~GroupCommitSink();
+        GroupCommitSink(GroupCommitSink const&) = delete;
+        GroupCommitSink& operator=(GroupCommitSink const&) = delete;
+
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        /// @brief Дожидается фиксации и вывода всех пакетов, сбрасывает приемники release_sinks
+        void flush() override;
+        void sync() override { flush(); }
+
+        GroupCommitStats stats() const;
+
+    private:
+        void run();
+        void commit(std::vector<FormattedBulkPtr_t>& batch);
+        void rethrow_error();
+
+        std::vector<IBulkSinkPtr_t>             log_sinks_, release_sinks_;
+        GroupCommitOptions                      opts_;
+        ObjectPool<FormattedBulk>               bulks_;
+        std::deque<FormattedBulkPtr_t>          pending_;
+        std::chrono::steady_clock::time_point   first_at_;      ///< Поступление первого пакета группы
+        mutable std::mutex                      mtx_;
+        std::condition_variable                 ready_, room_, done_;
+        uint64_t                                flush_req_ = 0, flush_done_ = 0;
+        bool                                    stop_ = false;
+        std::exception_ptr                      error_;         ///< Первая ошибка записи или синхронизации, бросается из write/flush
+        GroupCommitStats                        stats_;
+        std::thread                             thread_;
+    };
+
+} // otus_hw7
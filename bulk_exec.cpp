@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include "bulk_exec.h"
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    namespace {
+        /// @brief Пул и номер деки текущего потока, если он поток пула
+        thread_local WorkStealingPool const* tls_pool = nullptr;
+        thread_local size_t                  tls_idx = 0;
+    }
+
+    void HashHandler::handle(std::string_view arg, std::string& out) const
+    {
+        uint64_t h = 14695981039346656037ull;
+        for( size_t r = 0; r < rounds_; ++r )
+            for( unsigned char c : arg )
+            {
+                h ^= c;
+                h *= 1099511628211ull;
+            }
+        static constexpr char kDigits[] = "0123456789abcdef";
+        char buf[16];
+        for( int i = 15; i >= 0; --i, h >>= 4 )
+            buf[i] = kDigits[h & 0xf];
+        out.append(buf, sizeof(buf));
+    }
+
+    void RegexHandler::handle(std::string_view arg, std::string& out) const
+    {
+        std::match_results<std::string_view::const_iterator> m;
+        if( std::regex_search(arg.begin(), arg.end(), m, re_) )
+            out.append(m[0].first, m[0].second);
+        else
+            out.push_back('-');
+    }
+
+#ifndef _WIN32
+    PluginHandler::PluginHandler(std::string const& path)
+    {
+        lib_ = ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if( !lib_ )
+            throw std::runtime_error(::dlerror());
+        void* const sym = ::dlsym(lib_, kSymbol);
+        if( !sym )
+        {
+            ::dlclose(lib_);
+            throw std::runtime_error(path + ": no " + kSymbol + " in plugin");
+        }
+        std::memcpy(&fn_, &sym, sizeof(fn_));
+    }
+
+    PluginHandler::~PluginHandler()
+    {
+        ::dlclose(lib_);
+    }
+
+    void PluginHandler::handle(std::string_view arg, std::string& out) const
+    {
+        constexpr size_t kInitialCap = 64;
+        size_t const pos = out.size();
+        out.resize(pos + kInitialCap);
+        size_t const n = fn_(arg.data(), arg.size(), &out[pos], kInitialCap);
+        if( n > kInitialCap )
+        {
+            out.resize(pos + n);
+            fn_(arg.data(), arg.size(), &out[pos], n);
+        }
+        out.resize(pos + n);
+    }
+#endif
+
+    ICommandHandlerPtr_t create_handler(std::string const& spec)
+    {
+        auto const colon = spec.find(':');
+        std::string const name = spec.substr(0, colon);
+        std::string const arg = colon == std::string::npos ? std::string() : spec.substr(colon + 1);
+        if( name == "hash" )
+        {
+            size_t rounds = 1;
+            if( !arg.empty() )
+            {
+                size_t used = 0;
+                try { rounds = std::stoul(arg, &used); } catch(std::exception const&) { used = 0; }
+                if( used != arg.size() )
+                    throw std::runtime_error("bad hash rounds: " + spec);
+            }
+            return std::make_shared<HashHandler>(rounds);
+        }
+        if( name == "regex" )
+            return std::make_shared<RegexHandler>(arg);
+        if( name == "plugin" )
+        {
+#ifndef _WIN32
+            return std::make_shared<PluginHandler>(arg);
+#else
+            throw std::runtime_error("plugin handlers are not supported on this platform");
+#endif
+        }
+        throw std::runtime_error("unknown command handler: " + spec);
+    }
+
+    void HandlerRegistry::add(std::string prefix, ICommandHandlerPtr_t handler)
+    {
+        auto it = std::find_if(handlers_.begin(), handlers_.end(), [&](auto const& h){ return h.first.size() <= prefix.size(); });
+        if( it != handlers_.end() && it->first == prefix )
+            it->second = std::move(handler);
+        else
+            handlers_.emplace(it, std::move(prefix), std::move(handler));
+    }
+
+    void HandlerRegistry::add(std::string const& binding)
+    {
+        auto const eq = binding.find('=');
+        if( eq == std::string::npos || !eq )
+            throw std::runtime_error("handler must be given as PREFIX=SPEC: " + binding);
+        add(binding.substr(0, eq), create_handler(binding.substr(eq + 1)));
+    }
+
+    ICommandHandler const* HandlerRegistry::find(std::string_view cmd, std::string_view& arg) const
+    {
+        for( auto const& h : handlers_ )
+            if( cmd.substr(0, h.first.size()) == h.first )
+            {
+                arg = cmd.substr(h.first.size());
+                arg.remove_prefix(std::min(arg.find_first_not_of(' '), arg.size()));
+                return h.second.get();
+            }
+        return nullptr;
+    }
+
+    void HandlerRegistry::apply(std::string_view cmd, std::string& out) const
+    {
+        out.append(cmd.data(), cmd.size());
+        std::string_view arg;
+        if( ICommandHandler const* handler = find(cmd, arg) )
+        {
+            out.push_back('=');
+            handler->handle(arg, out);
+        }
+    }
+
+    void format_bulk(BulkBuffer const& bulk, HandlerRegistry const& handlers, std::string& out)
+    {
+        const char* sep = bulk.opens() ? "bulk: " : ", ";
+        for( auto cmd : bulk )
+        {
+            out.append(sep);
+            handlers.apply(cmd, out);
+            sep = ", ";
+        }
+        if( bulk.closes() )
+            out.push_back('\n');
+    }
+
+    ICommandPtr_t HandlerCommandCreator::create_command(const command_data_t& cmd) const
+    {
+        return ICommandPtr_t{ new HandledCommand(cmd, handlers_) };
+    }
+
+    void HandledCommand::execute(ICommandContext& ctx)
+    {
+        std::string text;
+        handlers_->apply(cmd_, text);
+        ctx.os_ << (!ctx.cmd_idx_ ? "bulk: ": ", ") << text;
+        if( ctx.bulk_size_ - ctx.cmd_idx_ < 2 )
+            ctx.os_ << std::endl;
+    }
+
+    WorkStealingPool::WorkStealingPool(size_t threads)
+    {
+        if( !threads )
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        for( size_t i = 0; i < threads; ++i )
+            deques_.emplace_back(new Deque);
+        for( size_t i = 0; i < threads; ++i )
+            threads_.emplace_back(&WorkStealingPool::run, this, i);
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        wait_idle();
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for( auto& t : threads_ )
+            t.join();
+    }
+
+    void WorkStealingPool::submit(Task_t task)
+    {
+        size_t const idx = tls_pool == this ? tls_idx : next_.fetch_add(1, std::memory_order_relaxed) % deques_.size();
+        pending_.fetch_add(1, std::memory_order_acq_rel);
+        {
+            std::lock_guard<std::mutex> lk(deques_[idx]->mtx_);
+            deques_[idx]->tasks_.push_back(std::move(task));
+        }
+        queued_.fetch_add(1, std::memory_order_acq_rel);
+        {
+            // пустой захват: поток, проверивший queued_ перед сном, уже ждет на wake_
+            std::lock_guard<std::mutex> lk(mtx_);
+        }
+        wake_.notify_one();
+    }
+
+    void WorkStealingPool::wait_idle()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        idle_.wait(lk, [this]{ return !pending_.load(std::memory_order_acquire); });
+    }
+
+    bool WorkStealingPool::take(size_t idx, Task_t& task)
+    {
+        {
+            Deque& own = *deques_[idx];
+            std::lock_guard<std::mutex> lk(own.mtx_);
+            if( !own.tasks_.empty() )
+            {
+                task = std::move(own.tasks_.back());
+                own.tasks_.pop_back();
+                return true;
+            }
+        }
+        for( size_t k = 1; k < deques_.size(); ++k )
+        {
+            Deque& victim = *deques_[(idx + k) % deques_.size()];
+            std::lock_guard<std::mutex> lk(victim.mtx_);
+            if( !victim.tasks_.empty() )
+            {
+                task = std::move(victim.tasks_.front());
+                victim.tasks_.pop_front();
+                stolen_.fetch_add(1, std::memory_order_relaxed);
+                BULK_METRIC_ADD(kExecSteals, 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkStealingPool::run(size_t idx)
+    {
+        tls_pool = this;
+        tls_idx = idx;
+        for(;;)
+        {
+            Task_t task;
+            if( take(idx, task) )
+            {
+                queued_.fetch_sub(1, std::memory_order_acq_rel);
+                task();
+                task = nullptr;
+                if( pending_.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+                {
+                    std::lock_guard<std::mutex> lk(mtx_);
+                    idle_.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(mtx_);
+            wake_.wait(lk, [this]{ return stop_ || queued_.load(std::memory_order_acquire); });
+            if( stop_ && !queued_.load(std::memory_order_acquire) )
+                return;
+        }
+    }
+
+    ParallelBulkSink::ParallelBulkSink(WorkStealingPoolPtr_t pool, HandlerRegistryPtr_t handlers, std::vector<IBulkSinkPtr_t> sinks,
+                                       bool ordered, size_t max_in_flight)
+        : pool_(std::move(pool)), handlers_(std::move(handlers)), sinks_(std::move(sinks)), ordered_(ordered),
+          max_in_flight_(max_in_flight ? max_in_flight : 1), reorder_([this](FormattedBulkPtr_t& bulk){ deliver(*bulk); })
+    {
+    }
+
+    ParallelBulkSink::~ParallelBulkSink()
+    {
+        wait_drained();
+    }
+
+    void ParallelBulkSink::write(BulkBuffer const& bulk, std::string_view)
+    {
+        uint64_t seq;
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            drained_.wait(lk, [this]{ return in_flight_ < max_in_flight_; });
+            if( error_ )
+                std::rethrow_exception(std::exchange(error_, nullptr));
+            ++in_flight_;
+            seq = ++seq_;
+        }
+        FormattedBulkPtr_t job = bulks_.acquire();
+        job->bulk_ = bulk;
+        if( budget_ )
+            job->charge(*budget_);
+        pool_->submit([this, job, seq]() mutable
+        {
+            {
+                BULK_METRIC_TIMER(kExecute);
+                try
+                {
+                    if( handlers_ )
+                        format_bulk(job->bulk_, *handlers_, job->text_);
+                    else
+                        format_bulk(job->bulk_, job->text_);
+                }
+                catch(...)
+                {
+                    set_error(std::current_exception());
+                    job->text_.clear();
+                    format_bulk(job->bulk_, job->text_);
+                }
+            }
+            if( ordered_ )
+                reorder_.put(seq, std::move(job));
+            else
+            {
+                std::lock_guard<std::mutex> lk(out_mtx_);
+                deliver(*job);
+            }
+            job.reset();
+            // уведомление под замком: иначе деструктор, дождавшись in_flight_ == 0, уничтожит drained_ раньше notify_all
+            std::lock_guard<std::mutex> lk(mtx_);
+            --in_flight_;
+            drained_.notify_all();
+        });
+    }
+
+    void ParallelBulkSink::flush()
+    {
+        wait_drained();
+        for( auto& sink : sinks_ )
+            sink->flush();
+        std::lock_guard<std::mutex> lk(mtx_);
+        if( error_ )
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+    void ParallelBulkSink::deliver(FormattedBulk& bulk)
+    {
+        try
+        {
+            for( auto& sink : sinks_ )
+                sink->write(bulk.bulk_, bulk.text_);
+        }
+        catch(...)
+        {
+            set_error(std::current_exception());
+        }
+    }
+
+    void ParallelBulkSink::set_error(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if( !error_ )
+            error_ = error;
+    }
+
+    void ParallelBulkSink::wait_drained()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        drained_.wait(lk, [this]{ return !in_flight_; });
+    }
+
+    ParallelQueueExecutor::ParallelQueueExecutor(WorkStealingPoolPtr_t pool, bool ordered, size_t max_in_flight)
+        : pool_(std::move(pool)), ordered_(ordered), max_in_flight_(max_in_flight ? max_in_flight : 1),
+          reorder_([this](JobPtr_t& job){ deliver(*job); })
+    {
+    }
+
+    ParallelQueueExecutor::~ParallelQueueExecutor()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        drained_.wait(lk, [this]{ return !in_flight_; });
+    }
+
+    void ParallelQueueExecutor::execute(ICommandQueue& cmd_q, ICommandExecutor&, ICommandContext& ctx)
+    {
+        auto job = std::make_shared<Job>();
+        job->cmds_.reserve(cmd_q.size());
+        for( ICommandPtr_t cmd; cmd_q.pop(cmd); )
+            job->cmds_.push_back(std::move(cmd));
+        if( job->cmds_.empty() )
+            return;
+        job->created_at_ = ctx.cmd_created_at_;
+        job->os_ = &ctx.os_;
+        ctx.cmd_idx_ += job->cmds_.size();
+
+        uint64_t seq;
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            drained_.wait(lk, [this]{ return in_flight_ < max_in_flight_; });
+            if( error_ )
+                std::rethrow_exception(std::exchange(error_, nullptr));
+            ++in_flight_;
+            seq = ++seq_;
+        }
+        pool_->submit([this, job, seq]() mutable
+        {
+            {
+                BULK_METRIC_TIMER(kExecute);
+                std::ostringstream os;
+                ICommandContext job_ctx(job->cmds_.size(), 0, os, job->created_at_);
+                try
+                {
+                    for( ; job_ctx.cmd_idx_ < job->cmds_.size(); ++job_ctx.cmd_idx_ )
+                        job->cmds_[job_ctx.cmd_idx_]->execute(job_ctx);
+                }
+                catch(...)
+                {
+                    set_error(std::current_exception());
+                }
+                job->cmds_.clear();
+                job->text_ = os.str();
+            }
+            if( ordered_ )
+                reorder_.put(seq, std::move(job));
+            else
+            {
+                std::lock_guard<std::mutex> lk(out_mtx_);
+                deliver(*job);
+            }
+            job.reset();
+            std::lock_guard<std::mutex> lk(mtx_);
+            --in_flight_;
+            drained_.notify_all();
+        });
+    }
+
+    void ParallelQueueExecutor::wait()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        drained_.wait(lk, [this]{ return !in_flight_; });
+        if( error_ )
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+    void ParallelQueueExecutor::deliver(Job& job)
+    {
+        job.os_->write(job.text_.data(), static_cast<std::streamsize>(job.text_.size()));
+    }
+
+    void ParallelQueueExecutor::set_error(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if( !error_ )
+            error_ = error;
+    }
+
+} // otus_hw7
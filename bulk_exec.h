@@ -0,0 +1,294 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bulk_async.h"
+#include "bulk_internal.h"
+
+namespace otus_hw7{
+
+    /// @brief Обработчик команд с заданным префиксом: вычисляет результат по аргументу команды
+    ///        (тексту после префикса). Вызывается из многих потоков одновременно
+    struct ICommandHandler
+    {
+        virtual      ~ICommandHandler() = default;
+        /// @brief Дописывает результат обработки аргумента в out
+        virtual void handle(std::string_view arg, std::string& out) const = 0;
+    };
+    using ICommandHandlerPtr_t = std::shared_ptr<ICommandHandler>;
+
+    /// @brief Хеш FNV-1a аргумента, 16 шестнадцатеричных цифр. rounds > 1 повторяет хеширование
+    ///        с предыдущим значением в качестве начального - искусственно тяжелая команда
+    class HashHandler final : public ICommandHandler
+    {
+    public:
+        explicit HashHandler(size_t rounds = 1) : rounds_(rounds ? rounds : 1) {}
+        void handle(std::string_view arg, std::string& out) const override;
+    private:
+        size_t rounds_;
+    };
+
+    /// @brief Поиск регулярного выражения в аргументе: результат - найденный фрагмент или "-"
+    class RegexHandler final : public ICommandHandler
+    {
+    public:
+        /// @throw std::regex_error при ошибке в выражении
+        explicit RegexHandler(std::string const& pattern) : re_(pattern, std::regex::ECMAScript | std::regex::optimize) {}
+        void handle(std::string_view arg, std::string& out) const override;
+    private:
+        std::regex re_;
+    };
+
+#ifndef _WIN32
+    /// @brief Обработчик из разделяемой библиотеки. Библиотека экспортирует функцию
+    ///            extern "C" size_t bulk_handle(const char* arg, size_t arg_len, char* out, size_t out_cap);
+    ///        которая пишет в out не более out_cap байт результата и возвращает его полную длину;
+    ///        если результат не поместился, функция вызывается повторно с буфером нужного размера.
+    ///        Функция должна допускать одновременные вызовы из разных потоков
+    class PluginHandler final : public ICommandHandler
+    {
+    public:
+        using HandleFn_t = size_t (*)(const char*, size_t, char*, size_t);
+        static constexpr const char* kSymbol = "bulk_handle";
+
+        /// @throw std::runtime_error, если библиотека не загружена или в ней нет bulk_handle
+        explicit PluginHandler(std::string const& path);
+        ~PluginHandler();
+        PluginHandler(PluginHandler const&) = delete;
+        PluginHandler& operator=(PluginHandler const&) = delete;
+
+        void handle(std::string_view arg, std::string& out) const override;
+    private:
+        void*       lib_ = nullptr;
+        HandleFn_t  fn_ = nullptr;
+    };
+#endif
+
+    /// @brief Фабрика обработчика по описанию: "hash", "hash:ROUNDS", "regex:PATTERN", "plugin:PATH.so"
+    /// @throw std::runtime_error при неизвестном описании
+    ICommandHandlerPtr_t create_handler(std::string const& spec);
+
+    /// @brief Набор обработчиков по префиксам команд. Команда обрабатывается обработчиком
+    ///        с самым длинным подходящим префиксом и выводится как "команда=результат",
+    ///        команды без обработчика выводятся как есть
+    class HandlerRegistry
+    {
+    public:
+        void add(std::string prefix, ICommandHandlerPtr_t handler);
+        /// @brief Добавляет обработчик по строке "PREFIX=SPEC" (см. create_handler)
+        void add(std::string const& binding);
+
+        bool empty() const { return handlers_.empty(); }
+        size_t size() const { return handlers_.size(); }
+
+        /// @brief Обработчик команды
+        /// @param arg Аргумент: текст после префикса без ведущих пробелов
+        /// @return nullptr, если подходящего префикса нет
+        ICommandHandler const* find(std::string_view cmd, std::string_view& arg) const;
+        /// @brief Дописывает в out команду с результатом обработки
+        void apply(std::string_view cmd, std::string& out) const;
+
+    private:
+        std::vector<std::pair<std::string, ICommandHandlerPtr_t>> handlers_;   ///< по убыванию длины префикса
+    };
+    using HandlerRegistryPtr_t = std::shared_ptr<HandlerRegistry const>;
+
+    /// @brief Форматирует пакет как format_bulk, выполняя команды обработчиками handlers
+    void format_bulk(BulkBuffer const& bulk, HandlerRegistry const& handlers, std::string& out);
+
+    /// @brief Фабрика команд с обработчиками: команда с известным префиксом выполняет свой обработчик
+    class HandlerCommandCreator : public ICommandCreator
+    {
+    public:
+        explicit HandlerCommandCreator(HandlerRegistryPtr_t handlers) : handlers_(std::move(handlers)) {}
+        virtual ICommandPtr_t create_command(const command_data_t& cmd) const override;
+    private:
+        HandlerRegistryPtr_t handlers_;
+    };
+
+    /// @brief Команда, выполняемая обработчиком из набора
+    class HandledCommand : public ICommand
+    {
+    public:
+        HandledCommand(const command_data_t& cmd, HandlerRegistryPtr_t handlers) : cmd_(cmd), handlers_(std::move(handlers)) {}
+        virtual void execute(ICommandContext& ctx) override;
+    private:
+        command_data_t          cmd_;
+        HandlerRegistryPtr_t    handlers_;
+    };
+
+    /// @brief Пул потоков с перехватом задач. У каждого потока своя дека задач: владелец берет
+    ///        последние поставленные, простаивающий поток забирает самые старые у соседей.
+    ///        Задачи извне раскладываются по декам по кругу, задачи из потоков пула - в свою деку.
+    ///        Задача - пакет целиком, поэтому общий мьютекс нужен только для засыпания
+    class WorkStealingPool
+    {
+    public:
+        using Task_t = std::function<void()>;
+
+        /// @param threads Число потоков, 0 - по числу ядер
+        explicit WorkStealingPool(size_t threads = 0);
+        /// @brief Дожидается выполнения всех задач и останавливает потоки
+        ~WorkStealingPool();
+        WorkStealingPool(WorkStealingPool const&) = delete;
+        WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+
+        void    submit(Task_t task);
+        /// @brief Дожидается, пока не останется поставленных и выполняемых задач
+        void    wait_idle();
+
+        size_t  size() const { return threads_.size(); }
+        /// @brief Число задач, выполненных не тем потоком, в деку которого они попали
+        size_t  stolen() const { return stolen_.load(std::memory_order_relaxed); }
+
+    private:
+        struct Deque
+        {
+            std::mutex          mtx_;
+            std::deque<Task_t>  tasks_;
+        };
+
+        void run(size_t idx);
+        bool take(size_t idx, Task_t& task);
+
+        std::vector<std::unique_ptr<Deque>> deques_;
+        std::vector<std::thread>            threads_;
+        std::mutex                          mtx_;
+        std::condition_variable             wake_, idle_;
+        std::atomic<size_t>                 queued_{0}, pending_{0}, next_{0}, stolen_{0};
+        bool                                stop_ = false;
+    };
+    using WorkStealingPoolPtr_t = std::shared_ptr<WorkStealingPool>;
+
+    /// @brief Буфер восстановления порядка: результаты приходят с номерами в любом порядке,
+    ///        а отдаются emit строго по возрастанию номеров, начиная с первого
+    template <typename T>
+    class ReorderBuffer
+    {
+    public:
+        using Emit_t = std::function<void(T&)>;
+
+        explicit ReorderBuffer(Emit_t emit, uint64_t first_seq = 1) : emit_(std::move(emit)), next_(first_seq) {}
+
+        /// @brief Кладет результат и отдает все готовые подряд. Отдача идет под мьютексом буфера,
+        ///        поэтому emit не вызывается одновременно из разных потоков
+        void put(uint64_t seq, T item)
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if( seq != next_ )
+            {
+                held_.emplace(seq, std::move(item));
+                max_held_ = std::max(max_held_, held_.size());
+                return;
+            }
+            emit_(item);
+            ++next_;
+            for( auto it = held_.begin(); it != held_.end() && it->first == next_; it = held_.erase(it), ++next_ )
+                emit_(it->second);
+        }
+
+        /// @brief Наибольшее число результатов, ожидавших предшественников
+        size_t max_held() const
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            return max_held_;
+        }
+
+    private:
+        Emit_t                  emit_;
+        mutable std::mutex      mtx_;
+        uint64_t                next_;
+        std::map<uint64_t, T>   held_;
+        size_t                  max_held_ = 0;
+    };
+
+    /// @brief Выполнение пакетов на пуле: приемник копирует пакет, поток пула выполняет его команды
+    ///        обработчиками и форматирует, готовый пакет передается приемникам sinks - в порядке
+    ///        поступления (ordered) или по готовности. Приемники вызываются по одному.
+    ///        Число пакетов в работе ограничено max_in_flight, write ждет освобождения места.
+    ///        write можно вызывать из разных потоков
+    class ParallelBulkSink : public IBulkSink
+    {
+    public:
+        ParallelBulkSink(WorkStealingPoolPtr_t pool, HandlerRegistryPtr_t handlers, std::vector<IBulkSinkPtr_t> sinks,
+                         bool ordered = true, size_t max_in_flight = 1024);
+        ~ParallelBulkSink();
+
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        /// @brief Дожидается вывода всех пакетов и сбрасывает приемники
+        void flush() override;
+        /// @brief Учет пакетов в работе в бюджете памяти
+        void set_budget(MemoryBudgetPtr_t budget) { budget_ = std::move(budget); }
+
+    private:
+        void deliver(FormattedBulk& bulk);
+        void set_error(std::exception_ptr error);
+        void wait_drained();
+
+        WorkStealingPoolPtr_t           pool_;
+        HandlerRegistryPtr_t            handlers_;
+        std::vector<IBulkSinkPtr_t>     sinks_;
+        bool                            ordered_;
+        size_t                          max_in_flight_;
+        MemoryBudgetPtr_t               budget_;
+        ObjectPool<FormattedBulk>       bulks_;
+        ReorderBuffer<FormattedBulkPtr_t> reorder_;
+        std::mutex                      mtx_, out_mtx_;
+        std::condition_variable         drained_;
+        size_t                          in_flight_ = 0;
+        uint64_t                        seq_ = 0;
+        std::exception_ptr              error_;         ///< Первая ошибка обработчика или приемника, бросается из write/flush
+    };
+
+    /// @brief Исполнитель очередей на пуле: execute забирает команды пакета и сразу возвращается,
+    ///        команды выполняются потоком пула в буфер, текст пакета выводится в ctx.os_
+    ///        в порядке пакетов (ordered) или по готовности. Исполнитель cmd_executor живет только
+    ///        на время вызова execute, поэтому команды выполняются непосредственно.
+    ///        Дождаться вывода всех пакетов - wait()
+    class ParallelQueueExecutor : public IQueueExecutor
+    {
+    public:
+        ParallelQueueExecutor(WorkStealingPoolPtr_t pool, bool ordered = true, size_t max_in_flight = 1024);
+        ~ParallelQueueExecutor();
+
+        void execute(ICommandQueue& cmd_q, ICommandExecutor& cmd_executor, ICommandContext& ctx) override;
+        void wait() override;
+
+    private:
+        struct Job
+        {
+            std::vector<ICommandPtr_t>  cmds_;
+            time_t                      created_at_ = 0;
+            std::string                 text_;
+            ostream*                    os_ = nullptr;
+        };
+        using JobPtr_t = std::shared_ptr<Job>;
+
+        void deliver(Job& job);
+        void set_error(std::exception_ptr error);
+
+        WorkStealingPoolPtr_t       pool_;
+        bool                        ordered_;
+        size_t                      max_in_flight_;
+        ReorderBuffer<JobPtr_t>     reorder_;
+        std::mutex                  mtx_, out_mtx_;
+        std::condition_variable     drained_;
+        size_t                      in_flight_ = 0;
+        uint64_t                    seq_ = 0;
+        std::exception_ptr          error_;         ///< Первая ошибка выполнения команды, бросается из execute/wait
+    };
+
+} // otus_hw7
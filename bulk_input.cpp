@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bulk_input.h"
+
+namespace otus_hw7{
+
+    void ILineSource::seek(uint64_t offset)
+    {
+        (void)offset;
+        throw std::runtime_error("input does not support seeking");
+    }
+
+    bool BufferedLineSource::next_line(std::string_view& line)
+    {
+        for(;;)
+        {
+            char* const data = buf_.data();
+            if( const void* p = std::memchr(data + scan_, '\n', end_ - scan_) )
+            {
+                size_t const eol = static_cast<const char*>(p) - data;
+                line = std::string_view(data + beg_, eol - beg_);
+                consumed_ += eol + 1 - beg_;
+                beg_ = scan_ = eol + 1;
+                return true;
+            }
+            scan_ = end_;
+
+            if( eof_ )
+            {
+                if( beg_ == end_ )
+                    return false;
+                line = std::string_view(data + beg_, end_ - beg_);
+                consumed_ += end_ - beg_;
+                beg_ = scan_ = end_;
+                return true;
+            }
+
+            read_more();
+        }
+    }
+
+    bool BufferedLineSource::line_buffered() const
+    {
+        return eof_ || std::memchr(buf_.data() + scan_, '\n', end_ - scan_);
+    }
+
+    void BufferedLineSource::read_more()
+    {
+        if( beg_ )
+        {
+            std::memmove(buf_.data(), buf_.data() + beg_, end_ - beg_);
+            end_ -= beg_, scan_ -= beg_, beg_ = 0;
+        }
+        if( end_ == buf_.size() )
+            buf_.resize(buf_.size() * 2);
+
+        auto const start = std::chrono::steady_clock::now();
+        size_t const n = fill(buf_.data() + end_, buf_.size() - end_);
+        waited_ns_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        if( !n )
+            eof_ = true;
+        end_ += n;
+    }
+
+    void BufferedLineSource::seek(uint64_t offset)
+    {
+        seek_data(offset);
+        beg_ = scan_ = end_ = 0;
+        eof_ = false;
+        consumed_ = offset;
+    }
+
+    bool BufferedLineSource::wait_line(std::chrono::milliseconds timeout)
+    {
+        using clock_t = std::chrono::steady_clock;
+        auto const deadline = clock_t::now() + timeout;
+        while( !line_buffered() )
+        {
+            auto const now = clock_t::now();
+            auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+            bool const ready = left.count() > 0 && wait_data(left);
+            waited_ns_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - now).count());
+            if( !ready )
+                return false;
+            read_more();
+        }
+        return true;
+    }
+
+    size_t FdLineSource::fill(char* dst, size_t size)
+    {
+        for(;;)
+        {
+#ifdef _WIN32
+            auto const n = ::_read(fd_, dst, static_cast<unsigned>(size));
+#else
+            auto const n = ::read(fd_, dst, size);
+#endif
+            if( n >= 0 )
+                return static_cast<size_t>(n);
+            if( errno != EINTR )
+                throw std::system_error(errno, std::generic_category(), "read");
+        }
+    }
+
+    bool FdLineSource::wait_data(std::chrono::milliseconds timeout)
+    {
+#ifdef _WIN32
+        (void)timeout;
+        return true;
+#else
+        pollfd pfd{fd_, POLLIN, 0};
+        for(;;)
+        {
+            int const r = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+            if( r >= 0 )
+                return r > 0;
+            if( errno != EINTR )
+                throw std::system_error(errno, std::generic_category(), "poll");
+        }
+#endif
+    }
+
+    void FdLineSource::seek_data(uint64_t offset)
+    {
+#ifdef _WIN32
+        if( ::_lseeki64(fd_, static_cast<__int64>(offset), SEEK_SET) < 0 )
+#else
+        if( ::lseek(fd_, static_cast<off_t>(offset), SEEK_SET) < 0 )
+#endif
+            throw std::system_error(errno, std::generic_category(), "lseek");
+    }
+
+    size_t IstreamLineSource::fill(char* dst, size_t size)
+    {
+        is_.read(dst, static_cast<std::streamsize>(size));
+        return static_cast<size_t>(is_.gcount());
+    }
+
+    void IstreamLineSource::seek_data(uint64_t offset)
+    {
+        is_.clear();
+        if( !is_.seekg(static_cast<std::streamoff>(offset)) )
+            throw std::runtime_error("input stream does not support seeking");
+    }
+
+#ifndef _WIN32
+    MappedLineSource::MappedLineSource(std::string const& path, size_t window_size)
+        : page_size_(static_cast<size_t>(::sysconf(_SC_PAGESIZE)))
+    {
+        window_size_ = window_size < page_size_ ? page_size_ : window_size / page_size_ * page_size_;
+
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat st{};
+        if( ::fstat(fd_, &st) < 0 )
+        {
+            int const err = errno;
+            ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+        file_size_ = static_cast<uint64_t>(st.st_size);
+    }
+
+    MappedLineSource::~MappedLineSource()
+    {
+        unmap_window();
+        if( fd_ >= 0 )
+            ::close(fd_);
+    }
+
+    void MappedLineSource::unmap_window()
+    {
+        if( win_ )
+            ::munmap(const_cast<char*>(win_), win_len_);
+        win_ = nullptr;
+        win_len_ = 0;
+    }
+
+    void MappedLineSource::map_window(uint64_t offset, size_t length)
+    {
+        unmap_window();
+        win_off_ = offset / page_size_ * page_size_;
+        win_len_ = static_cast<size_t>(std::min<uint64_t>(length, file_size_ - win_off_));
+        void* p = ::mmap(nullptr, win_len_, PROT_READ, MAP_PRIVATE, fd_, static_cast<off_t>(win_off_));
+        if( p == MAP_FAILED )
+        {
+            win_len_ = 0;
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        ::madvise(p, win_len_, MADV_SEQUENTIAL);
+        win_ = static_cast<const char*>(p);
+    }
+
+    void MappedLineSource::seek(uint64_t offset)
+    {
+        if( offset > file_size_ )
+            throw std::runtime_error("seek beyond the end of input");
+        unmap_window();
+        pos_ = offset;
+    }
+
+    bool MappedLineSource::next_line(std::string_view& line)
+    {
+        if( pos_ >= file_size_ )
+            return false;
+
+        if( !win_ || pos_ >= win_off_ + win_len_ )
+            map_window(pos_, window_size_);
+
+        // окно растет только для текущей длинной строки, следующие отображаются окном заданного размера
+        size_t window = window_size_;
+        for(;;)
+        {
+            const char*  start = win_ + (pos_ - win_off_);
+            size_t const avail = static_cast<size_t>(win_off_ + win_len_ - pos_);
+            if( const void* p = std::memchr(start, '\n', avail) )
+            {
+                size_t const len = static_cast<const char*>(p) - start;
+                line = std::string_view(start, len);
+                pos_ += len + 1;
+                return true;
+            }
+            if( win_off_ + win_len_ == file_size_ )
+            {
+                line = std::string_view(start, avail);
+                pos_ = file_size_;
+                return true;
+            }
+
+            // Строка не помещается в остаток окна: окно переносится на начало строки,
+            // а если строка длиннее самого окна - окно увеличивается
+            if( win_off_ == pos_ / page_size_ * page_size_ )
+                window *= 2;
+            map_window(pos_, window);
+        }
+    }
+#endif
+
+} // otus_hw7
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    struct ILineSource;
+    using ILineSourcePtr_t = std::unique_ptr<ILineSource>;
+
+    /// @brief Источник строк ввода. Выдает строки без завершающего '\n' в виде string_view,
+    ///        строка действительна до следующего вызова next_line
+    struct ILineSource
+    {
+        virtual      ~ILineSource() = default;
+        virtual bool next_line(std::string_view& line) = 0;
+        /// @brief Ждет, пока следующую строку (или конец ввода) можно будет прочитать без блокировки
+        /// @return false, если за timeout строка не появилась
+        virtual bool wait_line(std::chrono::milliseconds timeout) { (void)timeout; return true; }
+        /// @brief Байты ввода, занятые уже выданными строками вместе с их '\n'
+        virtual uint64_t consumed() const { return 0; }
+        /// @brief Суммарное время, проведенное в ожидании данных ввода, нс
+        virtual uint64_t waited_ns() const { return 0; }
+        /// @brief Продолжает чтение с байта offset, который должен быть началом строки
+        /// @throw std::runtime_error или std::system_error, если ввод не поддерживает переход
+        virtual void seek(uint64_t offset);
+    };
+
+    /// @brief Построчное чтение через большой переиспользуемый буфер: данные читаются блоками,
+    ///        концы строк ищутся memchr. Наследник реализует только чтение очередного блока
+    class BufferedLineSource : public ILineSource
+    {
+    public:
+        static constexpr size_t kDefaultBufferSize = 1 << 16;
+
+        explicit BufferedLineSource(size_t buf_size = kDefaultBufferSize) : buf_(buf_size ? buf_size : 1) {}
+        bool next_line(std::string_view& line) override;
+        bool wait_line(std::chrono::milliseconds timeout) override;
+        uint64_t consumed() const override { return consumed_; }
+        uint64_t waited_ns() const override { return waited_ns_; }
+        /// @brief Сбрасывает буфер и переводит чтение блоков на offset
+        void seek(uint64_t offset) override;
+
+    protected:
+        /// @brief Читает очередной блок данных
+        /// @return Число прочитанных байт, 0 - конец ввода
+        virtual size_t fill(char* dst, size_t size) = 0;
+        /// @brief Ждет, пока fill сможет вернуть данные без блокировки
+        /// @return false, если за timeout данных не появилось
+        virtual bool   wait_data(std::chrono::milliseconds timeout) { (void)timeout; return true; }
+        /// @brief Следующий fill читает данные с байта offset
+        virtual void   seek_data(uint64_t offset) = 0;
+
+    private:
+        bool line_buffered() const;
+        void read_more();
+
+        std::vector<char> buf_;
+        size_t            beg_ = 0, scan_ = 0, end_ = 0;
+        uint64_t          consumed_ = 0, waited_ns_ = 0;
+        bool              eof_ = false;
+    };
+
+    /// @brief Чтение строк из файлового дескриптора системным вызовом read
+    class FdLineSource final : public BufferedLineSource
+    {
+    public:
+        explicit FdLineSource(int fd, size_t buf_size = kDefaultBufferSize) : BufferedLineSource(buf_size), fd_(fd) {}
+    protected:
+        size_t fill(char* dst, size_t size) override;
+        bool   wait_data(std::chrono::milliseconds timeout) override;
+        void   seek_data(uint64_t offset) override;
+    private:
+        int fd_;
+    };
+
+    /// @brief Чтение строк из произвольного istream блоками (для строковых потоков и тестов)
+    class IstreamLineSource final : public BufferedLineSource
+    {
+    public:
+        explicit IstreamLineSource(istream& is, size_t buf_size = kDefaultBufferSize) : BufferedLineSource(buf_size), is_(is) {}
+    protected:
+        size_t fill(char* dst, size_t size) override;
+        void   seek_data(uint64_t offset) override;
+    private:
+        istream& is_;
+    };
+
+#ifndef _WIN32
+    /// @brief Чтение строк из файла, отображенного в память. Файл отображается окнами фиксированного
+    ///        размера, поэтому объем файла не ограничен объемом памяти. Строки выдаются прямо
+    ///        из отображения, без копирования
+    class MappedLineSource final : public ILineSource
+    {
+    public:
+        static constexpr size_t kDefaultWindowSize = size_t(64) << 20;
+
+        explicit MappedLineSource(std::string const& path, size_t window_size = kDefaultWindowSize);
+        ~MappedLineSource();
+        MappedLineSource(MappedLineSource const&) = delete;
+        MappedLineSource& operator=(MappedLineSource const&) = delete;
+
+        bool next_line(std::string_view& line) override;
+        uint64_t consumed() const override { return pos_; }
+        /// @throw std::runtime_error, если offset за концом файла
+        void seek(uint64_t offset) override;
+
+    private:
+        /// @brief Отображает length байт файла (не больше остатка) со страницы, содержащей offset
+        void map_window(uint64_t offset, size_t length);
+        void unmap_window();
+
+        int         fd_ = -1;
+        uint64_t    file_size_ = 0, pos_ = 0;
+        uint64_t    win_off_ = 0;
+        size_t      page_size_, window_size_, win_len_ = 0;
+        const char* win_ = nullptr;
+    };
+#endif
+
+} // otus_hw7
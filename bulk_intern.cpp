@@ -0,0 +1,90 @@
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "bulk_intern.h"
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    StringInterner::StringInterner(size_t capacity)
+    {
+        size_t cap = 16;
+        while( cap < capacity )
+            cap <<= 1;
+        mask_ = cap - 1;
+        max_size_ = cap / 4 * 3;
+        slots_.reset(new std::atomic<uint64_t>[cap]);
+        for( size_t i = 0; i < cap; ++i )
+            slots_[i].store(0, std::memory_order_relaxed);
+    }
+
+    StringInterner::~StringInterner()
+    {
+        for( size_t i = 0; i <= mask_; ++i )
+            if( uint64_t const slot = slots_[i].load(std::memory_order_relaxed) )
+                ::operator delete(const_cast<Entry*>(entry_of(slot)));
+    }
+
+    bool StringInterner::matches(uint64_t slot, uint64_t hash, std::string_view s)
+    {
+        if( (slot >> kTagShift) != (hash >> kTagShift) )
+            return false;
+        Entry const* e = entry_of(slot);
+        return e->hash_ == hash && e->size_ == s.size() && !std::memcmp(e->data(), s.data(), s.size());
+    }
+
+    bool StringInterner::intern(std::string_view s, std::string_view& out)
+    {
+        uint64_t const hash = std::hash<std::string_view>()(s);
+        Entry* fresh = nullptr;
+        uint64_t fresh_slot = 0;
+        for( size_t i = static_cast<size_t>(hash) & mask_;; i = (i + 1) & mask_ )
+        {
+            uint64_t slot = slots_[i].load(std::memory_order_acquire);
+            if( !slot )
+            {
+                if( !fresh )
+                {
+                    if( size_.load(std::memory_order_relaxed) >= max_size_ )
+                    {
+                        BULK_METRIC_ADD(kInternMisses, 1);
+                        return false;
+                    }
+                    fresh = static_cast<Entry*>(::operator new(sizeof(Entry) + s.size()));
+                    fresh->hash_ = hash;
+                    fresh->size_ = s.size();
+                    std::memcpy(const_cast<char*>(fresh->data()), s.data(), s.size());
+                    auto const ptr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(fresh));
+                    // адрес вне 48 бит (например, при 5-уровневых таблицах страниц) не помещается в ячейку
+                    if( ptr & ~kPtrMask )
+                    {
+                        ::operator delete(fresh);
+                        BULK_METRIC_ADD(kInternMisses, 1);
+                        return false;
+                    }
+                    fresh_slot = (hash & ~kPtrMask) | ptr;
+                }
+                if( slots_[i].compare_exchange_strong(slot, fresh_slot, std::memory_order_acq_rel, std::memory_order_acquire) )
+                {
+                    size_.fetch_add(1, std::memory_order_relaxed);
+                    BULK_METRIC_ADD(kInternMisses, 1);
+                    BULK_METRIC_ADD(kInternStoredBytes, s.size());
+                    out = std::string_view(fresh->data(), fresh->size_);
+                    return true;
+                }
+                // ячейку заняли: slot теперь содержит запись другого потока
+            }
+            if( matches(slot, hash, s) )
+            {
+                ::operator delete(fresh);
+                BULK_METRIC_ADD(kInternHits, 1);
+                BULK_METRIC_ADD(kInternSavedBytes, s.size());
+                Entry const* e = entry_of(slot);
+                out = std::string_view(e->data(), e->size_);
+                return true;
+            }
+        }
+    }
+
+} // otus_hw7
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    /// @brief Таблица интернирования строк команд для многих потоков: одинаковые команды хранятся
+    ///        в одном неизменяемом буфере, пакеты ссылаются на него без копирования.
+    ///        Открытая адресация с линейным пробированием, только вставка. Ячейка - одно атомарное
+    ///        слово: указатель на запись в младших 48 битах и старшие 16 бит хеша в старших, поэтому
+    ///        несовпадающие строки отсеиваются без обращения к записи. Запись хранит полный хеш.
+    ///        Таблица не растет: при заполнении на 3/4 новые строки не интернируются
+    class StringInterner
+    {
+    public:
+        static constexpr size_t kDefaultCapacity = size_t(1) << 16;
+
+        /// @param capacity Число ячеек, округляется вверх до степени двойки
+        explicit StringInterner(size_t capacity = kDefaultCapacity);
+        ~StringInterner();
+        StringInterner(StringInterner const&) = delete;
+        StringInterner& operator=(StringInterner const&) = delete;
+
+        /// @brief Находит или добавляет строку
+        /// @param out Строка в буфере таблицы, действительна до разрушения таблицы
+        /// @return false, если таблица заполнена и строки в ней нет или адрес новой записи не помещается в 48 бит
+        bool intern(std::string_view s, std::string_view& out);
+
+        size_t size() const { return size_.load(std::memory_order_relaxed); }
+        size_t capacity() const { return mask_ + 1; }
+
+    private:
+        struct Entry
+        {
+            uint64_t hash_;
+            size_t   size_;
+            const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+        };
+
+        static constexpr unsigned kTagShift = 48;
+        static constexpr uint64_t kPtrMask = (uint64_t(1) << kTagShift) - 1;
+
+        static Entry const* entry_of(uint64_t slot) { return reinterpret_cast<Entry const*>(static_cast<uintptr_t>(slot & kPtrMask)); }
+        static bool         matches(uint64_t slot, uint64_t hash, std::string_view s);
+
+        size_t                                   mask_, max_size_;
+        std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+        std::atomic<size_t>                      size_{0};
+    };
+    using StringInternerPtr_t = std::shared_ptr<StringInterner>;
+
+    /// @brief Добавляет команду в пакет: через таблицу интернирования, если она задана и не заполнена,
+    ///        иначе копированием
+    inline void push_command(BulkBuffer& bulk, std::string_view cmd, StringInterner* interner)
+    {
+        std::string_view ref;
+        if( interner && interner->intern(cmd, ref) )
+            bulk.push_ref(ref);
+        else
+            bulk.push(cmd);
+    }
+
+} // otus_hw7
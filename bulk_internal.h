@@ -1,11 +1,19 @@
+#pragma once
+
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
+#include <functional>
 #include <map>
 
 
 #include "bulk.h"
+#include "bulk_adaptive.h"
+#include "bulk_input.h"
+#include "bulk_intern.h"
+#include "bulk_memory.h"
+#include "bulk_push.h"
 
 namespace otus_hw7{
 
@@ -16,6 +24,8 @@ namespace otus_hw7{
     {
         virtual ~ICommandCreator() = default;
         virtual ICommandPtr_t create_command(const command_data_t& cmd_data) const = 0;
+        /// @brief Пакет дочитан: команды следующего пакета создаются уже для него
+        virtual void          end_bulk() {}
     };
     using ICommandCreatorPtr_t = std::unique_ptr<ICommandCreator>;
 
@@ -23,18 +33,45 @@ namespace otus_hw7{
     class InputParser : public IInputParser
     {
     public:
-        InputParser(size_t chunk_size, istream& is, ICommandCreatorPtr_t cmd_creator) 
-            : is_(is), chunk_size_(chunk_size), cmd_creator_{std::move(cmd_creator)}, last_tok_{}, last_stat_{} { }
+        /// @param max_latency Предельное время ожидания статического пакета с момента получения первой команды,
+        ///                    по истечении пакет завершается досрочно. 0 - без ограничения
+        InputParser(size_t chunk_size, ILineSourcePtr_t src, ICommandCreatorPtr_t cmd_creator, std::chrono::milliseconds max_latency = {}) 
+            : src_(std::move(src)), chunk_size_(chunk_size), max_latency_(max_latency), cmd_creator_{std::move(cmd_creator)}, last_tok_{}, last_stat_{} { }
+        InputParser(size_t chunk_size, istream& is, ICommandCreatorPtr_t cmd_creator, std::chrono::milliseconds max_latency = {}) 
+            : InputParser(chunk_size, ILineSourcePtr_t{new IstreamLineSource(is)}, std::move(cmd_creator), max_latency) { }
         Status   read_next_command(ICommandPtr_t& cmd) override
         {
             read_command();
             command_data_t cmd_data;
             Status st = get_last_command_data(cmd_data);
             cmd = create_command(cmd_data);
+            if( st == Status::kReady || st == Status::kStop )
+                cmd_creator_->end_bulk();
             return st;
         }
         
         Status   read_next_bulk(ICommandQueue& cmd_queue) override;         
+        Status   read_next_bulk(BulkBuffer& bulk) override;         
+
+        /// @brief Включает интернирование команд пакетов BulkBuffer; таблица должна пережить пакеты
+        void     set_interner(StringInternerPtr_t interner) { interner_ = std::move(interner); }
+        /// @brief Включает предел памяти для пакетов BulkBuffer. Блок сверх предела обрабатывается по политике
+        ///        бюджета, выгруженный блок отдается порциями не больше половины предела.
+        ///        Статический пакет ограничен chunk_size, поэтому при превышении чтение только ждет очереди
+        /// @param spill_dir Каталог временных файлов, пусто - TMPDIR или /tmp
+        void     set_budget(MemoryBudgetPtr_t budget, std::string spill_dir = {}) { budget_ = std::move(budget); spill_dir_ = std::move(spill_dir); }
+        /// @brief Размер статического пакета берется у контроллера, а не из chunk_size; контроллеру
+        ///        сообщается о каждом готовом статическом пакете
+        void     set_chunk_controller(ChunkControllerPtr_t ctl) { chunk_ctl_ = std::move(ctl); }
+
+        /// @brief Байты ввода, разобранные к этому моменту
+        uint64_t consumed() const { return src_->consumed(); }
+        /// @brief Вложенность открытых динамических блоков
+        size_t   depth() const { return block_count_; }
+        /// @brief Продолжает разбор с границы пакетов: чтение переходит на offset, открыто depth блоков.
+        ///        На границе пакетов незавершенных команд нет, поэтому других данных разбору не нужно
+        /// @throw std::runtime_error или std::system_error, если ввод не поддерживает переход
+        void     resume(uint64_t offset, size_t depth);
 
     private:
         enum class Token : uint8_t
@@ -45,17 +82,62 @@ namespace otus_hw7{
             kEnd_Of_File
         };
 
-        istream&   read_command();
-        Status     get_last_command_data(std::string& cmd) const { cmd = last_cmd_; return last_stat_; }
+        void       read_command();
+        bool       static_bulk_expired();
+        size_t     static_chunk() const { return chunk_ctl_ ? chunk_ctl_->chunk() : chunk_size_; }
+        /// @brief Статический пакет из cmd_count_ команд завершен
+        void       static_bulk_ready();
+        Status     get_last_command_data(std::string& cmd) const { cmd.assign(last_cmd_.data(), last_cmd_.size()); return last_stat_; }
         void       set_status(Status new_st);
+        void       check_budget(BulkBuffer& bulk);
+        Status     next_spilled_part(BulkBuffer& bulk);
         ICommandPtr_t create_command(const command_data_t&  cmd) const { return cmd_creator_->create_command(cmd); }
-        istream&   is_;
+        ILineSourcePtr_t src_;
         size_t     chunk_size_, cmd_count_ = 0, block_count_ = 0;
+        std::chrono::milliseconds max_latency_;
+        std::chrono::steady_clock::time_point first_cmd_at_;   ///< Получение первой команды статического пакета
 
         ICommandCreatorPtr_t cmd_creator_;
-        command_data_t  last_cmd_; 
+        StringInternerPtr_t  interner_;
+        ChunkControllerPtr_t chunk_ctl_;
+        std::string_view last_cmd_;     ///< Последняя прочитанная строка, действительна до следующего чтения
         Token        last_tok_;       
         Status       last_stat_;       
+
+        MemoryBudgetPtr_t          budget_;
+        std::string                spill_dir_;
+        std::unique_ptr<SpillFile> spill_;          ///< Выгруженные команды текущего блока
+        bool         spill_ready_ = false;          ///< Блок дочитан, spill_ отдается порциями
+        bool         discarding_ = false;           ///< Текущий блок отброшен, команды до его конца пропускаются
+        size_t       spill_parts_ = 0;
+        time_t       spill_created_at_ = 0;
+        uint64_t     spill_created_us_ = 0;
+    };
+
+    /// @brief Парсер порций с обработчиком-функцией (сервер, IBulkFeeder); инстанцирован в bulk.cpp
+    using PushParser = BasicPushParser<std::function<void(BulkBuffer&)>>;
+    extern template class BasicPushParser<std::function<void(BulkBuffer&)>>;
+
+    /// @brief Встраиваемый разбор поверх PushParser: пакеты получают номера и отдаются без копирования команд
+    class BulkFeeder final : public IBulkFeeder
+    {
+    public:
+        BulkFeeder(size_t chunk_size, BulkCallback_t on_bulk, std::chrono::milliseconds max_latency)
+            : on_bulk_(std::move(on_bulk)), parser_(chunk_size, [this](BulkBuffer& bulk){ deliver(bulk); }, max_latency)
+        {
+            parser_.set_borrow(true);
+        }
+
+        void feed(const char* data, size_t size) override { parser_.feed(data, size); }
+        void finish() override { parser_.finish(); }
+        void poll() override { parser_.expire(PushParser::clock_t::now()); }
+
+    private:
+        void deliver(BulkBuffer& bulk);
+
+        BulkCallback_t  on_bulk_;
+        uint64_t        seq_ = 0;
+        PushParser      parser_;
     };
 
     /// @brief Реализация простой команды, выводящей себя в поток
@@ -68,6 +150,16 @@ namespace otus_hw7{
         command_data_t cmd_;
     };
 
+    /// @brief Команда, ссылающаяся на строку в таблице интернирования
+    class InternedCommand : public ICommand
+    {
+    public:
+        explicit InternedCommand(std::string_view cmd) : cmd_(cmd) {}
+        virtual void execute(ICommandContext& ctx) override;
+    private:
+        std::string_view cmd_;
+    };
+
     /// @brief Реализация команды-декоратора
     class CommandDecorator : public ICommand
     {
@@ -91,6 +183,23 @@ namespace otus_hw7{
         }
     };
 
+    /// @brief Фабрика команд с интернированием: повторяющиеся команды разделяют одну строку таблицы.
+    ///        При заполненной таблице команда создается копированием, как в CommandCreator
+    class InterningCommandCreator : public ICommandCreator
+    {
+    public:
+        explicit InterningCommandCreator(StringInternerPtr_t interner) : interner_(std::move(interner)) {}
+        virtual ICommandPtr_t create_command(const command_data_t&  cmd) const override 
+        { 
+            std::string_view ref;
+            if( interner_->intern(cmd, ref) )
+                return ICommandPtr_t{new InternedCommand(ref)};
+            return ICommandPtr_t{new SimpleCommand(cmd)}; 
+        }
+    private:
+        StringInternerPtr_t interner_;
+    };
+
     /// @brief Реализация очереди команд
     class CommandQueue : public ICommandQueue
     {
@@ -133,6 +242,7 @@ namespace otus_hw7{
         {
             wrapee_->execute(q, cmd_executor, ctx);
         }
+        virtual void wait() override { wrapee_->wait(); }
     private:
         IQueueExecutorPtr_t wrapee_;
     };
@@ -150,14 +260,13 @@ namespace otus_hw7{
         ICommandExecutorPtr_t wrapee_;
     };
 
-    /// @brief Реализация декоратора для сохранения команды в файл
-    class CommandExecutorWithLog : public CommandExecutorDecorator 
+    /// @brief Реализация исполнителя, сохраняющего команды пакета в файл
+    class LogCommandExecutor : public ICommandExecutor
     {
     public:
-        CommandExecutorWithLog(ICommandExecutorPtr_t wrapee) : CommandExecutorDecorator(std::move(wrapee)) {}
+        LogCommandExecutor() { }
         virtual void execute_cmd(ICommand& c, ICommandContext& ctx) override 
         {
-            CommandExecutorDecorator::execute_cmd(c, ctx);
             init_log(ctx);
             ICommandContext log_ctx{ctx.bulk_size_, ctx.cmd_idx_, log_, ctx.cmd_created_at_};
             c.execute(log_ctx);
@@ -180,16 +289,30 @@ namespace otus_hw7{
         std::ofstream log_;
     };
 
+    /// @brief Реализация декоратора для сохранения команды в файл
+    class CommandExecutorWithLog : public CommandExecutorDecorator 
+    {
+    public:
+        CommandExecutorWithLog(ICommandExecutorPtr_t wrapee) : CommandExecutorDecorator(std::move(wrapee)) {}
+        virtual void execute_cmd(ICommand& c, ICommandContext& ctx) override 
+        {
+            CommandExecutorDecorator::execute_cmd(c, ctx);
+            log_.execute_cmd(c, ctx);
+        }
+    private:
+        LogCommandExecutor log_;
+    };
+
     /// @brief Реализация процессора команд
     class Processor : public IProcessor
     {
     public:
-        Processor(IInputParserPtr_t parser, ICommandQueuePtr_t cmd_queue, IQueueExecutorPtr_t executor) :
+        Processor(IInputParserPtr_t parser, ICommandQueuePtr_t cmd_queue, IQueueExecutorPtr_t executor, ostream& os = std::cout) :
         parser_(std::move(parser)), cmd_queue_(std::move(cmd_queue)), executor_(std::move(executor)), 
-        ctx_(std::make_unique<ICommandContext>(0, 0, std::cout, 0)) {}
+        ctx_(std::make_unique<ICommandContext>(0, 0, os, 0)) {}
         void process() override;
-    private:
-        void     exec_queue( );
+    protected:
+        virtual void     exec_queue( );
 
         IInputParserPtr_t parser_;
         ICommandQueuePtr_t cmd_queue_; 
@@ -197,10 +320,45 @@ namespace otus_hw7{
         ICommandContextPtr_t ctx_;
     };
 
+    /// @brief Процессор, собирающий пакет в непрерывный буфер и отдающий его приемникам целиком
+    class BulkProcessor : public IProcessor
+    {
+    public:
+        BulkProcessor(IInputParserPtr_t parser, std::vector<IBulkSinkPtr_t> sinks) :
+            parser_(std::move(parser)), sinks_(std::move(sinks)) {}
+        void process() override;
+    protected:
+        virtual void     exec_bulk( );
+        void             flush_sinks( );
+
+        IInputParserPtr_t           parser_;
+        BulkBuffer                  bulk_;
+        uint64_t                    bulk_seq_ = 0;
+        std::string                 text_;
+        std::vector<IBulkSinkPtr_t> sinks_;
+    };
+
+    /// @brief Фабрика источника строк: файл через mmap или стандартный ввод
+    /// @param options 
+    /// @return 
+    ILineSourcePtr_t create_line_source(Options& options);
+
+    /// @brief Фабрика приемников пакетов: консоль и файлы журнала
+    /// @param options 
+    /// @return Приемник для консоли
+    IBulkSinkPtr_t create_console_sink(Options& options);
+
+    /// @brief Фабрика приемника для записи пакетов в файлы журнала
+    /// @param options 
+    /// @return 
+    IBulkSinkPtr_t create_log_sink(Options& options);
+
     /// @brief Фабрика для парсера. Опции нужны для выбора типа парсера
     /// @param options 
+    /// @param budget Бюджет памяти ожидающих пакетов, nullptr - без ограничения
+    /// @param chunk_ctl Подбор размера статического пакета, nullptr - размер из options
     /// @return 
-    IInputParserPtr_t create_parser(Options& options);
+    IInputParserPtr_t create_parser(Options& options, MemoryBudgetPtr_t budget = nullptr, ChunkControllerPtr_t chunk_ctl = nullptr);
     
     /// @brief Фабрика очереди команд
     /// @return Указатель на абстрактный интерфейс очереди команд 
@@ -0,0 +1,459 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bulk_input.h"
+#include "bulk_internal.h"
+#include "bulk_metrics.h"
+
+extern char** environ;
+
+namespace po = boost::program_options;
+using namespace otus_hw7;
+
+namespace {
+
+    /// @brief Настройки генерируемого потока
+    struct LoadOptions
+    {
+        size_t      lines_ = 0;         ///< Число строк без закрывающих скобок в конце потока
+        double      rate_ = 0;          ///< Строк в секунду, 0 - без ограничения
+        size_t      burst_ = 1;         ///< Строк, отправляемых подряд за один такт
+        size_t      min_len_ = 0, max_len_ = 0;
+        double      block_prob_ = 0;    ///< Вероятность открыть динамический блок на очередной строке
+        size_t      max_depth_ = 0;     ///< Наибольшая вложенность блоков
+        size_t      block_len_ = 0;     ///< Средняя длина блока в строках
+        uint64_t    seed_ = 0;
+    };
+
+    /// @brief Генератор строк: команды "c<номер>xxx..." случайной длины вперемешку со скобками
+    ///        вложенных блоков. Номер команды связывает ее вывод со временем отправки.
+    ///        Незакрытые блоки закрываются в конце, иначе bulk отбросил бы их команды
+    class LoadGenerator
+    {
+    public:
+        explicit LoadGenerator(LoadOptions const& opts) : opts_(opts), rng_(opts.seed_) {}
+
+        /// @brief Очередная строка без перевода строки
+        /// @param id Номер команды или kNoId для скобки
+        /// @return false, если поток закончился
+        bool next(std::string& line, size_t& id)
+        {
+            line.clear();
+            id = kNoId;
+            if( produced_ >= opts_.lines_ )
+            {
+                if( !depth_ )
+                    return false;
+                --depth_;
+                line = "}";
+                return true;
+            }
+            ++produced_;
+            if( depth_ < opts_.max_depth_ && chance(opts_.block_prob_) )
+            {
+                ++depth_;
+                line = "{";
+                return true;
+            }
+            if( depth_ && chance(1. / double(std::max<size_t>(opts_.block_len_, 1))) )
+            {
+                --depth_;
+                line = "}";
+                return true;
+            }
+            id = commands_++;
+            line = "c" + std::to_string(id);
+            size_t const len = std::uniform_int_distribution<size_t>(opts_.min_len_, std::max(opts_.min_len_, opts_.max_len_))(rng_);
+            if( line.size() < len )
+                line.append(len - line.size(), 'x');
+            return true;
+        }
+
+        static constexpr size_t kNoId = size_t(-1);
+
+    private:
+        bool chance(double p) { return p > 0 && std::uniform_real_distribution<double>(0., 1.)(rng_) < p; }
+
+        LoadOptions     opts_;
+        std::mt19937_64 rng_;
+        size_t          produced_ = 0, depth_ = 0, commands_ = 0;
+    };
+
+    /// @brief Номер команды генератора, kNoId для чужой строки
+    size_t parse_id(std::string_view cmd)
+    {
+        if( cmd.size() < 2 || cmd[0] != 'c' )
+            return LoadGenerator::kNoId;
+        size_t id = 0, i = 1;
+        for( ; i < cmd.size() && cmd[i] >= '0' && cmd[i] <= '9'; ++i )
+            id = id * 10 + static_cast<size_t>(cmd[i] - '0');
+        return i > 1 ? id : LoadGenerator::kNoId;
+    }
+
+    /// @brief Время отправки команд и задержки их вывода. Отправитель и получатель - разные потоки
+    class LatencyProbe
+    {
+    public:
+        explicit LatencyProbe(size_t lines) : sent_ns_(new std::atomic<uint64_t>[lines]), lines_(lines) {}
+
+        void sent(size_t id, uint64_t ns) { sent_ns_[id].store(ns, std::memory_order_relaxed); }
+
+        /// @brief Команда выведена в момент now_ns
+        void emitted(Histogram& hist, std::string_view cmd, uint64_t now_ns)
+        {
+            size_t const id = parse_id(cmd);
+            if( id >= lines_ )
+                return;
+            uint64_t const sent = sent_ns_[id].load(std::memory_order_relaxed);
+            hist.record(now_ns > sent ? now_ns - sent : 0);
+        }
+
+    private:
+        std::unique_ptr<std::atomic<uint64_t>[]>    sent_ns_;
+        size_t                                      lines_;
+    };
+
+    /// @brief Результаты прогона
+    struct RunResult
+    {
+        Histogram   console_, log_;
+        size_t      commands_ = 0, bulks_ = 0;
+        uint64_t    elapsed_ns_ = 0;
+    };
+
+    /// @brief Пишет поток в fd с заданным темпом. Темп открытый: такты не ждут вывода bulk, а задержка
+    ///        отсчитывается от запланированного времени отправки, чтобы отставание не скрывало очередь
+    /// @return Число отправленных команд
+    size_t feed(int fd, LoadOptions const& opts, LatencyProbe& probe, uint64_t start_ns)
+    {
+        LoadGenerator gen(opts);
+        std::string line, out;
+        size_t id = 0, commands = 0;
+        size_t const burst = std::max<size_t>(opts.burst_, 1);
+        double const tick_ns = opts.rate_ > 0 ? 1e9 * double(burst) / opts.rate_ : 0;
+        // канал закрывается и при ошибке, иначе читающая сторона не дождется конца потока
+        std::unique_ptr<int, void(*)(int*)> const closer(&fd, [](int* p){ ::close(*p); });
+        bool more = gen.next(line, id);
+        for( uint64_t tick = 0; more; ++tick )
+        {
+            uint64_t const due = start_ns + static_cast<uint64_t>(tick_ns * double(tick));
+            if( tick_ns > 0 )
+                std::this_thread::sleep_for(std::chrono::nanoseconds(std::max<int64_t>(int64_t(due - metrics_now_ns()), 0)));
+            uint64_t const stamp = tick_ns > 0 ? due : metrics_now_ns();
+            out.clear();
+            for( size_t i = 0; i < burst && more; ++i, more = gen.next(line, id) )
+            {
+                if( id != LoadGenerator::kNoId )
+                {
+                    probe.sent(id, stamp);
+                    ++commands;
+                }
+                out += line;
+                out += '\n';
+            }
+            for( size_t done = 0; done < out.size(); )
+            {
+                ssize_t const n = ::write(fd, out.data() + done, out.size() - done);
+                if( n < 0 && errno == EINTR )
+                    continue;
+                if( n < 0 )
+                    throw std::system_error(errno, std::generic_category(), "write load");
+                done += static_cast<size_t>(n);
+            }
+        }
+        return commands;
+    }
+
+    void make_pipe(int fds[2])
+    {
+        if( ::pipe(fds) )
+            throw std::system_error(errno, std::generic_category(), "pipe");
+    }
+
+    /// @brief Приемник замеров: фиксирует задержку команд пакета, затем передает его дальше
+    class ProbeSink final : public IBulkSink
+    {
+    public:
+        ProbeSink(LatencyProbe& probe, Histogram& hist, IBulkSinkPtr_t next = nullptr, size_t* bulks = nullptr)
+            : probe_(probe), hist_(hist), next_(std::move(next)), bulks_(bulks) {}
+
+        void write(BulkBuffer const& bulk, std::string_view text) override
+        {
+            if( next_ )
+                next_->write(bulk, text);
+            uint64_t const now = metrics_now_ns();
+            for( auto cmd : bulk )
+                probe_.emitted(hist_, cmd, now);
+            if( bulks_ )
+                ++*bulks_;
+        }
+        void flush() override
+        {
+            if( next_ )
+                next_->flush();
+        }
+
+    private:
+        LatencyProbe&   probe_;
+        Histogram&      hist_;
+        IBulkSinkPtr_t  next_;
+        size_t*         bulks_;
+    };
+
+    /// @brief Прогон через BulkProcessor в этом же процессе: поток разбирается из канала,
+    ///        замеряется вывод в консоль и, если задано, запись журнала
+    void run_inproc(size_t chunk, LoadOptions const& opts, bool with_log, size_t max_latency_ms, RunResult& res)
+    {
+        LatencyProbe probe(opts.lines_);
+        int fds[2];
+        make_pipe(fds);
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new ProbeSink(probe, res.console_, nullptr, &res.bulks_));
+        if( with_log )
+        {
+            Options log_opts{};
+            sinks.emplace_back(new ProbeSink(probe, res.log_, create_log_sink(log_opts)));
+        }
+        BulkProcessor processor(IInputParserPtr_t{ new InputParser(chunk, ILineSourcePtr_t{new FdLineSource(fds[0])},
+                                                                   ICommandCreatorPtr_t{new CommandCreator},
+                                                                   std::chrono::milliseconds(max_latency_ms)) },
+                                std::move(sinks));
+        uint64_t const start = metrics_now_ns();
+        std::exception_ptr error;
+        std::thread feeder([&]
+        {
+            try
+            {
+                res.commands_ = feed(fds[1], opts, probe, start);
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+        });
+        processor.process();
+        feeder.join();
+        res.elapsed_ns_ = metrics_now_ns() - start;
+        ::close(fds[0]);
+        if( error )
+            std::rethrow_exception(error);
+    }
+
+    /// @brief Прогон через процесс bulk: поток подается на его стандартный ввод,
+    ///        замеряется появление пакетов в стандартном выводе
+    void run_pipe(std::string const& bulk_path, std::vector<std::string> args, size_t chunk,
+                  LoadOptions const& opts, RunResult& res)
+    {
+        LatencyProbe probe(opts.lines_);
+        int in[2], out[2];
+        make_pipe(in);
+        make_pipe(out);
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, in[0], 0);
+        posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+        posix_spawn_file_actions_addclose(&actions, in[1]);
+        posix_spawn_file_actions_addclose(&actions, out[0]);
+        args.insert(args.begin(), {bulk_path, std::to_string(chunk)});
+        std::vector<char*> argv;
+        for( auto& arg : args )
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        pid_t pid = 0;
+        int const rc = ::posix_spawn(&pid, bulk_path.c_str(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        ::close(in[0]);
+        ::close(out[1]);
+        if( rc )
+        {
+            ::close(in[1]);
+            ::close(out[0]);
+            throw std::system_error(rc, std::generic_category(), "spawn " + bulk_path);
+        }
+
+        uint64_t const start = metrics_now_ns();
+        std::exception_ptr error;
+        std::thread feeder([&]
+        {
+            try
+            {
+                res.commands_ = feed(in[1], opts, probe, start);
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+        });
+
+        // строки "bulk: a, b" разбираются на команды по мере чтения
+        std::string pending;
+        char buf[64 << 10];
+        for( ssize_t n; (n = ::read(out[0], buf, sizeof(buf))) != 0; )
+        {
+            if( n < 0 && errno == EINTR )
+                continue;
+            if( n < 0 )
+                break;
+            uint64_t const now = metrics_now_ns();
+            pending.append(buf, static_cast<size_t>(n));
+            size_t begin = 0;
+            for( size_t eol; (eol = pending.find('\n', begin)) != std::string::npos; begin = eol + 1 )
+            {
+                std::string_view line(pending.data() + begin, eol - begin);
+                if( line.compare(0, 6, "bulk: ") )
+                    continue;
+                line.remove_prefix(6);
+                for( size_t pos = 0; pos <= line.size(); )
+                {
+                    size_t const comma = std::min(line.find(", ", pos), line.size());
+                    probe.emitted(res.console_, line.substr(pos, comma - pos), now);
+                    pos = comma + 2;
+                }
+                ++res.bulks_;
+            }
+            pending.erase(0, begin);
+        }
+        feeder.join();
+        res.elapsed_ns_ = metrics_now_ns() - start;
+        ::close(out[0]);
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        if( error )
+            std::rethrow_exception(error);
+        if( !WIFEXITED(status) || WEXITSTATUS(status) )
+            throw std::runtime_error(bulk_path + " failed");
+    }
+
+    void print_latency(ostream& os, const char* name, Histogram const& hist)
+    {
+        HistogramSnapshot snap;
+        hist.merge_into(snap);
+        if( !snap.count_ )
+            return;
+        os << ' ' << name << "_us p50=" << snap.percentile(0.5) / 1000 << " p90=" << snap.percentile(0.9) / 1000
+           << " p99=" << snap.percentile(0.99) / 1000 << " p999=" << snap.percentile(0.999) / 1000
+           << " max=" << snap.max_ / 1000;
+    }
+
+    void print_result(size_t chunk, RunResult const& res)
+    {
+        HistogramSnapshot console;
+        res.console_.merge_into(console);
+        double const seconds = double(res.elapsed_ns_) / 1e9;
+        std::cout << "chunk=" << chunk << " commands=" << res.commands_ << " bulks=" << res.bulks_
+                  << std::fixed << std::setprecision(3) << " elapsed_s=" << seconds
+                  << std::setprecision(0) << " throughput=" << (seconds > 0 ? double(res.commands_) / seconds : 0) << "/s";
+        print_latency(std::cout, "console", res.console_);
+        print_latency(std::cout, "log", res.log_);
+        std::cout << std::endl;
+        if( console.count_ != res.commands_ )
+            std::cerr << "chunk=" << chunk << ": " << res.commands_ - std::min<size_t>(console.count_, res.commands_)
+                      << " commands were not emitted" << std::endl;
+    }
+
+    std::vector<std::string> split_args(std::string const& s)
+    {
+        std::istringstream is(s);
+        std::vector<std::string> args;
+        for( std::string arg; is >> arg; )
+            args.push_back(arg);
+        return args;
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        LoadOptions opts;
+        std::vector<size_t> chunks;
+        std::string target, bulk_path, bulk_args;
+        bool with_log = false;
+        size_t max_latency_ms = 0;
+
+        po::options_description desc("bulk-loadgen [--target inproc|pipe|stdout] [--rate R] [--chunk_size N...] - нагрузка на bulk\n"
+                                     "и замер задержки от отправки команды до ее вывода; с --rate 0 - предельная пропускная способность\n"
+                                     "Аргументы командной строки");
+        desc.add_options()
+            ("help", "Отображение справки")
+            ("target", po::value<std::string>(&target)->default_value("inproc"),
+                "inproc - BulkProcessor в этом процессе, pipe - процесс bulk через стандартные ввод и вывод, "
+                "stdout - только вывести поток")
+            ("bulk", po::value<std::string>(&bulk_path), "Путь к bulk для --target pipe, по умолчанию рядом с bulk-loadgen")
+            ("bulk_args", po::value<std::string>(&bulk_args), "Дополнительные аргументы bulk через пробел")
+            ("chunk_size", po::value<std::vector<size_t>>(&chunks)->multitoken(), "Размеры статического пакета, прогон на каждый, по умолчанию 3")
+            ("lines", po::value<size_t>(&opts.lines_)->default_value(100000), "Число строк потока")
+            ("rate", po::value<double>(&opts.rate_)->default_value(0), "Строк в секунду, 0 - без ограничения")
+            ("burst", po::value<size_t>(&opts.burst_)->default_value(1), "Строк за один такт: всплески при том же среднем темпе")
+            ("min_len", po::value<size_t>(&opts.min_len_)->default_value(8), "Наименьшая длина команды")
+            ("max_len", po::value<size_t>(&opts.max_len_)->default_value(32), "Наибольшая длина команды")
+            ("block_prob", po::value<double>(&opts.block_prob_)->default_value(0), "Вероятность открыть динамический блок на строке")
+            ("max_depth", po::value<size_t>(&opts.max_depth_)->default_value(3), "Наибольшая вложенность блоков")
+            ("block_len", po::value<size_t>(&opts.block_len_)->default_value(16), "Средняя длина блока в строках")
+            ("seed", po::value<uint64_t>(&opts.seed_)->default_value(1), "Начальное значение генератора")
+            ("log", po::bool_switch(&with_log), "inproc: писать журнал по пакету на файл и замерять задержку записи")
+            ("max_latency_ms", po::value<size_t>(&max_latency_ms)->default_value(0), "inproc: предельное время ожидания статического пакета");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        if( vm.count("help") )
+        {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        if( chunks.empty() )
+            chunks.push_back(3);
+        if( std::find(chunks.begin(), chunks.end(), size_t(0)) != chunks.end() )
+            throw std::runtime_error("chunk_size must be positive");
+
+        if( target == "stdout" )
+        {
+            LatencyProbe probe(opts.lines_);
+            feed(::dup(1), opts, probe, metrics_now_ns());
+            return 0;
+        }
+        if( target != "inproc" && target != "pipe" )
+            throw std::runtime_error("unknown target: " + target);
+        // завершившийся bulk не должен обрывать генератор сигналом, ошибка записи сообщит о нем
+        std::signal(SIGPIPE, SIG_IGN);
+        if( bulk_path.empty() )
+        {
+            std::string const self = argv[0];
+            size_t const slash = self.rfind('/');
+            bulk_path = (slash == std::string::npos ? std::string(".") : self.substr(0, slash)) + "/bulk";
+        }
+        for( size_t chunk : chunks )
+        {
+            RunResult res;
+            if( target == "inproc" )
+                run_inproc(chunk, opts, with_log, max_latency_ms, res);
+            else
+                run_pipe(bulk_path, split_args(bulk_args), chunk, opts, res);
+            print_result(chunk, res);
+        }
+        return 0;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,143 @@
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "bulk_memory.h"
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    MemoryBudget::MemoryBudget(size_t cap, OverflowPolicy policy) : cap_(cap), policy_(policy)
+    {
+        BULK_METRIC_GAUGE(kMemoryCap, cap_);
+    }
+
+    void MemoryBudget::charge(size_t size)
+    {
+        size_t const total = queued_.fetch_add(size) + size;
+        BULK_METRIC_GAUGE(kPendingBytes, total);
+        note_peak(total);
+    }
+
+    void MemoryBudget::release(size_t size)
+    {
+        [[maybe_unused]] size_t const total = queued_.fetch_sub(size) - size;
+        BULK_METRIC_GAUGE(kPendingBytes, total);
+        // waiting_ читается после изменения queued_: ожидающий либо увидит новый объем, либо будет разбужен
+        if( waiting_ )
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            room_.notify_all();
+        }
+    }
+
+    bool MemoryBudget::over(size_t current)
+    {
+        size_t const total = queued() + current;
+        note_peak(total);
+        return cap_ && total > cap_;
+    }
+
+    bool MemoryBudget::wait_for_room(size_t current)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        waiting_ = true;
+        size_t q;
+        for( bool stalled = false; (q = queued_.load()) && q + current > cap_; stalled = true )
+        {
+            if( !stalled )
+                BULK_METRIC_ADD(kMemoryStalls, 1);
+            room_.wait(lk);
+        }
+        waiting_ = false;
+        return current <= cap_;
+    }
+
+    void MemoryBudget::note_peak(size_t total)
+    {
+        size_t peak = peak_.load(std::memory_order_relaxed);
+        while( total > peak && !peak_.compare_exchange_weak(peak, total, std::memory_order_relaxed) )
+            ;
+        BULK_METRIC_GAUGE(kPeakPendingBytes, peak_.load(std::memory_order_relaxed));
+    }
+
+    SpillFile::SpillFile(std::string const& dir)
+    {
+#ifndef _WIN32
+        std::string path = dir;
+        if( path.empty() )
+        {
+            const char* const tmp = std::getenv("TMPDIR");
+            path = tmp && *tmp ? tmp : "/tmp";
+        }
+        path += "/bulkspillXXXXXX";
+        int const fd = ::mkstemp(&path[0]);
+        if( fd < 0 )
+            throw std::system_error(errno, std::generic_category(), "mkstemp " + path);
+        ::unlink(path.c_str());
+        file_ = ::fdopen(fd, "w+b");
+        if( !file_ )
+        {
+            int const err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fdopen " + path);
+        }
+#else
+        (void)dir;
+        file_ = std::tmpfile();
+        if( !file_ )
+            throw std::system_error(errno, std::generic_category(), "tmpfile");
+#endif
+    }
+
+    SpillFile::~SpillFile()
+    {
+        if( file_ )
+            std::fclose(file_);
+    }
+
+    void SpillFile::append(BulkBuffer const& bulk)
+    {
+        for( auto cmd : bulk )
+        {
+            uint32_t const len = static_cast<uint32_t>(cmd.size());
+            if( std::fwrite(&len, sizeof(len), 1, file_) != 1 ||
+                (len && std::fwrite(cmd.data(), len, 1, file_) != 1) )
+                throw std::system_error(errno, std::generic_category(), "write spill file");
+            bytes_ += len;
+        }
+        commands_ += bulk.size();
+    }
+
+    void SpillFile::rewind()
+    {
+        if( std::fflush(file_) )
+            throw std::system_error(errno, std::generic_category(), "flush spill file");
+        std::rewind(file_);
+        left_ = commands_;
+    }
+
+    bool SpillFile::read_part(BulkBuffer& bulk, size_t max_bytes)
+    {
+        if( !left_ )
+            return false;
+        for( size_t got = 0; left_ && (!got || got < max_bytes); --left_ )
+        {
+            uint32_t len = 0;
+            if( std::fread(&len, sizeof(len), 1, file_) != 1 )
+                throw std::runtime_error("spill file is truncated");
+            cmd_.resize(len);
+            if( len && std::fread(&cmd_[0], len, 1, file_) != 1 )
+                throw std::runtime_error("spill file is truncated");
+            bulk.push(cmd_);
+            got += len + 1;
+        }
+        return true;
+    }
+
+} // otus_hw7
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    /// @brief Бюджет памяти ожидающих пакетов: учитывает байты пакетов в очередях вывода и выполнения
+    ///        (charge/release) вместе с читаемым пакетом и сообщает о превышении предела.
+    ///        Текущий и наибольший объем выводятся в метриках, по ним подбирается предел
+    class MemoryBudget
+    {
+    public:
+        /// @param cap Предел, байт; 0 - без ограничения
+        MemoryBudget(size_t cap, OverflowPolicy policy);
+
+        size_t          cap() const { return cap_; }
+        OverflowPolicy  policy() const { return policy_; }
+        /// @brief Байты пакетов в очередях
+        size_t          queued() const { return queued_.load(std::memory_order_relaxed); }
+        /// @brief Наибольший объем ожидающих пакетов вместе с читаемым
+        size_t          peak() const { return peak_.load(std::memory_order_relaxed); }
+
+        /// @brief Пакет размером size поставлен в очередь
+        void    charge(size_t size);
+        /// @brief Пакет размером size покинул очередь; будит ожидающего в wait_for_room
+        void    release(size_t size);
+
+        /// @brief Превышен ли предел вместе с читаемым пакетом размером current
+        bool    over(size_t current);
+        /// @brief Ждет, пока очереди не освободят место для пакета размером current
+        /// @return false, если очереди пусты, а пакет все равно не помещается
+        bool    wait_for_room(size_t current);
+
+    private:
+        void    note_peak(size_t total);
+
+        size_t                      cap_;
+        OverflowPolicy              policy_;
+        std::atomic<size_t>         queued_{0}, peak_{0};
+        std::mutex                  mtx_;
+        std::condition_variable     room_;
+        std::atomic<bool>           waiting_{false};
+    };
+    using MemoryBudgetPtr_t = std::shared_ptr<MemoryBudget>;
+
+    /// @brief Временный файл для команд блока, не поместившегося в память. Команды дописываются
+    ///        записями <длина u32> <байты>, затем читаются порциями. Файл удаляется сразу после создания
+    class SpillFile
+    {
+    public:
+        /// @param dir Каталог файла, пусто - TMPDIR или /tmp
+        /// @throw std::system_error, если файл не создан
+        explicit SpillFile(std::string const& dir = {});
+        ~SpillFile();
+        SpillFile(SpillFile const&) = delete;
+        SpillFile& operator=(SpillFile const&) = delete;
+
+        /// @brief Дописывает команды пакета
+        void    append(BulkBuffer const& bulk);
+        /// @brief Переходит к чтению с начала файла
+        void    rewind();
+        /// @brief Дочитывает в bulk очередную порцию: команды, пока их длина не достигнет max_bytes,
+        ///        но не меньше одной
+        /// @return false, если команд не осталось
+        bool    read_part(BulkBuffer& bulk, size_t max_bytes);
+        /// @brief Все команды прочитаны
+        bool    exhausted() const { return !left_; }
+
+        size_t  commands() const { return commands_; }
+        size_t  bytes() const { return bytes_; }
+
+    private:
+        std::FILE*  file_ = nullptr;
+        size_t      commands_ = 0, bytes_ = 0, left_ = 0;
+        std::string cmd_;
+    };
+
+} // otus_hw7
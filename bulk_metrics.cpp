@@ -0,0 +1,263 @@
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <ctime>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    const char* to_string(MetricCounter counter)
+    {
+        switch( counter )
+        {
+            case MetricCounter::kLinesRead:         return "lines_read";
+            case MetricCounter::kBulksEmitted:      return "bulks_emitted";
+            case MetricCounter::kCommandsEmitted:   return "commands_emitted";
+            case MetricCounter::kInternHits:        return "intern_hits";
+            case MetricCounter::kInternMisses:      return "intern_misses";
+            case MetricCounter::kInternStoredBytes: return "intern_stored_bytes";
+            case MetricCounter::kInternSavedBytes:  return "intern_saved_bytes";
+            case MetricCounter::kExecSteals:        return "exec_steals";
+            case MetricCounter::kSpilledBlocks:     return "spilled_blocks";
+            case MetricCounter::kSpilledBytes:      return "spilled_bytes";
+            case MetricCounter::kDiscardedBlocks:   return "discarded_blocks";
+            case MetricCounter::kMemoryStalls:      return "memory_stalls";
+            case MetricCounter::kCommits:           return "commits";
+            case MetricCounter::kCommittedBulks:    return "committed_bulks";
+            case MetricCounter::kCheckpoints:       return "checkpoints";
+            default:                                return "unknown";
+        }
+    }
+
+    const char* to_string(MetricStage stage)
+    {
+        switch( stage )
+        {
+            case MetricStage::kParse:           return "parse";
+            case MetricStage::kQueueWait:       return "queue_wait";
+            case MetricStage::kConsoleWrite:    return "console_write";
+            case MetricStage::kFileWrite:       return "file_write";
+            case MetricStage::kExecute:         return "execute";
+            case MetricStage::kSync:            return "sync";
+            default:                            return "unknown";
+        }
+    }
+
+    const char* to_string(MetricGauge gauge)
+    {
+        switch( gauge )
+        {
+            case MetricGauge::kPendingBytes:        return "pending_bytes";
+            case MetricGauge::kPeakPendingBytes:    return "peak_pending_bytes";
+            case MetricGauge::kMemoryCap:           return "memory_cap";
+            case MetricGauge::kChunkSize:           return "chunk_size";
+            case MetricGauge::kInputRate:           return "input_rate";
+            case MetricGauge::kBulkP99Us:           return "bulk_p99_us";
+            default:                                return "unknown";
+        }
+    }
+
+    uint64_t HistogramSnapshot::percentile(double q) const
+    {
+        if( !count_ )
+            return 0;
+        auto const target = static_cast<uint64_t>(std::ceil(q * double(count_)));
+        uint64_t seen = 0;
+        for( size_t i = 0; i < buckets_.size(); ++i )
+        {
+            seen += buckets_[i];
+            if( seen >= target && buckets_[i] )
+            {
+                uint64_t const upper = i + 1 < Histogram::kBuckets ? Histogram::lower_bound(i + 1) - 1 : max_;
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    void Histogram::merge_into(HistogramSnapshot& snap) const
+    {
+        snap.buckets_.resize(kBuckets);
+        for( size_t i = 0; i < kBuckets; ++i )
+            snap.buckets_[i] += buckets_[i].load(std::memory_order_relaxed);
+        snap.count_ += count_.load(std::memory_order_relaxed);
+        snap.sum_ += sum_.load(std::memory_order_relaxed);
+        uint64_t const max = max_.load(std::memory_order_relaxed);
+        if( max > snap.max_ )
+            snap.max_ = max;
+    }
+
+    MetricsRegistry& MetricsRegistry::instance()
+    {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    ThreadMetrics* MetricsRegistry::attach()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        threads_.emplace_back(new ThreadMetrics);
+        return threads_.back().get();
+    }
+
+    MetricsSnapshot MetricsRegistry::snapshot() const
+    {
+        MetricsSnapshot snap;
+        std::lock_guard<std::mutex> lk(mtx_);
+        for( auto const& tm : threads_ )
+        {
+            for( size_t i = 0; i < static_cast<size_t>(MetricCounter::kCount); ++i )
+                snap.counters_[i] += tm->counters_[i].load(std::memory_order_relaxed);
+            for( size_t i = 0; i < static_cast<size_t>(MetricStage::kCount); ++i )
+                tm->stages_[i].merge_into(snap.stages_[i]);
+            tm->bulk_size_.merge_into(snap.bulk_size_);
+            tm->commit_batch_.merge_into(snap.commit_batch_);
+        }
+        for( size_t i = 0; i < static_cast<size_t>(MetricGauge::kCount); ++i )
+            snap.gauges_[i] = gauges_[i].load(std::memory_order_relaxed);
+        return snap;
+    }
+
+    static void write_histogram_json(ostream& os, HistogramSnapshot const& h)
+    {
+        os << "{\"count\":" << h.count_ << ",\"mean\":" << static_cast<uint64_t>(h.mean())
+           << ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9)
+           << ",\"p99\":" << h.percentile(0.99) << ",\"p999\":" << h.percentile(0.999)
+           << ",\"max\":" << h.max_ << "}";
+    }
+
+    void write_metrics_json(ostream& os, MetricsSnapshot const& snap, const char* reason)
+    {
+        os << "{\"time\":" << std::time(nullptr) << ",\"reason\":\"" << reason << "\",\"counters\":{";
+        for( size_t i = 0; i < static_cast<size_t>(MetricCounter::kCount); ++i )
+            os << (i ? "," : "") << '"' << to_string(static_cast<MetricCounter>(i)) << "\":" << snap.counters_[i];
+        os << "}";
+        uint64_t const intern_lookups = snap.counters_[static_cast<size_t>(MetricCounter::kInternHits)] + 
+                                        snap.counters_[static_cast<size_t>(MetricCounter::kInternMisses)];
+        if( intern_lookups )
+            os << ",\"intern_hit_rate\":" << double(snap.counters_[static_cast<size_t>(MetricCounter::kInternHits)]) / double(intern_lookups);
+        auto write_gauges = [&os, &snap](const char* name, MetricGauge first, MetricGauge last)
+        {
+            os << ",\"" << name << "\":{";
+            for( size_t i = static_cast<size_t>(first); i <= static_cast<size_t>(last); ++i )
+                os << (i != static_cast<size_t>(first) ? "," : "") << '"' << to_string(static_cast<MetricGauge>(i)) << "\":" << snap.gauges_[i];
+            os << "}";
+        };
+        write_gauges("memory", MetricGauge::kPendingBytes, MetricGauge::kMemoryCap);
+        // размер пакета выводится только при его подборе
+        if( snap.gauges_[static_cast<size_t>(MetricGauge::kChunkSize)] )
+            write_gauges("chunk", MetricGauge::kChunkSize, MetricGauge::kBulkP99Us);
+        os << ",\"bulk_size\":";
+        write_histogram_json(os, snap.bulk_size_);
+        os << ",\"commit_batch\":";
+        write_histogram_json(os, snap.commit_batch_);
+        os << ",\"latency_ns\":{";
+        for( size_t i = 0; i < static_cast<size_t>(MetricStage::kCount); ++i )
+        {
+            os << (i ? "," : "") << '"' << to_string(static_cast<MetricStage>(i)) << "\":";
+            write_histogram_json(os, snap.stages_[i]);
+        }
+        os << "}}";
+    }
+
+#ifndef _WIN32
+    static std::atomic<int> g_stats_signal_fd{-1};
+
+    static void on_stats_signal(int)
+    {
+        int const saved_errno = errno;
+        int const fd = g_stats_signal_fd.load(std::memory_order_relaxed);
+        if( fd >= 0 )
+        {
+            char const c = 's';
+            ssize_t const n = ::write(fd, &c, 1);
+            (void)n;
+        }
+        errno = saved_errno;
+    }
+#endif
+
+    StatsReporter::StatsReporter(std::string const& path, std::chrono::milliseconds interval)
+        : file_(path == "-" ? std::ofstream() : std::ofstream(path, std::ios_base::out | std::ios_base::app)),
+          os_(path == "-" ? std::cerr : file_), interval_(interval)
+    {
+        if( path != "-" && !file_ )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+#ifndef _WIN32
+        if( ::pipe(wake_fds_) < 0 )
+            throw std::system_error(errno, std::generic_category(), "pipe");
+        for( int fd : wake_fds_ )
+        {
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+            ::fcntl(fd, F_SETFL, O_NONBLOCK);
+        }
+        g_stats_signal_fd.store(wake_fds_[1]);
+        struct sigaction sa{};
+        sa.sa_handler = on_stats_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        ::sigaction(SIGUSR1, &sa, nullptr);
+        thread_ = std::thread(&StatsReporter::run, this);
+#endif
+    }
+
+    StatsReporter::~StatsReporter()
+    {
+#ifndef _WIN32
+        std::signal(SIGUSR1, SIG_DFL);
+        g_stats_signal_fd.store(-1);
+        stop_ = true;
+        char const c = 'q';
+        ssize_t const n = ::write(wake_fds_[1], &c, 1);
+        (void)n;
+        if( thread_.joinable() )
+            thread_.join();
+        ::close(wake_fds_[0]);
+        ::close(wake_fds_[1]);
+#endif
+        dump("exit");
+    }
+
+    void StatsReporter::dump(const char* reason)
+    {
+        MetricsSnapshot const snap = MetricsRegistry::instance().snapshot();
+        std::lock_guard<std::mutex> lk(dump_mtx_);
+        write_metrics_json(os_, snap, reason);
+        os_ << std::endl;
+    }
+
+    void StatsReporter::run()
+    {
+#ifndef _WIN32
+        auto const timeout = interval_.count() ? static_cast<int>(interval_.count()) : -1;
+        while( !stop_ )
+        {
+            pollfd pfd{wake_fds_[0], POLLIN, 0};
+            int const r = ::poll(&pfd, 1, timeout);
+            if( r < 0 && errno != EINTR )
+                break;
+            if( !r )
+            {
+                dump("periodic");
+                continue;
+            }
+            bool signalled = false;
+            char buf[64];
+            for( ssize_t n; (n = ::read(wake_fds_[0], buf, sizeof(buf))) > 0; )
+                for( ssize_t i = 0; i < n; ++i )
+                    signalled |= buf[i] == 's';
+            if( signalled && !stop_ )
+                dump("signal");
+        }
+#endif
+    }
+
+} // otus_hw7
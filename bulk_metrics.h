@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    /// @brief Счетчики событий конвейера
+    enum class MetricCounter : uint8_t
+    {
+        kLinesRead,
+        kBulksEmitted,
+        kCommandsEmitted,
+        kInternHits,            ///< команда найдена в таблице интернирования
+        kInternMisses,          ///< команда добавлена в таблицу (или не поместилась)
+        kInternStoredBytes,     ///< байты уникальных команд в таблице
+        kInternSavedBytes,      ///< байты, не скопированные благодаря интернированию
+        kExecSteals,            ///< пакеты, перехваченные потоком пула выполнения у соседа
+        kSpilledBlocks,         ///< блоки, выгруженные во временный файл по пределу памяти
+        kSpilledBytes,          ///< байты команд, выгруженные во временный файл
+        kDiscardedBlocks,       ///< блоки, отброшенные по пределу памяти
+        kMemoryStalls,          ///< ожидания чтения, пока очереди освободят память
+        kCommits,               ///< групповые фиксации журнала (синхронизации с носителем)
+        kCommittedBulks,        ///< пакеты, записанные на носитель групповой фиксацией
+        kCheckpoints,           ///< сохраненные контрольные точки
+        kCount
+    };
+
+    /// @brief Текущие значения, общие для процесса
+    enum class MetricGauge : uint8_t
+    {
+        kPendingBytes,          ///< байты пакетов в очередях вывода и выполнения
+        kPeakPendingBytes,      ///< наибольший объем ожидающих пакетов вместе с читаемым
+        kMemoryCap,             ///< предел памяти ожидающих пакетов, 0 - без ограничения
+        kChunkSize,             ///< размер статического пакета, выбранный подбором; 0 - подбор выключен
+        kInputRate,             ///< оценка темпа ввода при подборе размера, команд в секунду
+        kBulkP99Us,             ///< p99 задержки последних статических пакетов при подборе размера, мкс
+        kCount
+    };
+
+    /// @brief Этапы конвейера, для которых собирается гистограмма задержек
+    enum class MetricStage : uint8_t
+    {
+        kParse,             ///< разбор ввода до готовности пакета
+        kQueueWait,         ///< ожидание пакета в очереди потока вывода
+        kConsoleWrite,      ///< вывод пакета в консоль
+        kFileWrite,         ///< запись пакета в журнал
+        kExecute,           ///< выполнение команд пакета обработчиками в пуле
+        kSync,              ///< синхронизация журнала с носителем при групповой фиксации
+        kCount
+    };
+
+    const char* to_string(MetricCounter counter);
+    const char* to_string(MetricStage stage);
+    const char* to_string(MetricGauge gauge);
+
+    inline uint64_t metrics_now_ns()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /// @brief Сводная копия гистограммы для расчета перцентилей
+    struct HistogramSnapshot
+    {
+        std::vector<uint64_t>   buckets_;
+        uint64_t                count_ = 0, sum_ = 0, max_ = 0;
+
+        /// @brief Значение, не меньше которого q-я доля записей (верхняя граница корзины)
+        uint64_t percentile(double q) const;
+        double   mean() const { return count_ ? double(sum_) / double(count_) : 0.; }
+    };
+
+    /// @brief Гистограмма в духе HDR: значения до 16 хранятся точно, далее каждая степень двойки
+    ///        делится на 16 линейных корзин, относительная погрешность не более 1/16.
+    ///        Пишет только поток-владелец (без атомарных RMW), читать можно из любого потока
+    class Histogram
+    {
+    public:
+        static constexpr unsigned kSubBits = 4;
+        static constexpr uint64_t kSubCount = uint64_t(1) << kSubBits;
+        static constexpr size_t   kBuckets = (64 - kSubBits + 1) * kSubCount;
+
+        static size_t bucket_of(uint64_t v)
+        {
+            if( v < kSubCount )
+                return static_cast<size_t>(v);
+#ifdef _MSC_VER
+            unsigned e = 0;
+            for( uint64_t x = v; x >>= 1; )
+                ++e;
+#else
+            unsigned const e = 63u - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+            return (e - kSubBits + 1) * kSubCount + ((v >> (e - kSubBits)) & (kSubCount - 1));
+        }
+        static uint64_t lower_bound(size_t idx)
+        {
+            if( idx < kSubCount )
+                return idx;
+            size_t const range = idx / kSubCount, sub = idx % kSubCount;
+            return (kSubCount + sub) << (range - 1);
+        }
+
+        void record(uint64_t v)
+        {
+            bump(buckets_[bucket_of(v)], 1);
+            bump(count_, 1);
+            bump(sum_, v);
+            if( v > max_.load(std::memory_order_relaxed) )
+                max_.store(v, std::memory_order_relaxed);
+        }
+
+        void merge_into(HistogramSnapshot& snap) const;
+
+    private:
+        static void bump(std::atomic<uint64_t>& a, uint64_t n) { a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+        std::atomic<uint64_t> buckets_[kBuckets] = {};
+        std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+    };
+
+    /// @brief Метрики одного потока
+    class ThreadMetrics
+    {
+    public:
+        void add(MetricCounter counter, uint64_t n)
+        {
+            auto& c = counters_[static_cast<size_t>(counter)];
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+        void record(MetricStage stage, uint64_t ns) { stages_[static_cast<size_t>(stage)].record(ns); }
+        void record_bulk_size(uint64_t cmds) { bulk_size_.record(cmds); }
+        void record_commit_batch(uint64_t bulks) { commit_batch_.record(bulks); }
+
+    private:
+        friend class MetricsRegistry;
+        std::atomic<uint64_t>   counters_[static_cast<size_t>(MetricCounter::kCount)] = {};
+        Histogram               stages_[static_cast<size_t>(MetricStage::kCount)];
+        Histogram               bulk_size_;
+        Histogram               commit_batch_;
+    };
+
+    /// @brief Сводные метрики всех потоков
+    struct MetricsSnapshot
+    {
+        uint64_t            counters_[static_cast<size_t>(MetricCounter::kCount)] = {};
+        HistogramSnapshot   stages_[static_cast<size_t>(MetricStage::kCount)];
+        HistogramSnapshot   bulk_size_;
+        HistogramSnapshot   commit_batch_;      ///< Число пакетов в групповой фиксации
+        uint64_t            gauges_[static_cast<size_t>(MetricGauge::kCount)] = {};
+    };
+
+    /// @brief Выводит метрики одной строкой JSON
+    void write_metrics_json(ostream& os, MetricsSnapshot const& snap, const char* reason);
+
+    /// @brief Реестр метрик потоков. Блок метрик потока создается при первом обращении
+    ///        и живет до конца процесса, чтобы метрики завершившихся потоков попадали в отчет
+    class MetricsRegistry
+    {
+    public:
+        static MetricsRegistry& instance();
+        static ThreadMetrics&   local()
+        {
+            static thread_local ThreadMetrics* tm = instance().attach();
+            return *tm;
+        }
+
+        MetricsSnapshot snapshot() const;
+
+        void set(MetricGauge gauge, uint64_t v) { gauges_[static_cast<size_t>(gauge)].store(v, std::memory_order_relaxed); }
+
+    private:
+        ThreadMetrics* attach();
+
+        mutable std::mutex                          mtx_;
+        std::vector<std::unique_ptr<ThreadMetrics>> threads_;
+        std::atomic<uint64_t>                       gauges_[static_cast<size_t>(MetricGauge::kCount)] = {};
+    };
+
+    /// @brief Замер длительности этапа в пределах области видимости
+    class StageTimer
+    {
+    public:
+        explicit StageTimer(MetricStage stage) : stage_(stage), start_(metrics_now_ns()) {}
+        ~StageTimer() { MetricsRegistry::local().record(stage_, metrics_now_ns() - start_); }
+    private:
+        MetricStage stage_;
+        uint64_t    start_;
+    };
+
+    /// @brief Приемник-декоратор, замеряющий запись и сброс как этап stage
+    class TimedBulkSink : public IBulkSink
+    {
+    public:
+        TimedBulkSink(IBulkSinkPtr_t wrapee, MetricStage stage) : wrapee_(std::move(wrapee)), stage_(stage) {}
+        void write(BulkBuffer const& bulk, std::string_view text) override
+        {
+            StageTimer timer(stage_);
+            wrapee_->write(bulk, text);
+        }
+        void flush() override
+        {
+            StageTimer timer(stage_);
+            wrapee_->flush();
+        }
+        void sync() override
+        {
+            StageTimer timer(stage_);
+            wrapee_->sync();
+        }
+    private:
+        IBulkSinkPtr_t  wrapee_;
+        MetricStage     stage_;
+    };
+
+    /// @brief Вывод метрик в файл статистики строками JSON: периодически, по SIGUSR1 и при завершении
+    class StatsReporter : public IStatsReporter
+    {
+    public:
+        /// @param path     Файл статистики, "-" - стандартный поток ошибок
+        /// @param interval Период вывода, 0 - только по сигналу и при завершении
+        StatsReporter(std::string const& path, std::chrono::milliseconds interval);
+        ~StatsReporter();
+        StatsReporter(StatsReporter const&) = delete;
+        StatsReporter& operator=(StatsReporter const&) = delete;
+
+        void dump(const char* reason) override;
+
+    private:
+        void run();
+
+        std::ofstream               file_;
+        ostream&                    os_;
+        std::chrono::milliseconds   interval_;
+        std::mutex                  dump_mtx_;
+        int                         wake_fds_[2] = {-1, -1};
+        std::atomic<bool>           stop_{false};
+        std::thread                 thread_;
+    };
+
+} // otus_hw7
+
+#ifdef BULK_METRICS
+#define BULK_METRIC_ONLY(...)           __VA_ARGS__
+#define BULK_METRIC_ADD(counter, n)     ::otus_hw7::MetricsRegistry::local().add(::otus_hw7::MetricCounter::counter, (n))
+#define BULK_METRIC_RECORD(stage, ns)   ::otus_hw7::MetricsRegistry::local().record(::otus_hw7::MetricStage::stage, (ns))
+#define BULK_METRIC_BULK(cmds)          do { auto& bulk_metric_tm_ = ::otus_hw7::MetricsRegistry::local();\
+                                             bulk_metric_tm_.add(::otus_hw7::MetricCounter::kBulksEmitted, 1);\
+                                             bulk_metric_tm_.add(::otus_hw7::MetricCounter::kCommandsEmitted, (cmds));\
+                                             bulk_metric_tm_.record_bulk_size(cmds); } while(0)
+#define BULK_METRIC_TIMER(stage)        ::otus_hw7::StageTimer bulk_metric_timer_##stage(::otus_hw7::MetricStage::stage)
+#define BULK_METRIC_GAUGE(gauge, v)     ::otus_hw7::MetricsRegistry::instance().set(::otus_hw7::MetricGauge::gauge, (v))
+#define BULK_METRIC_COMMIT(bulks)       do { auto& bulk_metric_tm_ = ::otus_hw7::MetricsRegistry::local();\
+                                             bulk_metric_tm_.add(::otus_hw7::MetricCounter::kCommits, 1);\
+                                             bulk_metric_tm_.add(::otus_hw7::MetricCounter::kCommittedBulks, (bulks));\
+                                             bulk_metric_tm_.record_commit_batch(bulks); } while(0)
+#else
+#define BULK_METRIC_ONLY(...)
+#define BULK_METRIC_ADD(counter, n)     ((void)0)
+#define BULK_METRIC_RECORD(stage, ns)   ((void)0)
+#define BULK_METRIC_BULK(cmds)          ((void)0)
+#define BULK_METRIC_TIMER(stage)        ((void)0)
+#define BULK_METRIC_GAUGE(gauge, v)     ((void)0)
+#define BULK_METRIC_COMMIT(bulks)       ((void)0)
+#endif
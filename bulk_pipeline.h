@@ -0,0 +1,107 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+#include "bulk_metrics.h"
+#include "bulk_push.h"
+#include "bulk_sinks.h"
+
+namespace otus_hw7{
+
+    /// @brief Статический приемник-декоратор, замеряющий запись и сброс как этап Stage (аналог TimedBulkSink)
+    template<class Sink, MetricStage Stage>
+    class Timed
+    {
+    public:
+        explicit Timed(std::unique_ptr<Sink> sink) : sink_(std::move(sink)) {}
+        void write(BulkBuffer const& bulk, std::string_view text)
+        {
+            BULK_METRIC_ONLY(StageTimer timer(Stage);)
+            sink_->write(bulk, text);
+        }
+        void flush()
+        {
+            BULK_METRIC_ONLY(StageTimer timer(Stage);)
+            sink_->flush();
+        }
+    private:
+        std::unique_ptr<Sink> sink_;
+    };
+
+    /// @brief Статический разветвитель: пакет передается всем приемникам по порядку
+    template<class... Sinks>
+    class Tee
+    {
+    public:
+        explicit Tee(Sinks... sinks) : sinks_(std::move(sinks)...) {}
+        void write(BulkBuffer const& bulk, std::string_view text)
+        {
+            std::apply([&](auto&... sink){ (sink.write(bulk, text), ...); }, sinks_);
+        }
+        void flush()
+        {
+            std::apply([](auto&... sink){ (sink.flush(), ...); }, sinks_);
+        }
+    private:
+        std::tuple<Sinks...> sinks_;
+    };
+
+    /// @brief Конвейер, собранный на этапе компиляции: источник строк Source, пакет BulkBuffer
+    ///        и приемник Sink (например, Tee<...>) - конкретные типы, поэтому весь путь команды
+    ///        от чтения строки до записи пакета обходится без виртуальных вызовов.
+    ///        Пакеты формируются по правилам InputParser, без досрочного завершения по времени
+    template<class Source, class Sink>
+    class Pipeline : public IProcessor
+    {
+    public:
+        Pipeline(size_t chunk_size, std::unique_ptr<Source> src, Sink sink, StringInternerPtr_t interner = nullptr)
+            : src_(std::move(src)), sink_(std::move(sink)), parser_(chunk_size, Emit{this})
+        {
+            parser_.set_interner(std::move(interner));
+        }
+
+        void process() override
+        {
+            BULK_METRIC_ONLY(parse_started_ns_ = metrics_now_ns();)
+            for( std::string_view line; src_->next_line(line); )
+                parser_.push_line(line);
+            parser_.finish();
+            sink_.flush();
+        }
+
+    private:
+        /// @brief Обработчик пакетов парсера без std::function: вызов emit встраивается
+        struct Emit
+        {
+            Pipeline* self_;
+            void operator()(BulkBuffer& bulk) const { self_->emit(bulk); }
+        };
+
+        void emit(BulkBuffer& bulk)
+        {
+            BULK_METRIC_RECORD(kParse, metrics_now_ns() - parse_started_ns_);
+            bulk.seq_ = ++bulk_seq_;
+            BULK_METRIC_BULK(bulk.size());
+            text_.clear();
+            format_bulk(bulk, text_);
+            sink_.write(bulk, text_);
+            BULK_METRIC_ONLY(parse_started_ns_ = metrics_now_ns();)
+        }
+
+        std::unique_ptr<Source> src_;
+        Sink                    sink_;
+        BasicPushParser<Emit>   parser_;
+        uint64_t                bulk_seq_ = 0;
+        std::string             text_;
+        BULK_METRIC_ONLY(uint64_t parse_started_ns_ = 0;)
+    };
+
+    /// @brief Выбирает заранее инстанцированный статический конвейер по настройкам
+    /// @return nullptr, если для настроек статического конвейера нет (асинхронный вывод, сервер,
+    ///         параллельный разбор, --max_latency_ms, --flush interval, io_uring, пул выполнения) - тогда нужен BulkProcessor
+    IProcessorPtr_t create_static_pipeline(Options& options);
+
+} // otus_hw7
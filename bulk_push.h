@@ -0,0 +1,145 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "bulk_intern.h"
+#include "bulk_metrics.h"
+
+namespace otus_hw7{
+
+    /// @brief Парсер ввода, поступающего порциями (например, из сокета) или готовыми строками:
+    ///        строки собираются из порций, пакеты формируются по тем же правилам, что и в InputParser,
+    ///        и отдаются обработчику Handler (вызываемому с BulkBuffer&). Статический пакет отдается
+    ///        сразу по заполнении, а не при чтении следующей строки
+    template<class Handler>
+    class BasicPushParser
+    {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        /// @param on_bulk Обработчик готового пакета; после возврата пакет очищается
+        /// @param max_latency Предельное время ожидания статического пакета, см. InputParser. 0 - без ограничения
+        BasicPushParser(size_t chunk_size, Handler on_bulk, std::chrono::milliseconds max_latency = {})
+            : chunk_size_(chunk_size), max_latency_(max_latency), on_bulk_(std::move(on_bulk)) {}
+
+        /// @brief Разбирает очередную порцию; незавершенная строка ждет следующей порции
+        void feed(const char* data, size_t size)
+        {
+            const char* const end = data + size;
+            while( data != end )
+            {
+                auto const eol = static_cast<const char*>(std::memchr(data, '\n', static_cast<size_t>(end - data)));
+                if( !eol )
+                {
+                    partial_.append(data, static_cast<size_t>(end - data));
+                    break;
+                }
+                if( partial_.empty() )
+                    push_line(std::string_view(data, static_cast<size_t>(eol - data)), borrow_);
+                else
+                {
+                    partial_.append(data, static_cast<size_t>(eol - data));
+                    push_line(partial_);
+                    partial_.clear();
+                }
+                data = eol + 1;
+            }
+            // незавершенный пакет переживет порцию
+            if( borrow_ )
+                bulk_.own();
+        }
+
+        /// @brief Разбирает одну строку без перевода строки
+        /// @param borrowed Команда может ссылаться на строку без копирования, см. set_borrow
+        void push_line(std::string_view line, bool borrowed = false)
+        {
+            BULK_METRIC_ADD(kLinesRead, 1);
+            if( line.size() == 1 && line[0] == '{' )
+            {
+                if( !depth_++ )
+                    emit();
+            }
+            else if( line.size() == 1 && line[0] == '}' )
+            {
+                if( depth_ && !--depth_ )
+                    emit();
+            }
+            else
+            {
+                if( bulk_.empty() )
+                {
+                    bulk_.stamp_now();
+                    if( max_latency_.count() )
+                        first_cmd_at_ = clock_t::now();
+                }
+                if( borrowed && !interner_ && !line.empty() )
+                    bulk_.push_ref(line);
+                else
+                    push_command(bulk_, line, interner_.get());
+                if( !depth_ && bulk_.size() == chunk_size_ )
+                    emit();
+            }
+        }
+
+        /// @brief Конец ввода: отдает статический пакет, незавершенный динамический блок отбрасывается
+        void finish()
+        {
+            if( !partial_.empty() )
+            {
+                push_line(partial_);
+                partial_.clear();
+            }
+            if( !depth_ )
+                emit();
+            depth_ = 0;
+            bulk_.clear();
+        }
+
+        /// @brief Срок досрочного завершения статического пакета, time_point::max() - ожидающего пакета нет
+        clock_t::time_point deadline() const
+        {
+            if( !max_latency_.count() || depth_ || bulk_.empty() )
+                return clock_t::time_point::max();
+            return first_cmd_at_ + max_latency_;
+        }
+        /// @brief Отдает статический пакет, если его срок истек к моменту now
+        void expire(clock_t::time_point now)
+        {
+            if( deadline() <= now )
+                emit();
+        }
+
+        /// @brief Включает интернирование команд; таблица может быть общей для многих парсеров
+        void set_interner(StringInternerPtr_t interner) { interner_ = std::move(interner); }
+        /// @brief Команды пакета, целиком пришедшего в одной порции, ссылаются на порцию без копирования.
+        ///        Такой пакет действителен только в обработчике; команды пакета, не завершенного порцией,
+        ///        копируются в пакет перед возвратом из feed. Не действует при интернировании
+        void set_borrow(bool borrow) { borrow_ = borrow; }
+
+    private:
+        void emit()
+        {
+            // пакет очищается и при исключении обработчика: он может ссылаться на порцию
+            struct Clear
+            {
+                BulkBuffer& bulk_;
+                ~Clear() { bulk_.clear(); }
+            } clear{bulk_};
+            if( !bulk_.empty() )
+                on_bulk_(bulk_);
+        }
+
+        size_t          chunk_size_, depth_ = 0;
+        std::chrono::milliseconds max_latency_;
+        clock_t::time_point first_cmd_at_;
+        Handler         on_bulk_;
+        BulkBuffer      bulk_;
+        std::string     partial_;       ///< Хвост порции без перевода строки
+        StringInternerPtr_t interner_;
+        bool            borrow_ = false;
+    };
+
+} // otus_hw7
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    constexpr size_t kCacheLineSize = 64;
+
+    /// @brief Стратегия ожидания блокирующей очереди: сначала активное ожидание, затем уступка
+    ///        процессора, затем сон на futex до прихода уведомления
+    struct WaitStrategy
+    {
+        unsigned spins_ = 64;
+        unsigned yields_ = 8;
+    };
+
+    /// @brief Счетчик событий: позволяет потоку уснуть, не теряя уведомления, пришедшего
+    ///        между последней проверкой условия и засыпанием
+    class EventCount
+    {
+    public:
+        uint32_t prepare_wait()
+        {
+            waiters_.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return epoch_.load(std::memory_order_acquire);
+        }
+        void cancel_wait() { waiters_.fetch_sub(1, std::memory_order_relaxed); }
+        void wait(uint32_t key)
+        {
+#ifdef __linux__
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
+            while( epoch_.load(std::memory_order_acquire) == key )
+                std::this_thread::yield();
+#endif
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        void notify_all()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if( !waiters_.load(std::memory_order_relaxed) )
+                return;
+            epoch_.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+        }
+    private:
+        std::atomic<uint32_t> epoch_{0};
+        std::atomic<uint32_t> waiters_{0};
+    };
+
+    inline size_t round_up_pow2(size_t n)
+    {
+        size_t p = 1;
+        while( p < n )
+            p <<= 1;
+        return p;
+    }
+
+    /// @brief Ограниченное кольцо без блокировок для одного производителя и одного потребителя
+    template <typename T>
+    class SpscRing
+    {
+    public:
+        using value_type = T;
+
+        explicit SpscRing(size_t capacity) : buf_(round_up_pow2(capacity ? capacity : 1)), mask_(buf_.size() - 1) {}
+
+        /// @brief Перемещает v в кольцо; при заполненном кольце v не трогается
+        bool try_push(T& v)
+        {
+            size_t const tail = tail_.load(std::memory_order_relaxed);
+            if( tail - head_cache_ > mask_ )
+            {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if( tail - head_cache_ > mask_ )
+                    return false;
+            }
+            buf_[tail & mask_] = std::move(v);
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& v)
+        {
+            size_t const head = head_.load(std::memory_order_relaxed);
+            if( head == tail_cache_ )
+            {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if( head == tail_cache_ )
+                    return false;
+            }
+            v = std::move(buf_[head & mask_]);
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+        size_t capacity() const { return buf_.size(); }
+
+    private:
+        std::vector<T>                          buf_;
+        size_t const                            mask_;
+        alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+        size_t                                  tail_cache_ = 0;    ///< Копия tail_ потребителя
+        alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+        size_t                                  head_cache_ = 0;    ///< Копия head_ производителя
+    };
+
+    /// @brief Ограниченное кольцо без блокировок для многих производителей и потребителей
+    ///        (ячейки с номерами последовательности, схема Д. Вьюкова)
+    template <typename T>
+    class MpmcRing
+    {
+    public:
+        using value_type = T;
+
+        explicit MpmcRing(size_t capacity) : cells_(round_up_pow2(capacity ? capacity : 1)), mask_(cells_.size() - 1)
+        {
+            for( size_t i = 0; i < cells_.size(); ++i )
+                cells_[i].seq_.store(i, std::memory_order_relaxed);
+        }
+
+        bool try_push(T& v)
+        {
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                Cell& cell = cells_[pos & mask_];
+                size_t const seq = cell.seq_.load(std::memory_order_acquire);
+                auto const diff = static_cast<std::ptrdiff_t>(seq - pos);
+                if( !diff )
+                {
+                    if( enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                    {
+                        cell.data_ = std::move(v);
+                        cell.seq_.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if( diff < 0 )
+                    return false;
+                else
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        bool try_pop(T& v)
+        {
+            size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                Cell& cell = cells_[pos & mask_];
+                size_t const seq = cell.seq_.load(std::memory_order_acquire);
+                auto const diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+                if( !diff )
+                {
+                    if( dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                    {
+                        v = std::move(cell.data_);
+                        cell.seq_.store(pos + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if( diff < 0 )
+                    return false;
+                else
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        size_t size() const
+        {
+            size_t const tail = enqueue_pos_.load(std::memory_order_acquire);
+            size_t const head = dequeue_pos_.load(std::memory_order_acquire);
+            return tail > head ? tail - head : 0;
+        }
+        size_t capacity() const { return cells_.size(); }
+
+    private:
+        struct alignas(kCacheLineSize) Cell
+        {
+            std::atomic<size_t> seq_;
+            T                   data_;
+        };
+        std::vector<Cell>                           cells_;
+        size_t const                                mask_;
+        alignas(kCacheLineSize) std::atomic<size_t> enqueue_pos_{0};
+        alignas(kCacheLineSize) std::atomic<size_t> dequeue_pos_{0};
+    };
+
+    /// @brief Блокирующая очередь поверх кольца без блокировок: мьютекс не берется ни при вставке,
+    ///        ни при извлечении, ожидание по WaitStrategy. Закрытая очередь дочитывается до конца
+    template <typename Ring>
+    class RingQueue
+    {
+    public:
+        using value_type = typename Ring::value_type;
+
+        explicit RingQueue(size_t capacity, WaitStrategy ws = {}) : ring_(capacity), ws_(ws) {}
+
+        bool try_push(value_type& v)
+        {
+            if( !ring_.try_push(v) )
+                return false;
+            not_empty_.notify_all();
+            return true;
+        }
+
+        bool try_pop(value_type& v)
+        {
+            if( !ring_.try_pop(v) )
+                return false;
+            not_full_.notify_all();
+            return true;
+        }
+
+        /// @brief Вставка с ожиданием свободного места
+        /// @return false, если очередь закрыта
+        bool push(value_type v)
+        {
+            bool pushed = false;
+            wait_for(not_full_, [&]{ return closed() || (pushed = try_push(v)); });
+            return pushed;
+        }
+
+        /// @brief Извлечение с ожиданием элемента
+        /// @return false, если очередь закрыта и пуста
+        bool pop(value_type& v)
+        {
+            bool popped = false;
+            wait_for(not_empty_, [&]{ return (popped = try_pop(v)) || closed(); });
+            return popped || try_pop(v);
+        }
+
+        /// @brief Вставляет n элементов, ожидая места при необходимости
+        /// @return Число вставленных элементов, меньше n только для закрытой очереди
+        size_t push_batch(value_type* items, size_t n)
+        {
+            size_t done = 0;
+            while( done < n && !closed() )
+            {
+                size_t const before = done;
+                while( done < n && ring_.try_push(items[done]) )
+                    ++done;
+                if( done != before )
+                    not_empty_.notify_all();
+                else
+                    wait_for(not_full_, [&]{ return closed() || ring_.size() < ring_.capacity(); });
+            }
+            return done;
+        }
+
+        /// @brief Извлекает до max элементов, ожидая хотя бы одного
+        /// @return Число извлеченных элементов, 0 - очередь закрыта и пуста
+        size_t pop_batch(value_type* out, size_t max)
+        {
+            size_t done = 0;
+            while( max )
+            {
+                while( done < max && ring_.try_pop(out[done]) )
+                    ++done;
+                if( done )
+                {
+                    not_full_.notify_all();
+                    return done;
+                }
+                if( closed() )
+                    return ring_.try_pop(out[0]) ? 1 : 0;
+                wait_for(not_empty_, [&]{ return closed() || ring_.size(); });
+            }
+            return 0;
+        }
+
+        void close()
+        {
+            closed_flag_.store(true, std::memory_order_release);
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+        size_t size() const { return ring_.size(); }
+
+    private:
+        bool closed() const { return closed_flag_.load(std::memory_order_acquire); }
+
+        /// @brief Ждет выполнения условия: активно, затем уступая процессор, затем на futex
+        template <typename Pred>
+        void wait_for(EventCount& ev, Pred ready)
+        {
+            for( unsigned i = 0; i < ws_.spins_; ++i )
+                if( ready() )
+                    return;
+            for( unsigned i = 0; i < ws_.yields_; ++i )
+            {
+                if( ready() )
+                    return;
+                std::this_thread::yield();
+            }
+            for(;;)
+            {
+                uint32_t const key = ev.prepare_wait();
+                if( ready() )
+                {
+                    ev.cancel_wait();
+                    return;
+                }
+                ev.wait(key);
+            }
+        }
+
+        Ring                ring_;
+        WaitStrategy        ws_;
+        std::atomic<bool>   closed_flag_{false};
+        EventCount          not_empty_, not_full_;
+    };
+
+    template <typename T> using SpscQueue = RingQueue<SpscRing<T>>;
+    template <typename T> using MpmcQueue = RingQueue<MpmcRing<T>>;
+
+    /// @brief Ограниченная очередь команд на кольце без блокировок для передачи между потоками:
+    ///        заполняется одним потоком, выполняется другим. push на полном кольце ждет по WaitStrategy,
+    ///        пока потребитель не освободит место, поэтому очередь не подходит для накопления целого
+    ///        блока в одном потоке перед выполнением - для этого есть CommandQueue
+    template <typename Ring>
+    class RingCommandQueue : public ICommandQueue
+    {
+    public:
+        explicit RingCommandQueue(size_t capacity, WaitStrategy ws = {}) : q_(capacity, ws) {}
+
+        void     push(ICommandPtr_t cmd) override { q_.push(std::move(cmd)); }
+        bool     pop(ICommandPtr_t& cmd) override { return q_.try_pop(cmd); }
+        void     reset() override { for( ICommandPtr_t cmd; q_.try_pop(cmd); ) ; }
+        size_t   size() const override { return q_.size(); }
+
+    private:
+        RingQueue<Ring> q_;
+    };
+
+    using SpscCommandQueue = RingCommandQueue<SpscRing<ICommandPtr_t>>;
+    using MpmcCommandQueue = RingCommandQueue<MpmcRing<ICommandPtr_t>>;
+
+} // otus_hw7
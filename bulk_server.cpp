@@ -0,0 +1,286 @@
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bulk_metrics.h"
+#include "bulk_server.h"
+#include "bulk_sinks.h"
+
+namespace otus_hw7{
+
+    namespace {
+        constexpr size_t    kReadBufferSize = size_t(64) << 10;
+        constexpr int       kReadsPerEvent = 16;       ///< Ограничение чтений за событие, чтобы один клиент не занимал цикл
+        constexpr int       kMaxEvents = 64;
+
+        std::atomic<int>    g_server_stop_fd{-1};
+
+        void on_stop_signal(int)
+        {
+            int const saved_errno = errno;
+            int const fd = g_server_stop_fd.load(std::memory_order_relaxed);
+            if( fd >= 0 )
+            {
+                uint64_t const one = 1;
+                ssize_t const n = ::write(fd, &one, sizeof(one));
+                (void)n;
+            }
+            errno = saved_errno;
+        }
+
+        void epoll_add(int epfd, int fd, uint32_t events)
+        {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.fd = fd;
+            if( ::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 )
+                throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        }
+    }
+
+    BulkServer::BulkServer(ServerOptions const& opts, std::vector<IBulkSinkPtr_t> sinks) : opts_(opts)
+    {
+        if( !opts_.threads_ )
+            opts_.threads_ = 1;
+        for( auto& sink : sinks )
+            sinks_.emplace_back(new LockedBulkSink(std::move(sink)));
+        if( opts_.intern_capacity_ )
+            interner_ = std::make_shared<StringInterner>(opts_.intern_capacity_);
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if( opts_.path_.size() >= sizeof(addr.sun_path) )
+            throw std::system_error(ENAMETOOLONG, std::generic_category(), "socket path " + opts_.path_);
+        std::memcpy(addr.sun_path, opts_.path_.c_str(), opts_.path_.size() + 1);
+
+        struct stat st{};
+        if( ::stat(opts_.path_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) )
+            ::unlink(opts_.path_.c_str());
+
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if( listen_fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "socket");
+        if( ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(listen_fd_, SOMAXCONN) < 0 )
+        {
+            int const err = errno;
+            ::close(listen_fd_);
+            throw std::system_error(err, std::generic_category(), "bind " + opts_.path_);
+        }
+        stop_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if( stop_fd_ < 0 )
+        {
+            int const err = errno;
+            ::close(listen_fd_);
+            ::unlink(opts_.path_.c_str());
+            throw std::system_error(err, std::generic_category(), "eventfd");
+        }
+    }
+
+    BulkServer::~BulkServer()
+    {
+        ::close(listen_fd_);
+        ::unlink(opts_.path_.c_str());
+        ::close(stop_fd_);
+    }
+
+    void BulkServer::stop()
+    {
+        uint64_t const one = 1;
+        ssize_t const n = ::write(stop_fd_, &one, sizeof(one));
+        (void)n;
+    }
+
+    void BulkServer::process()
+    {
+        g_server_stop_fd.store(stop_fd_);
+        struct sigaction sa{}, old_int{}, old_term{};
+        sa.sa_handler = on_stop_signal;
+        sigemptyset(&sa.sa_mask);
+        ::sigaction(SIGINT, &sa, &old_int);
+        ::sigaction(SIGTERM, &sa, &old_term);
+
+        std::vector<std::thread> loops;
+        try
+        {
+            for( size_t i = 1; i < opts_.threads_; ++i )
+                loops.emplace_back(&BulkServer::run_loop, this);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lk(error_mtx_);
+            error_ = std::current_exception();
+            stop();
+        }
+        run_loop();
+        for( auto& t : loops )
+            t.join();
+
+        ::sigaction(SIGINT, &old_int, nullptr);
+        ::sigaction(SIGTERM, &old_term, nullptr);
+        g_server_stop_fd.store(-1);
+
+        if( error_ )
+            std::rethrow_exception(error_);
+        for( auto& sink : sinks_ )
+            sink->flush();
+    }
+
+    void BulkServer::run_loop()
+    {
+        try
+        {
+            serve();
+        }
+        catch(...)
+        {
+            {
+                std::lock_guard<std::mutex> lk(error_mtx_);
+                if( !error_ )
+                    error_ = std::current_exception();
+            }
+            // остальные циклы видят eventfd остановки и завершаются
+            stop();
+        }
+    }
+
+    void BulkServer::serve()
+    {
+        int const epfd = ::epoll_create1(EPOLL_CLOEXEC);
+        if( epfd < 0 )
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+
+        std::unordered_map<int, ConnectionPtr_t> conns;
+        // при ошибке закрываются соединения цикла и сам epoll; недочитанные команды соединений теряются
+        struct Cleanup
+        {
+            int                                         epfd_;
+            std::unordered_map<int, ConnectionPtr_t>&   conns_;
+            ~Cleanup()
+            {
+                for( auto const& c : conns_ )
+                    ::close(c.first);
+                ::close(epfd_);
+            }
+        } cleanup{epfd, conns};
+        auto close_client = [&conns](int fd)
+        {
+            auto it = conns.find(fd);
+            it->second->parser_.finish();
+            ::close(fd);
+            conns.erase(it);
+        };
+
+        epoll_add(epfd, listen_fd_, EPOLLIN | EPOLLEXCLUSIVE);
+        epoll_add(epfd, stop_fd_, EPOLLIN);
+
+        epoll_event events[kMaxEvents];
+        for( bool stopping = false; !stopping; )
+        {
+            int timeout = -1;
+            if( opts_.max_latency_.count() )
+            {
+                auto const now = PushParser::clock_t::now();
+                auto deadline = PushParser::clock_t::time_point::max();
+                for( auto& c : conns )
+                {
+                    c.second->parser_.expire(now);
+                    deadline = std::min(deadline, c.second->parser_.deadline());
+                }
+                if( deadline != PushParser::clock_t::time_point::max() )
+                    timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+            }
+            int const n = ::epoll_wait(epfd, events, kMaxEvents, timeout);
+            if( n < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            for( int i = 0; i < n; ++i )
+            {
+                int const fd = events[i].data.fd;
+                if( fd == stop_fd_ )
+                    stopping = true;
+                else if( fd == listen_fd_ )
+                    accept_clients(epfd, conns);
+                else if( !read_client(*conns[fd]) )
+                    close_client(fd);
+            }
+        }
+
+        while( !conns.empty() )
+        {
+            int const fd = conns.begin()->first;
+            while( read_client(*conns[fd]) )
+            {
+                pollfd pfd{fd, POLLIN, 0};
+                if( ::poll(&pfd, 1, 0) <= 0 )
+                    break;
+            }
+            close_client(fd);
+        }
+    }
+
+    void BulkServer::accept_clients(int epfd, std::unordered_map<int, ConnectionPtr_t>& conns)
+    {
+        for(;;)
+        {
+            int const fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if( fd < 0 )
+            {
+                if( errno == EINTR || errno == ECONNABORTED )
+                    continue;
+                return;
+            }
+            conns[fd].reset(new Connection{fd, PushParser(opts_.chunk_size_, [this](BulkBuffer& bulk){ on_bulk(bulk); }, opts_.max_latency_)});
+            conns[fd]->parser_.set_interner(interner_);
+            epoll_add(epfd, fd, EPOLLIN | EPOLLRDHUP);
+            connections_.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    bool BulkServer::read_client(Connection& conn)
+    {
+        char buf[kReadBufferSize];
+        for( int i = 0; i < kReadsPerEvent; ++i )
+        {
+            ssize_t const n = ::read(conn.fd_, buf, sizeof(buf));
+            if( n > 0 )
+                conn.parser_.feed(buf, static_cast<size_t>(n));
+            else if( !n )
+                return false;
+            else if( errno == EINTR )
+                continue;
+            else
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        return true;
+    }
+
+    void BulkServer::on_bulk(BulkBuffer& bulk)
+    {
+        thread_local std::string text;
+        bulk.seq_ = bulk_seq_.fetch_add(1, std::memory_order_relaxed) + 1;
+        BULK_METRIC_BULK(bulk.size());
+        text.clear();
+        format_bulk(bulk, text);
+        for( auto& sink : sinks_ )
+            sink->write(bulk, text);
+        bulks_.fetch_add(1, std::memory_order_release);
+    }
+
+} // otus_hw7
+
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bulk_internal.h"
+
+namespace otus_hw7{
+
+    /// @brief Настройки сервера
+    struct ServerOptions
+    {
+        std::string path_;              ///< Путь Unix-сокета
+        size_t      threads_ = 2;       ///< Число потоков цикла событий
+        size_t      chunk_size_ = 3;
+        std::chrono::milliseconds max_latency_{0};  ///< Предельное время ожидания статического пакета, 0 - без ограничения
+        size_t      intern_capacity_ = 0;           ///< Ячеек общей таблицы интернирования команд, 0 - без интернирования
+    };
+
+    /// @brief Сервер на Unix-сокете: принимает много потоков команд одновременно.
+    ///        Соединения распределяются между потоками цикла событий на epoll, у каждого
+    ///        соединения свое состояние разбора (PushParser), приемники общие для всех.
+    ///        Работает до stop() или SIGINT/SIGTERM; соединения, открытые при остановке,
+    ///        дочитываются и завершаются как при конце ввода. Ошибка в любом цикле событий
+    ///        (например, записи приемника) останавливает все циклы и выбрасывается из process()
+    class BulkServer : public IProcessor
+    {
+    public:
+        /// @param sinks Приемники пакетов, доступ к ним сервер синхронизирует сам
+        /// @throw std::system_error, если сокет не удалось открыть
+        BulkServer(ServerOptions const& opts, std::vector<IBulkSinkPtr_t> sinks);
+        ~BulkServer();
+        BulkServer(BulkServer const&) = delete;
+        BulkServer& operator=(BulkServer const&) = delete;
+
+        void process() override;
+
+        /// @brief Останавливает сервер; можно вызывать из любого потока
+        void stop();
+
+        size_t bulks() const { return bulks_.load(std::memory_order_acquire); }
+        size_t connections() const { return connections_.load(std::memory_order_acquire); }
+
+    private:
+        struct Connection
+        {
+            int         fd_;
+            PushParser  parser_;
+        };
+        using ConnectionPtr_t = std::unique_ptr<Connection>;
+
+        void run_loop();
+        void serve();
+        void accept_clients(int epfd, std::unordered_map<int, ConnectionPtr_t>& conns);
+        bool read_client(Connection& conn);
+        void on_bulk(BulkBuffer& bulk);
+
+        ServerOptions               opts_;
+        std::vector<IBulkSinkPtr_t> sinks_;
+        StringInternerPtr_t         interner_;          ///< Общая для всех соединений
+        int                         listen_fd_ = -1;
+        int                         stop_fd_ = -1;      ///< eventfd остановки, слушают все циклы событий
+        std::atomic<uint64_t>       bulk_seq_{0};
+        std::atomic<size_t>         bulks_{0}, connections_{0};
+        std::mutex                  error_mtx_;
+        std::exception_ptr          error_;             ///< Первая ошибка циклов событий
+    };
+
+} // otus_hw7
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bulk_metrics.h"
+#include "bulk_sharded.h"
+
+namespace otus_hw7{
+
+    namespace {
+        /// @brief Выполняет f(0) .. f(n - 1) в n потоках, текущий поток берет f(0)
+        template <typename F>
+        void parallel_for(size_t n, F f)
+        {
+            std::vector<std::thread> threads;
+            threads.reserve(n);
+            for( size_t i = 1; i < n; ++i )
+                threads.emplace_back(f, i);
+            if( n )
+                f(0);
+            for( auto& t : threads )
+                t.join();
+        }
+    }
+
+    ShardedInputParser::ShardedInputParser(size_t chunk_size, std::string const& path, size_t threads, size_t shard_size)
+        : chunk_size_(chunk_size), threads_(threads ? threads : 1), shard_size_(shard_size ? shard_size : 1),
+          page_size_(static_cast<size_t>(::sysconf(_SC_PAGESIZE)))
+    {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat st{};
+        if( ::fstat(fd_, &st) < 0 )
+        {
+            int const err = errno;
+            ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+        file_size_ = static_cast<uint64_t>(st.st_size);
+    }
+
+    ShardedInputParser::~ShardedInputParser()
+    {
+        unmap_window();
+        if( fd_ >= 0 )
+            ::close(fd_);
+    }
+
+    void ShardedInputParser::unmap_window()
+    {
+        if( win_ )
+            ::munmap(const_cast<char*>(win_), win_len_);
+        win_ = nullptr;
+        win_len_ = 0;
+    }
+
+    void ShardedInputParser::map_window(uint64_t offset, size_t length)
+    {
+        unmap_window();
+        uint64_t const aligned = offset / page_size_ * page_size_;
+        win_len_ = static_cast<size_t>(offset - aligned + std::min<uint64_t>(length, file_size_ - offset));
+        void* p = ::mmap(nullptr, win_len_, PROT_READ, MAP_PRIVATE, fd_, static_cast<off_t>(aligned));
+        if( p == MAP_FAILED )
+        {
+            win_len_ = 0;
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        ::madvise(p, win_len_, MADV_SEQUENTIAL);
+        win_ = static_cast<const char*>(p);
+    }
+
+    bool ShardedInputParser::load_round()
+    {
+        shards_.clear();
+        shard_idx_ = line_idx_ = 0;
+        if( round_off_ >= file_size_ )
+        {
+            unmap_window();
+            return false;
+        }
+
+        // Раунд заканчивается на последнем '\n' окна, окно растет, пока в него не попадет хотя бы одна строка
+        const char* data = nullptr;
+        size_t end = 0;
+        for( size_t want = threads_ * shard_size_; ; want *= 2 )
+        {
+            map_window(round_off_, want);
+            data = win_ + (round_off_ % page_size_);
+            size_t const avail = static_cast<size_t>(std::min<uint64_t>(want, file_size_ - round_off_));
+            if( round_off_ + avail == file_size_ )
+            {
+                end = avail;
+                break;
+            }
+            for( end = avail; end && data[end - 1] != '\n'; --end )
+                ;
+            if( end )
+                break;
+        }
+
+        shards_.resize(threads_);
+        size_t beg = 0;
+        for( size_t k = 0; k < threads_; ++k )
+        {
+            size_t stop = end;
+            if( k + 1 < threads_ )
+            {
+                size_t const nominal = std::max(beg, end / threads_ * (k + 1));
+                const void* nl = std::memchr(data + nominal, '\n', end - nominal);
+                stop = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data) + 1 : end;
+            }
+            shards_[k].data_ = data + beg;
+            shards_[k].size_ = stop - beg;
+            beg = stop;
+        }
+        round_off_ += end;
+
+        parallel_for(threads_, [this](size_t k){ tokenize(shards_[k]); });
+
+        for( auto& sh : shards_ )
+        {
+            sh.depth_in_ = depth_;
+            depth_ = std::max(depth_, sh.unmatched_close_) - sh.unmatched_close_ + sh.unmatched_open_;
+        }
+        parallel_for(threads_, [this](size_t k){ assign_roles(shards_[k]); });
+
+        for( auto& sh : shards_ )
+        {
+            sh.count_in_ = count_;
+            count_ = (sh.has_reset_ ? sh.tail_static_ : count_ + sh.lead_static_) % chunk_size_;
+        }
+        parallel_for(threads_, [this](size_t k){ assign_flushes(shards_[k]); });
+        return true;
+    }
+
+    void ShardedInputParser::tokenize(Shard& sh) const
+    {
+        sh.lines_.clear();
+        sh.roles_.clear();
+        sh.unmatched_close_ = sh.unmatched_open_ = 0;
+
+        const char* const data = sh.data_;
+        for( size_t pos = 0; pos < sh.size_; )
+        {
+            const void* nl = std::memchr(data + pos, '\n', sh.size_ - pos);
+            size_t const eol = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data) : sh.size_;
+            LineRef const line{pos, eol - pos};
+            Role role = Role::kStatic;
+            if( line.length_ == 1 && data[pos] == '{' )
+            {
+                role = Role::kOpen;
+                ++sh.unmatched_open_;
+            }
+            else if( line.length_ == 1 && data[pos] == '}' )
+            {
+                role = Role::kClose;
+                if( sh.unmatched_open_ )
+                    --sh.unmatched_open_;
+                else
+                    ++sh.unmatched_close_;
+            }
+            sh.lines_.push_back(line);
+            sh.roles_.push_back(role);
+            pos = eol + 1;
+        }
+    }
+
+    void ShardedInputParser::assign_roles(Shard& sh) const
+    {
+        size_t depth = sh.depth_in_, run = 0;
+        sh.has_reset_ = false;
+        auto reset = [&]
+        {
+            if( !sh.has_reset_ )
+                sh.lead_static_ = run, sh.has_reset_ = true;
+            run = 0;
+        };
+
+        for( auto& role : sh.roles_ )
+        {
+            switch( role )
+            {
+                default:
+                case Role::kStatic:
+                    if( depth )
+                        role = Role::kBlock;
+                    else
+                        ++run;
+                    break;
+                case Role::kOpen:
+                    if( depth++ )
+                        role = Role::kIgnore;
+                    else
+                        reset();
+                    break;
+                case Role::kClose:
+                    if( !depth || --depth )
+                        role = Role::kIgnore;
+                    else
+                        reset();
+                    break;
+            }
+        }
+        if( !sh.has_reset_ )
+            sh.lead_static_ = run;
+        sh.tail_static_ = run;
+    }
+
+    void ShardedInputParser::assign_flushes(Shard& sh) const
+    {
+        size_t count = sh.count_in_;
+        for( auto& role : sh.roles_ )
+        {
+            if( role == Role::kStatic && ++count == chunk_size_ )
+                role = Role::kStaticFlush, count = 0;
+            else if( role == Role::kOpen || role == Role::kClose )
+                count = 0;
+        }
+    }
+
+    IInputParser::Status ShardedInputParser::read_next_bulk(BulkBuffer& bulk)
+    {
+        if( bulk.empty() )
+            bulk.stamp_now();
+
+        for(;;)
+        {
+            if( shard_idx_ == shards_.size() )
+            {
+                if( load_round() )
+                    continue;
+                if( depth_ || eof_reported_ || bulk.empty() )
+                {
+                    bulk.clear();
+                    return Status::kStop;
+                }
+                eof_reported_ = true;
+                return Status::kReady;
+            }
+
+            Shard const& sh = shards_[shard_idx_];
+            if( line_idx_ == sh.lines_.size() )
+            {
+                BULK_METRIC_ADD(kLinesRead, sh.lines_.size());
+                ++shard_idx_, line_idx_ = 0;
+                continue;
+            }
+
+            size_t const i = line_idx_++;
+            LineRef const line = sh.lines_[i];
+            switch( sh.roles_[i] )
+            {
+                case Role::kStatic:
+                case Role::kBlock:
+                    bulk.push(std::string_view(sh.data_ + line.offset_, line.length_));
+                    break;
+                case Role::kStaticFlush:
+                    bulk.push(std::string_view(sh.data_ + line.offset_, line.length_));
+                    return Status::kReady;
+                case Role::kOpen:
+                case Role::kClose:
+                    return Status::kReady;
+                default:
+                case Role::kIgnore:
+                    break;
+            }
+        }
+    }
+
+    IInputParser::Status ShardedInputParser::read_next_command(ICommandPtr_t& cmd)
+    {
+        if( cmd_idx_ < cmd_bulk_.size() )
+        {
+            auto const data = cmd_bulk_[cmd_idx_++];
+            cmd = CommandCreator().create_command(command_data_t(data.data(), data.size()));
+            return Status::kReading;
+        }
+        if( !cmd_bulk_.empty() )
+        {
+            cmd_bulk_.clear();
+            cmd_idx_ = 0;
+            return Status::kReady;
+        }
+
+        Status const st = read_next_bulk(cmd_bulk_);
+        if( cmd_bulk_.empty() )
+            return st;
+        return read_next_command(cmd);
+    }
+
+    IInputParser::Status ShardedInputParser::read_next_bulk(ICommandQueue& cmd_queue)
+    {
+        if( !cmd_queue.size() )
+            cmd_queue.created_at_ = std::time(nullptr);
+
+        for(;;)
+        {
+            ICommandPtr_t cmd;
+            Status const st = read_next_command(cmd);
+            if( st == Status::kReading )
+                cmd_queue.push(std::move(cmd));
+            else
+            {
+                if( st == Status::kStop )
+                    cmd_queue.reset();
+                return st;
+            }
+        }
+    }
+
+} // otus_hw7
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+#ifndef _WIN32
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bulk_internal.h"
+
+namespace otus_hw7{
+
+    /// @brief Параллельный парсер файла. Файл обрабатывается раундами: отображенный в память участок
+    ///        делится по границам строк на шарды, которые размечаются параллельно. Глубина вложенности
+    ///        блоков и счетчик команд статического пакета на границах шардов восстанавливаются
+    ///        последовательным префиксным проходом по сводкам шардов, поэтому пакеты и их порядок
+    ///        совпадают с последовательным InputParser
+    class ShardedInputParser : public IInputParser
+    {
+    public:
+        static constexpr size_t kDefaultShardSize = size_t(4) << 20;
+
+        ShardedInputParser(size_t chunk_size, std::string const& path, size_t threads, size_t shard_size = kDefaultShardSize);
+        ~ShardedInputParser();
+        ShardedInputParser(ShardedInputParser const&) = delete;
+        ShardedInputParser& operator=(ShardedInputParser const&) = delete;
+
+        Status   read_next_command(ICommandPtr_t& cmd) override;
+        Status   read_next_bulk(ICommandQueue& cmd_queue) override;
+        Status   read_next_bulk(BulkBuffer& bulk) override;
+
+    private:
+        /// @brief Роль строки после разметки
+        enum class Role : uint8_t
+        {
+            kStatic,        ///< команда статического пакета
+            kBlock,         ///< команда динамического блока
+            kOpen,          ///< начало блока на верхнем уровне - завершает текущий пакет
+            kClose,         ///< конец блока верхнего уровня - завершает блок
+            kIgnore,        ///< вложенные и непарные скобки
+            kStaticFlush    ///< команда, заполнившая статический пакет до chunk_size
+        };
+
+        struct LineRef
+        {
+            size_t offset_, length_;
+        };
+
+        struct Shard
+        {
+            const char*             data_ = nullptr;
+            size_t                  size_ = 0;
+            std::vector<LineRef>    lines_;
+            std::vector<Role>       roles_;
+            /// Сводка скобок: шард переводит глубину d в max(d - unmatched_close_, 0) + unmatched_open_
+            size_t                  unmatched_close_ = 0, unmatched_open_ = 0;
+            /// Сводка счетчика: статические команды до первого и после последнего сброса счетчика
+            size_t                  lead_static_ = 0, tail_static_ = 0;
+            bool                    has_reset_ = false;
+            size_t                  depth_in_ = 0, count_in_ = 0;
+        };
+
+        bool     load_round();
+        void     map_window(uint64_t offset, size_t length);
+        void     unmap_window();
+        void     tokenize(Shard& shard) const;
+        void     assign_roles(Shard& shard) const;
+        void     assign_flushes(Shard& shard) const;
+
+        size_t              chunk_size_, threads_, shard_size_;
+        int                 fd_ = -1;
+        size_t              page_size_;
+        uint64_t            file_size_ = 0, round_off_ = 0;
+        const char*         win_ = nullptr;
+        size_t              win_len_ = 0;
+        std::vector<Shard>  shards_;
+        size_t              shard_idx_ = 0, line_idx_ = 0;
+        size_t              depth_ = 0, count_ = 0;
+        bool                eof_reported_ = false;
+        BulkBuffer          cmd_bulk_;
+        size_t              cmd_idx_ = 0;
+    };
+
+} // otus_hw7
+
+#endif
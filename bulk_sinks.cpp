@@ -0,0 +1,429 @@
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "bulk_sinks.h"
+
+namespace otus_hw7{
+
+    void format_bulk(BulkBuffer const& bulk, std::string& out)
+    {
+        const char* sep = bulk.opens() ? "bulk: " : ", ";
+        for( auto cmd : bulk )
+        {
+            out.append(sep);
+            out.append(cmd.data(), cmd.size());
+            sep = ", ";
+        }
+        if( bulk.closes() )
+            out.push_back('\n');
+    }
+
+    void write_all(int fd, const char* data, size_t size)
+    {
+        while( size )
+        {
+#ifdef _WIN32
+            auto const n = ::_write(fd, data, static_cast<unsigned>(size));
+#else
+            auto const n = ::write(fd, data, size);
+#endif
+            if( n < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    void write_file(std::string const& file_nm, std::string_view data, bool append)
+    {
+#ifdef _WIN32
+        std::ofstream(file_nm, std::ios_base::out | std::ios_base::binary | (append ? std::ios_base::app : std::ios_base::trunc))
+            .write(data.data(), data.size());
+#else
+        int const fd = ::open(file_nm.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC) | O_CLOEXEC, 0644);
+        if( fd < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + file_nm);
+        try
+        {
+            write_all(fd, data.data(), data.size());
+        }
+        catch(...)
+        {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+#endif
+    }
+
+    void OstreamBulkSink::write(BulkBuffer const&, std::string_view text)
+    {
+        os_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        if( flush_ctl_.due(0) )
+            flush();
+    }
+
+    void OstreamBulkSink::flush()
+    {
+        os_.flush();
+        flush_ctl_.flushed();
+    }
+
+    FdBulkSink::~FdBulkSink()
+    {
+        try
+        {
+            flush();
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    void FdBulkSink::write(BulkBuffer const&, std::string_view text)
+    {
+        buf_.append(text.data(), text.size());
+        if( flush_ctl_.due(buf_.size()) )
+            flush();
+    }
+
+    void FdBulkSink::flush()
+    {
+        if( !buf_.empty() )
+            write_all(fd_, buf_.data(), buf_.size());
+        buf_.clear();
+        flush_ctl_.flushed();
+    }
+
+    std::string get_bulk_file_stem(BulkBuffer const& bulk)
+    {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "bulk%lld_%06u_%llu", static_cast<long long>(bulk.created_at_),
+                      static_cast<unsigned>(bulk.created_us_ % 1000000), static_cast<unsigned long long>(bulk.seq_));
+        return buf;
+    }
+
+    LogFileBulkSink::~LogFileBulkSink()
+    {
+        try
+        {
+            flush();
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    void LogFileBulkSink::write(BulkBuffer const& bulk, std::string_view text)
+    {
+        std::string file_nm = get_bulk_file_stem(bulk) + ".log";
+        if( encoder_ )
+            file_nm += encoder_->extension();
+        if( !bulk.opens() && !pending_.empty() && pending_.back().file_nm_ == file_nm && !encoder_ )
+            pending_.back().length_ += text.size();
+        else
+            pending_.push_back({std::move(file_nm), buf_.size(), text.size(), !bulk.opens()});
+        buf_.append(text.data(), text.size());
+        if( flush_ctl_.due(buf_.size()) )
+            flush();
+    }
+
+    void LogFileBulkSink::flush()
+    {
+        for( auto const& p : pending_ )
+        {
+            std::string_view data = std::string_view(buf_).substr(p.offset_, p.length_);
+            if( encoder_ )
+            {
+                enc_buf_.clear();
+                encoder_->encode(data, enc_buf_, true);
+                data = enc_buf_;
+            }
+            write_file(p.file_nm_, data, p.append_);
+        }
+        unsynced_ = unsynced_ || !pending_.empty();
+        pending_.clear();
+        buf_.clear();
+        flush_ctl_.flushed();
+    }
+
+    void LogFileBulkSink::sync()
+    {
+        flush();
+        // файл на пакет: одна синхронизация файловой системы вместо fdatasync и fsync каталога на каждый файл
+        if( unsynced_ )
+            sync_fs(".");
+        unsynced_ = false;
+    }
+
+    int open_for_append(std::string const& file_nm)
+    {
+#ifdef _WIN32
+        int const fd = ::_open(file_nm.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, 0644);
+#else
+        int const fd = ::open(file_nm.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+        if( fd < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + file_nm);
+        return fd;
+    }
+
+    void close_fd(int fd)
+    {
+#ifdef _WIN32
+        ::_close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    void sync_fd(int fd)
+    {
+#ifdef _WIN32
+        if( ::_commit(fd) )
+            throw std::system_error(errno, std::generic_category(), "commit");
+#elif defined(__APPLE__)
+        if( ::fsync(fd) )
+            throw std::system_error(errno, std::generic_category(), "fsync");
+#else
+        if( ::fdatasync(fd) )
+            throw std::system_error(errno, std::generic_category(), "fdatasync");
+#endif
+    }
+
+    void sync_dir([[maybe_unused]] std::string const& dir)
+    {
+#ifndef _WIN32
+        int const fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + dir);
+        int const rc = ::fsync(fd);
+        int const err = errno;
+        ::close(fd);
+        if( rc )
+            throw std::system_error(err, std::generic_category(), "fsync " + dir);
+#endif
+    }
+
+    void sync_fs([[maybe_unused]] std::string const& dir)
+    {
+#if defined(__linux__)
+        int const fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0 )
+            throw std::system_error(errno, std::generic_category(), "open " + dir);
+        int const rc = ::syncfs(fd);
+        int const err = errno;
+        ::close(fd);
+        if( rc )
+            throw std::system_error(err, std::generic_category(), "syncfs " + dir);
+#elif !defined(_WIN32)
+        ::sync();
+#endif
+    }
+
+    SegmentLogSink::~SegmentLogSink()
+    {
+        try
+        {
+            close_segment();
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    bool SegmentLogSink::rotate_due(size_t size) const
+    {
+        if( data_fd_ < 0 )
+            return true;
+        if( seg_bytes_ && seg_bytes_ + size > seg_opts_.max_bytes_ )
+            return true;
+        return seg_opts_.max_age_.count() && std::chrono::steady_clock::now() - opened_at_ >= seg_opts_.max_age_;
+    }
+
+    void SegmentLogSink::open_segment(BulkBuffer const& bulk)
+    {
+        std::string const stem = get_bulk_file_stem(bulk);
+        data_fd_ = open_for_append(encoder_ ? stem + ".seg" + encoder_->extension() : stem + ".seg");
+        index_fd_ = open_for_append(stem + ".idx");
+        new_segment_ = true;
+        seg_bytes_ = 0;
+        opened_at_ = std::chrono::steady_clock::now();
+    }
+
+    void SegmentLogSink::close_segment()
+    {
+        if( data_fd_ < 0 )
+            return;
+        flush();
+        if( encoder_ )
+        {
+            enc_buf_.clear();
+            encoder_->encode({}, enc_buf_, true);
+            write_all(data_fd_, enc_buf_.data(), enc_buf_.size());
+        }
+        if( seg_opts_.durable_ )
+        {
+            sync_fd(data_fd_);
+            sync_fd(index_fd_);
+        }
+        close_fd(data_fd_);
+        close_fd(index_fd_);
+        data_fd_ = index_fd_ = -1;
+    }
+
+    void SegmentLogSink::write(BulkBuffer const& bulk, std::string_view text)
+    {
+        if( bulk.opens() )
+        {
+            if( rotate_due(text.size()) )
+            {
+                close_segment();
+                open_segment(bulk);
+            }
+            entry_offset_ = seg_bytes_;
+            entry_length_ = 0;
+        }
+        buf_.append(text.data(), text.size());
+        seg_bytes_ += text.size();
+        entry_length_ += text.size();
+
+        if( bulk.closes() )
+        {
+            char entry[96];
+            int const n = std::snprintf(entry, sizeof(entry), "%llu %llu %llu %llu\n",
+                                        static_cast<unsigned long long>(bulk.seq_), static_cast<unsigned long long>(bulk.created_us_),
+                                        static_cast<unsigned long long>(entry_offset_), static_cast<unsigned long long>(entry_length_));
+            index_buf_.append(entry, static_cast<size_t>(n));
+        }
+
+        if( flush_ctl_.due(buf_.size()) )
+            flush();
+    }
+
+    void SegmentLogSink::flush()
+    {
+        if( data_fd_ >= 0 )
+        {
+            std::string_view data = buf_;
+            if( encoder_ && !data.empty() )
+            {
+                enc_buf_.clear();
+                encoder_->encode(data, enc_buf_, false);
+                data = enc_buf_;
+            }
+            write_all(data_fd_, data.data(), data.size());
+            write_all(index_fd_, index_buf_.data(), index_buf_.size());
+        }
+        buf_.clear();
+        index_buf_.clear();
+        flush_ctl_.flushed();
+    }
+
+    void SegmentLogSink::sync()
+    {
+        flush();
+        if( data_fd_ < 0 )
+            return;
+        sync_fd(data_fd_);
+        sync_fd(index_fd_);
+        if( new_segment_ )
+            sync_dir(".");
+        new_segment_ = false;
+    }
+
+    TimedFlushSink::TimedFlushSink(IBulkSinkPtr_t wrapee, std::chrono::milliseconds interval)
+        : wrapee_(std::move(wrapee)), interval_(interval), timer_([this]{ run(); })
+    {
+    }
+
+    TimedFlushSink::~TimedFlushSink()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        timer_.join();
+    }
+
+    void TimedFlushSink::write(BulkBuffer const& bulk, std::string_view text)
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        rethrow_error();
+        wrapee_->write(bulk, text);
+        if( !dirty_ )
+        {
+            dirty_ = true;
+            deadline_ = clock_t::now() + interval_;
+            cv_.notify_one();
+        }
+    }
+
+    void TimedFlushSink::flush()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        rethrow_error();
+        wrapee_->flush();
+        dirty_ = false;
+    }
+
+    void TimedFlushSink::sync()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        rethrow_error();
+        wrapee_->sync();
+        dirty_ = false;
+    }
+
+    void TimedFlushSink::run()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        while( !stop_ )
+        {
+            if( !dirty_ )
+            {
+                cv_.wait(lk);
+                continue;
+            }
+            cv_.wait_until(lk, deadline_);
+            if( stop_ || !dirty_ || clock_t::now() < deadline_ )
+                continue;
+            try
+            {
+                wrapee_->flush();
+            }
+            catch(...)
+            {
+                error_ = std::current_exception();
+            }
+            dirty_ = false;
+        }
+    }
+
+    void TimedFlushSink::rethrow_error()
+    {
+        if( error_ )
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+} // otus_hw7
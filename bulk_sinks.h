@@ -0,0 +1,240 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bulk.h"
+
+namespace otus_hw7{
+
+    /// @brief Настройки сброса буферизованного вывода
+    struct FlushOptions
+    {
+        FlushPolicy                 policy_ = FlushPolicy::kPerBulk;
+        std::chrono::milliseconds   interval_{1000};
+        size_t                      max_buffered_ = size_t(1) << 20;    ///< Порог размера буфера, при котором сброс выполняется всегда
+    };
+
+    /// @brief Решает, пора ли сбрасывать буфер, по политике сброса
+    class FlushController
+    {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        explicit FlushController(FlushOptions const& opts) : opts_(opts), last_flush_(clock_t::now()) {}
+
+        bool due(size_t buffered) const
+        {
+            switch( opts_.policy_ )
+            {
+                default:
+                case FlushPolicy::kPerBulk:
+                    return true;
+                case FlushPolicy::kInterval:
+                    return buffered >= opts_.max_buffered_ || clock_t::now() - last_flush_ >= opts_.interval_;
+                case FlushPolicy::kOnExit:
+                    return buffered >= opts_.max_buffered_;
+            }
+        }
+        void flushed() { last_flush_ = clock_t::now(); }
+
+    private:
+        FlushOptions        opts_;
+        clock_t::time_point last_flush_;
+    };
+
+    /// @brief Приемник, выводящий отформатированный пакет в поток
+    class OstreamBulkSink final : public IBulkSink
+    {
+    public:
+        OstreamBulkSink(ostream& os, FlushOptions const& opts = {}) : os_(os), flush_ctl_(opts) {}
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+    private:
+        ostream&        os_;
+        FlushController flush_ctl_;
+    };
+
+    /// @brief Приемник, выводящий пакеты в файловый дескриптор: пакеты копятся в буфере
+    ///        и уходят одним вызовом write при сбросе
+    class FdBulkSink final : public IBulkSink
+    {
+    public:
+        FdBulkSink(int fd, FlushOptions const& opts = {}) : fd_(fd), flush_ctl_(opts) {}
+        ~FdBulkSink();
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+    private:
+        int             fd_;
+        std::string     buf_;
+        FlushController flush_ctl_;
+    };
+
+    /// @brief Потоковый кодировщик журнала (сжатие). Данные одного файла журнала образуют один кадр:
+    ///        порции кодируются по мере сброса, end завершает кадр
+    struct ILogEncoder
+    {
+        virtual             ~ILogEncoder() = default;
+        /// @brief Расширение, добавляемое к имени файла журнала
+        virtual const char* extension() const = 0;
+        /// @brief Дописывает в out закодированную порцию in. Записанное в out раскодируется
+        ///        без последующих порций
+        virtual void        encode(std::string_view in, std::string& out, bool end) = 0;
+    };
+    using ILogEncoderPtr_t = std::unique_ptr<ILogEncoder>;
+
+    /// @brief Приемник, сохраняющий каждый пакет в свой файл bulk<время>_<мкс>_<номер>.log.
+    ///        Файл создается и записывается одним вызовом write при сбросе, порции пакета дописываются
+    ///        в тот же файл. С кодировщиком каждая запись - отдельный кадр, к имени добавляется расширение кодировщика
+    class LogFileBulkSink final : public IBulkSink
+    {
+    public:
+        LogFileBulkSink(FlushOptions const& opts = {}, ILogEncoderPtr_t encoder = nullptr) 
+            : flush_ctl_(opts), encoder_(std::move(encoder)) {}
+        ~LogFileBulkSink();
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+        /// @brief Сбрасывает файлы и одним вызовом синхронизирует файловую систему каталога журналов
+        void sync() override;
+    private:
+        struct Pending
+        {
+            std::string file_nm_;
+            size_t      offset_, length_;
+            bool        append_;        ///< Продолжение пакета, уже записанного в файл
+        };
+        std::string             buf_, enc_buf_;
+        std::vector<Pending>    pending_;
+        FlushController         flush_ctl_;
+        ILogEncoderPtr_t        encoder_;
+        bool                    unsynced_ = false;      ///< Файлы записаны после последней синхронизации
+    };
+
+    /// @brief Настройки ротации сегментов журнала
+    struct SegmentOptions
+    {
+        size_t                  max_bytes_ = size_t(64) << 20;
+        std::chrono::seconds    max_age_{0};        ///< 0 - без ротации по времени
+        bool                    durable_ = false;   ///< Закрываемый при ротации сегмент синхронизируется (см. sync)
+    };
+
+    /// @brief Приемник, дописывающий пакеты в сегменты bulk<время>_<мкс>_<номер>.seg, названные по первому пакету.
+    ///        Новый сегмент начинается по достижении размера или возраста. Рядом ведется индекс .idx
+    ///        со строками "<номер> <время, мкс> <смещение> <длина>" для каждого пакета сегмента.
+    ///        Пакет, выводимый порциями, не разрывается ротацией и получает одну строку индекса.
+    ///        С кодировщиком сегмент - один кадр, смещения индекса отсчитываются в раскодированных данных
+    class SegmentLogSink final : public IBulkSink
+    {
+    public:
+        SegmentLogSink(SegmentOptions const& seg_opts, FlushOptions const& opts = {}, ILogEncoderPtr_t encoder = nullptr) 
+            : seg_opts_(seg_opts), flush_ctl_(opts), encoder_(std::move(encoder)) {}
+        ~SegmentLogSink();
+        SegmentLogSink(SegmentLogSink const&) = delete;
+        SegmentLogSink& operator=(SegmentLogSink const&) = delete;
+
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+        void sync() override;
+
+    private:
+        bool rotate_due(size_t size) const;
+        void open_segment(BulkBuffer const& bulk);
+        void close_segment();
+
+        SegmentOptions                          seg_opts_;
+        int                                     data_fd_ = -1, index_fd_ = -1;
+        bool                                    new_segment_ = false;  ///< Сегмент создан после последней синхронизации
+        uint64_t                                seg_bytes_ = 0;
+        uint64_t                                entry_offset_ = 0, entry_length_ = 0;  ///< Текущий пакет в сегменте
+        std::chrono::steady_clock::time_point   opened_at_;
+        std::string                             buf_, index_buf_, enc_buf_;
+        FlushController                         flush_ctl_;
+        ILogEncoderPtr_t                        encoder_;
+    };
+
+    /// @brief Приемник-декоратор для общего использования несколькими потоками: запись и сброс под мьютексом
+    class LockedBulkSink : public IBulkSink
+    {
+    public:
+        explicit LockedBulkSink(IBulkSinkPtr_t wrapee) : wrapee_(std::move(wrapee)) {}
+        void write(BulkBuffer const& bulk, std::string_view text) override
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            wrapee_->write(bulk, text);
+        }
+        void flush() override
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            wrapee_->flush();
+        }
+        void sync() override
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            wrapee_->sync();
+        }
+    private:
+        std::mutex      mtx_;
+        IBulkSinkPtr_t  wrapee_;
+    };
+
+    /// @brief Приемник-декоратор для политики FlushPolicy::kInterval: сбрасывает вывод по таймеру
+    ///        в своем потоке, если после записи прошел интервал, а новых пакетов нет. Без него
+    ///        последний пакет простаивающего потока оставался бы в буфере до следующего пакета.
+    ///        Запись и сброс идут под мьютексом; ошибка сброса по таймеру выбрасывается следующим вызовом
+    class TimedFlushSink final : public IBulkSink
+    {
+    public:
+        TimedFlushSink(IBulkSinkPtr_t wrapee, std::chrono::milliseconds interval);
+        ~TimedFlushSink();
+        TimedFlushSink(TimedFlushSink const&) = delete;
+        TimedFlushSink& operator=(TimedFlushSink const&) = delete;
+
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+        void sync() override;
+    private:
+        void run();
+        void rethrow_error();
+
+        using clock_t = std::chrono::steady_clock;
+
+        IBulkSinkPtr_t              wrapee_;
+        std::chrono::milliseconds   interval_;
+        std::mutex                  mtx_;
+        std::condition_variable     cv_;
+        bool                        dirty_ = false, stop_ = false;
+        clock_t::time_point         deadline_;
+        std::exception_ptr          error_;
+        std::thread                 timer_;
+    };
+
+    /// @brief Основа имени файла пакета: bulk<время>_<мкс>_<номер>, уникальна в пределах процесса
+    std::string get_bulk_file_stem(BulkBuffer const& bulk);
+
+    /// @brief Записывает данные в дескриптор целиком, повторяя write при частичной записи
+    void write_all(int fd, const char* data, size_t size);
+
+    /// @brief Открывает файл на дозапись, создавая его при отсутствии
+    /// @throw std::system_error, если файл не удалось открыть
+    int open_for_append(std::string const& file_nm);
+
+    void close_fd(int fd);
+
+    /// @brief Дожидается записи данных файла на носитель (fdatasync)
+    /// @throw std::system_error при ошибке
+    void sync_fd(int fd);
+    /// @brief Дожидается записи на носитель записей каталога dir: созданные в нем файлы переживут сбой
+    void sync_dir(std::string const& dir);
+    /// @brief Дожидается записи на носитель всех данных файловой системы каталога dir (syncfs в Linux)
+    void sync_fs(std::string const& dir);
+
+    /// @brief Создает (перезаписывает) файл с данными одним вызовом write
+    /// @param append Дописать в конец существующего файла
+    void write_file(std::string const& file_nm, std::string_view data, bool append = false);
+
+} // otus_hw7
@@ -0,0 +1,359 @@
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bulk_uring.h"
+
+namespace otus_hw7{
+
+    namespace {
+        template <typename T>
+        T* ring_ptr(void* base, unsigned offset)
+        {
+            return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        }
+
+        char* alloc_aligned(size_t size)
+        {
+            void* p = nullptr;
+            if( ::posix_memalign(&p, UringLogSink::kDirectAlignment, size) )
+                throw std::bad_alloc();
+            return static_cast<char*>(p);
+        }
+    }
+
+    IoUring::IoUring(unsigned entries)
+    {
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params_));
+        if( fd_ < 0 )
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+        sq_ring_sz_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+        cq_ring_sz_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+        bool const single_mmap = params_.features & IORING_FEAT_SINGLE_MMAP;
+        if( single_mmap )
+            sq_ring_sz_ = cq_ring_sz_ = std::max(sq_ring_sz_, cq_ring_sz_);
+
+        sq_ring_ = ::mmap(nullptr, sq_ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap ? sq_ring_
+                               : ::mmap(nullptr, cq_ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        void* sqes = ::mmap(nullptr, params_.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if( sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes == MAP_FAILED )
+        {
+            int const err = errno;
+            if( sq_ring_ != MAP_FAILED ) ::munmap(sq_ring_, sq_ring_sz_);
+            if( !single_mmap && cq_ring_ != MAP_FAILED ) ::munmap(cq_ring_, cq_ring_sz_);
+            if( sqes != MAP_FAILED ) ::munmap(sqes, params_.sq_entries * sizeof(io_uring_sqe));
+            ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "io_uring mmap");
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        sq_head_ = ring_ptr<unsigned>(sq_ring_, params_.sq_off.head);
+        sq_tail_ = ring_ptr<unsigned>(sq_ring_, params_.sq_off.tail);
+        sq_mask_ = ring_ptr<unsigned>(sq_ring_, params_.sq_off.ring_mask);
+        sq_array_ = ring_ptr<unsigned>(sq_ring_, params_.sq_off.array);
+        cq_head_ = ring_ptr<unsigned>(cq_ring_, params_.cq_off.head);
+        cq_tail_ = ring_ptr<unsigned>(cq_ring_, params_.cq_off.tail);
+        cq_mask_ = ring_ptr<unsigned>(cq_ring_, params_.cq_off.ring_mask);
+        cqes_ = ring_ptr<io_uring_cqe>(cq_ring_, params_.cq_off.cqes);
+        sqe_tail_ = *sq_tail_;
+    }
+
+    IoUring::~IoUring()
+    {
+        ::munmap(sqes_, params_.sq_entries * sizeof(io_uring_sqe));
+        if( cq_ring_ != sq_ring_ )
+            ::munmap(cq_ring_, cq_ring_sz_);
+        ::munmap(sq_ring_, sq_ring_sz_);
+        ::close(fd_);
+    }
+
+    io_uring_sqe* IoUring::get_sqe()
+    {
+        unsigned const head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if( sqe_tail_ - head >= params_.sq_entries )
+            return nullptr;
+        unsigned const idx = sqe_tail_ & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[idx] = idx;
+        ++sqe_tail_;
+        ++to_submit_;
+        return sqe;
+    }
+
+    void IoUring::submit(unsigned wait_nr)
+    {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        while( to_submit_ || wait_nr )
+        {
+            long const n = ::syscall(__NR_io_uring_enter, fd_, to_submit_, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if( n < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+            to_submit_ -= std::min<unsigned>(to_submit_, static_cast<unsigned>(n));
+            wait_nr = 0;
+        }
+    }
+
+    io_uring_cqe* IoUring::peek_cqe()
+    {
+        unsigned const head = *cq_head_;
+        if( head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) )
+            return nullptr;
+        return &cqes_[head & *cq_mask_];
+    }
+
+    void IoUring::cqe_seen()
+    {
+        __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+    }
+
+    bool IoUring::register_buffers(std::vector<iovec> const& iov)
+    {
+        return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == 0;
+    }
+
+    bool IoUring::supports(std::initializer_list<uint8_t> ops) const
+    {
+        constexpr unsigned kMaxOps = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + kMaxOps * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if( ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, kMaxOps) < 0 )
+            return false;
+        return std::all_of(ops.begin(), ops.end(), [probe](uint8_t op)
+                           { return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED); });
+    }
+
+    UringLogSink::UringLogSink(UringOptions const& opts, FlushOptions const& flush_opts)
+        : opts_(opts), ring_(opts.entries_ ? opts.entries_ : 1), flush_ctl_(flush_opts)
+    {
+        // io_uring_setup есть с 5.1, а openat и close - только с 5.6: без проверки каждая запись
+        // падала бы при сбросе вместо перехода на потоковый журнал при создании
+        if( !ring_.supports({IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE}) )
+            throw std::system_error(EOPNOTSUPP, std::generic_category(), "io_uring lacks openat/write/close");
+        opts_.buffer_size_ = (std::max<size_t>(opts_.buffer_size_, 1) + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+        slots_.resize(opts.entries_ ? opts.entries_ : 1);
+        buffers_ = alloc_aligned(opts_.buffer_size_ * slots_.size());
+
+        std::vector<iovec> iov(slots_.size());
+        for( size_t i = 0; i < slots_.size(); ++i )
+            iov[i] = {buffers_ + i * opts_.buffer_size_, opts_.buffer_size_};
+        fixed_buffers_ = ring_.register_buffers(iov);
+    }
+
+    UringLogSink::~UringLogSink()
+    {
+        try
+        {
+            flush();
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        for( auto& slot : slots_ )
+            std::free(slot.data_heap_);
+        std::free(buffers_);
+    }
+
+    size_t UringLogSink::padded_length(Slot const& slot) const
+    {
+        if( !slot.direct_ )
+            return slot.length_;
+        return (slot.length_ + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+    }
+
+    UringLogSink::Slot& UringLogSink::acquire_slot()
+    {
+        for(;;)
+        {
+            auto p = std::find_if(slots_.begin(), slots_.end(), [](Slot const& s){ return s.stage_ == Stage::kFree; });
+            if( p != slots_.end() )
+                return *p;
+            reap(1);
+        }
+    }
+
+    io_uring_sqe* UringLogSink::get_sqe()
+    {
+        // Каждый слот держит не более одной операции в полете, так что место в кольце найдется
+        // после отправки уже подготовленных элементов
+        io_uring_sqe* sqe = ring_.get_sqe();
+        if( !sqe )
+        {
+            ring_.submit();
+            sqe = ring_.get_sqe();
+        }
+        return sqe;
+    }
+
+    void UringLogSink::submit_open(size_t idx)
+    {
+        Slot& slot = slots_[idx];
+        slot.stage_ = Stage::kOpen;
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.file_nm_.c_str());
+        sqe->len = 0644;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (slot.direct_ ? O_DIRECT : 0);
+        sqe->user_data = idx;
+        ++in_flight_;
+    }
+
+    void UringLogSink::submit_write(size_t idx)
+    {
+        Slot& slot = slots_[idx];
+        slot.stage_ = Stage::kWrite;
+        io_uring_sqe* sqe = get_sqe();
+        bool const fixed = fixed_buffers_ && slot.data_ != slot.data_heap_;
+        sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = slot.fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.data_ + slot.written_);
+        sqe->len = static_cast<uint32_t>(padded_length(slot) - slot.written_);
+        sqe->off = slot.written_;
+        if( fixed )
+            sqe->buf_index = static_cast<uint16_t>(idx);
+        sqe->user_data = idx;
+        ++in_flight_;
+    }
+
+    void UringLogSink::submit_close(size_t idx)
+    {
+        Slot& slot = slots_[idx];
+        slot.stage_ = Stage::kClose;
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot.fd_;
+        sqe->user_data = idx;
+        ++in_flight_;
+    }
+
+    void UringLogSink::release_slot(Slot& slot)
+    {
+        slot.stage_ = Stage::kFree;
+        slot.fd_ = -1;
+    }
+
+    void UringLogSink::on_complete(size_t idx, int res)
+    {
+        Slot& slot = slots_[idx];
+        switch( slot.stage_ )
+        {
+            default:
+            case Stage::kFree:
+                break;
+
+            case Stage::kOpen:
+                if( res == -EINVAL && slot.direct_ )
+                {
+                    // Файловая система не поддерживает O_DIRECT - пишем через кэш
+                    slot.direct_ = false;
+                    submit_open(idx);
+                }
+                else if( res < 0 )
+                {
+                    first_error_ = first_error_ ? first_error_ : -res;
+                    release_slot(slot);
+                }
+                else
+                {
+                    slot.fd_ = res;
+                    submit_write(idx);
+                }
+                break;
+
+            case Stage::kWrite:
+                if( res < 0 )
+                    first_error_ = first_error_ ? first_error_ : -res;
+                else if( (slot.written_ += static_cast<size_t>(res)) < padded_length(slot) && res > 0 )
+                {
+                    submit_write(idx);
+                    break;
+                }
+                if( slot.direct_ && slot.length_ != padded_length(slot) && ::ftruncate(slot.fd_, static_cast<off_t>(slot.length_)) < 0 )
+                    first_error_ = first_error_ ? first_error_ : errno;
+                submit_close(idx);
+                break;
+
+            case Stage::kClose:
+                ++completed_;
+                release_slot(slot);
+                break;
+        }
+    }
+
+    void UringLogSink::reap(unsigned wait_nr)
+    {
+        ring_.submit(wait_nr);
+        while( io_uring_cqe* cqe = ring_.peek_cqe() )
+        {
+            size_t const idx = static_cast<size_t>(cqe->user_data);
+            int const res = cqe->res;
+            ring_.cqe_seen();
+            --in_flight_;
+            on_complete(idx, res);
+        }
+    }
+
+    void UringLogSink::write(BulkBuffer const& bulk, std::string_view text)
+    {
+        Slot& slot = acquire_slot();
+        size_t const idx = static_cast<size_t>(&slot - slots_.data());
+        slot.file_nm_ = get_bulk_file_stem(bulk) + ".log";
+        slot.direct_ = opts_.direct_;
+        slot.length_ = text.size();
+        slot.written_ = 0;
+
+        size_t const need = (text.size() + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+        if( need <= opts_.buffer_size_ )
+            slot.data_ = buffers_ + idx * opts_.buffer_size_;
+        else
+        {
+            std::free(slot.data_heap_);
+            slot.data_heap_ = alloc_aligned(need);
+            slot.data_ = slot.data_heap_;
+        }
+        std::memcpy(slot.data_, text.data(), text.size());
+        std::memset(slot.data_ + text.size(), 0, need - text.size());
+
+        submit_open(idx);
+        if( flush_ctl_.due(in_flight_) )
+        {
+            reap(0);
+            flush_ctl_.flushed();
+        }
+    }
+
+    void UringLogSink::flush()
+    {
+        while( in_flight_ )
+            reap(1);
+        flush_ctl_.flushed();
+        if( first_error_ )
+        {
+            int const err = first_error_;
+            first_error_ = 0;
+            throw std::system_error(err, std::generic_category(), "io_uring log write");
+        }
+    }
+
+} // otus_hw7
+
+#endif
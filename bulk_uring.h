@@ -0,0 +1,114 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "bulk_sinks.h"
+
+namespace otus_hw7{
+
+    /// @brief Минимальная обертка над кольцами io_uring на системных вызовах, без liburing
+    class IoUring
+    {
+    public:
+        /// @throw std::system_error, если io_uring недоступен
+        explicit IoUring(unsigned entries);
+        ~IoUring();
+        IoUring(IoUring const&) = delete;
+        IoUring& operator=(IoUring const&) = delete;
+
+        /// @brief Очередной свободный элемент очереди отправки, nullptr - очередь заполнена
+        io_uring_sqe* get_sqe();
+        /// @brief Отправляет подготовленные элементы и ждет не менее wait_nr завершений
+        void          submit(unsigned wait_nr = 0);
+        /// @brief Очередное завершение или nullptr; после обработки вызвать cqe_seen
+        io_uring_cqe* peek_cqe();
+        void          cqe_seen();
+        /// @brief Регистрирует буферы для IORING_OP_WRITE_FIXED
+        bool          register_buffers(std::vector<iovec> const& iov);
+        /// @brief Поддерживает ли ядро все операции ops (IORING_REGISTER_PROBE). Ядра до 5.6 пробы не знают
+        ///        и считаются не поддерживающими: openat и close в них тоже появились только в 5.6
+        bool          supports(std::initializer_list<uint8_t> ops) const;
+
+    private:
+        int             fd_ = -1;
+        io_uring_params params_{};
+        void*           sq_ring_ = nullptr;
+        void*           cq_ring_ = nullptr;
+        size_t          sq_ring_sz_ = 0, cq_ring_sz_ = 0;
+        io_uring_sqe*   sqes_ = nullptr;
+        unsigned        *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+        unsigned        *cq_head_, *cq_tail_, *cq_mask_;
+        io_uring_cqe*   cqes_ = nullptr;
+        unsigned        sqe_tail_ = 0, to_submit_ = 0;
+    };
+
+    /// @brief Настройки журнала на io_uring
+    struct UringOptions
+    {
+        unsigned    entries_ = 64;                  ///< Глубина кольца и число одновременно записываемых пакетов
+        size_t      buffer_size_ = size_t(64) << 10;///< Размер каждого зарегистрированного буфера
+        bool        direct_ = false;                ///< Писать с O_DIRECT через выровненные буферы
+    };
+
+    /// @brief Приемник, создающий файл пакета и записывающий его через io_uring: openat -> write -> close
+    ///        выполняются ядром асинхронно, поток вывода только копирует текст в зарегистрированный буфер.
+    ///        flush дожидается завершения всех операций
+    class UringLogSink : public IBulkSink
+    {
+    public:
+        static constexpr size_t kDirectAlignment = 4096;
+
+        /// @throw std::system_error, если io_uring недоступен или ядро не поддерживает openat, write и close
+        UringLogSink(UringOptions const& opts, FlushOptions const& flush_opts = {});
+        ~UringLogSink();
+
+        void write(BulkBuffer const& bulk, std::string_view text) override;
+        void flush() override;
+
+        size_t completed() const { return completed_; }
+
+    private:
+        enum class Stage : uint8_t { kFree, kOpen, kWrite, kClose };
+
+        struct Slot
+        {
+            Stage       stage_ = Stage::kFree;
+            std::string file_nm_;
+            int         fd_ = -1;
+            bool        direct_ = false;
+            char*       data_ = nullptr;        ///< Зарегистрированный буфер слота или data_heap_
+            char*       data_heap_ = nullptr;   ///< Буфер для пакетов больше зарегистрированного
+            size_t      length_ = 0, written_ = 0;
+        };
+
+        Slot&   acquire_slot();
+        void    submit_open(size_t idx);
+        void    submit_write(size_t idx);
+        void    submit_close(size_t idx);
+        io_uring_sqe* get_sqe();
+        void    reap(unsigned wait_nr);
+        void    on_complete(size_t idx, int res);
+        void    release_slot(Slot& slot);
+        size_t  padded_length(Slot const& slot) const;
+
+        UringOptions        opts_;
+        IoUring             ring_;
+        std::vector<Slot>   slots_;
+        char*               buffers_ = nullptr;
+        bool                fixed_buffers_ = false;
+        size_t              in_flight_ = 0, completed_ = 0;
+        int                 first_error_ = 0;
+        FlushController     flush_ctl_;
+    };
+
+} // otus_hw7
+
+#endif
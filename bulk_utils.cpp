@@ -14,16 +14,180 @@ namespace otus_hw7{
     {
         constexpr const char* const OPTION_NAME_HELP = "help"; 
         constexpr const char* const OPTION_NAME_CHUNK_SIZE = "chunk_size"; 
-        parsed_options = {false, 0};
+        constexpr const char* const OPTION_NAME_LOG_THREADS = "log_threads"; 
+        constexpr const char* const OPTION_NAME_QUEUE_CAPACITY = "queue_capacity"; 
+        constexpr const char* const OPTION_NAME_INPUT = "input"; 
+        constexpr const char* const OPTION_NAME_PARSE_THREADS = "parse_threads"; 
+        constexpr const char* const OPTION_NAME_FLUSH = "flush"; 
+        constexpr const char* const OPTION_NAME_FLUSH_INTERVAL = "flush_interval_ms"; 
+        constexpr const char* const OPTION_NAME_LOG_MODE = "log_mode"; 
+        constexpr const char* const OPTION_NAME_SEGMENT_SIZE = "segment_size"; 
+        constexpr const char* const OPTION_NAME_SEGMENT_SECONDS = "segment_seconds"; 
+        constexpr const char* const OPTION_NAME_LOG_BACKEND = "log_backend"; 
+        constexpr const char* const OPTION_NAME_LOG_DIRECT = "log_direct"; 
+        constexpr const char* const OPTION_NAME_STATS_FILE = "stats_file"; 
+        constexpr const char* const OPTION_NAME_STATS_INTERVAL = "stats_interval_ms"; 
+        constexpr const char* const OPTION_NAME_SOCKET = "socket"; 
+        constexpr const char* const OPTION_NAME_SERVER_THREADS = "server_threads"; 
+        constexpr const char* const OPTION_NAME_MAX_LATENCY = "max_latency_ms"; 
+        constexpr const char* const OPTION_NAME_LOG_COMPRESS = "log_compress"; 
+        constexpr const char* const OPTION_NAME_LOG_COMPRESS_LEVEL = "log_compress_level"; 
+        constexpr const char* const OPTION_NAME_LOG_DICT = "log_dict"; 
+        constexpr const char* const OPTION_NAME_LOG_FORMAT = "log_format"; 
+        constexpr const char* const OPTION_NAME_INTERN = "intern"; 
+        constexpr const char* const OPTION_NAME_INTERN_CAPACITY = "intern_capacity"; 
+        constexpr const char* const OPTION_NAME_DYNAMIC_PIPELINE = "dynamic_pipeline"; 
+        constexpr const char* const OPTION_NAME_EXEC_THREADS = "exec_threads"; 
+        constexpr const char* const OPTION_NAME_HANDLER = "handler"; 
+        constexpr const char* const OPTION_NAME_EXEC_UNORDERED = "exec_unordered"; 
+        constexpr const char* const OPTION_NAME_MEMORY_CAP = "memory_cap"; 
+        constexpr const char* const OPTION_NAME_OVERFLOW = "overflow"; 
+        constexpr const char* const OPTION_NAME_SPILL_DIR = "spill_dir"; 
+        constexpr const char* const OPTION_NAME_DURABLE = "durable"; 
+        constexpr const char* const OPTION_NAME_COMMIT_DELAY = "commit_delay_us"; 
+        constexpr const char* const OPTION_NAME_CHECKPOINT = "checkpoint"; 
+        constexpr const char* const OPTION_NAME_CHECKPOINT_EVERY = "checkpoint_every"; 
+        constexpr const char* const OPTION_NAME_RESUME = "resume"; 
+        constexpr const char* const OPTION_NAME_TARGET_P99 = "target_p99_us"; 
+        constexpr const char* const OPTION_NAME_MIN_CHUNK = "min_chunk"; 
+        constexpr const char* const OPTION_NAME_MAX_CHUNK = "max_chunk"; 
+        parsed_options = Options{};
         
         auto check_size = [](const size_t& sz) 
                           { 
                             if( sz < 1 ) throw po::invalid_option_value(OPTION_NAME_CHUNK_SIZE); 
                           };
+        auto check_capacity = [](const size_t& sz) 
+                          { 
+                            if( sz < 1 ) throw po::invalid_option_value(OPTION_NAME_QUEUE_CAPACITY); 
+                          };
+        auto set_flush_policy = [&parsed_options](const std::string& policy) 
+                          { 
+                            if( policy == "bulk" )          parsed_options.flush_policy = FlushPolicy::kPerBulk;
+                            else if( policy == "interval" ) parsed_options.flush_policy = FlushPolicy::kInterval;
+                            else if( policy == "exit" )     parsed_options.flush_policy = FlushPolicy::kOnExit;
+                            else throw po::invalid_option_value(policy); 
+                          };
+        auto set_log_mode = [&parsed_options](const std::string& mode) 
+                          { 
+                            if( mode == "file" )            parsed_options.log_mode = LogMode::kFilePerBulk;
+                            else if( mode == "segment" )    parsed_options.log_mode = LogMode::kSegment;
+                            else throw po::invalid_option_value(mode); 
+                          };
+        auto set_log_backend = [&parsed_options](const std::string& backend) 
+                          { 
+                            if( backend == "stream" )       parsed_options.log_backend = LogBackend::kStream;
+                            else if( backend == "uring" )   parsed_options.log_backend = LogBackend::kUring;
+                            else throw po::invalid_option_value(backend); 
+                          };
+        auto set_log_compress = [&parsed_options](const std::string& codec) 
+                          { 
+                            if( codec == "none" )           parsed_options.log_compress = LogCompression::kNone;
+                            else if( codec == "zstd" )      parsed_options.log_compress = LogCompression::kZstd;
+                            else throw po::invalid_option_value(codec); 
+                          };
+        auto set_log_format = [&parsed_options](const std::string& format) 
+                          { 
+                            if( format == "text" )          parsed_options.log_format = LogFormat::kText;
+                            else if( format == "binary" )   parsed_options.log_format = LogFormat::kBinary;
+                            else throw po::invalid_option_value(format); 
+                          };
+        auto set_overflow = [&parsed_options](const std::string& policy) 
+                          { 
+                            if( policy == "stall" )         parsed_options.overflow_policy = OverflowPolicy::kStall;
+                            else if( policy == "spill" )    parsed_options.overflow_policy = OverflowPolicy::kSpill;
+                            else if( policy == "discard" )  parsed_options.overflow_policy = OverflowPolicy::kDiscard;
+                            else throw po::invalid_option_value(policy); 
+                          };
         po::options_description desc("Аргументы командной строки");
         desc.add_options()
             (OPTION_NAME_HELP, po::bool_switch(&parsed_options.show_help), "Отображение справки")
-            (OPTION_NAME_CHUNK_SIZE, po::value<size_t>(&parsed_options.cmd_chunk_sz)->notifier(check_size), "Размер блока команд");
+            (OPTION_NAME_CHUNK_SIZE, po::value<size_t>(&parsed_options.cmd_chunk_sz)->notifier(check_size), "Размер блока команд")
+            (OPTION_NAME_LOG_THREADS, po::value<size_t>(&parsed_options.log_threads)->default_value(0), 
+                "Число потоков записи в файлы, 0 - синхронный вывод")
+            (OPTION_NAME_QUEUE_CAPACITY, po::value<size_t>(&parsed_options.queue_capacity)->default_value(1024)->notifier(check_capacity), 
+                "Емкость очередей пакетов для асинхронного вывода")
+            (OPTION_NAME_INPUT, po::value<std::string>(&parsed_options.input_path), 
+                "Файл с командами вместо стандартного ввода (читается через mmap)")
+            (OPTION_NAME_PARSE_THREADS, po::value<size_t>(&parsed_options.parse_threads)->default_value(0), 
+                "Число потоков параллельного разбора файла, только вместе с --input")
+            (OPTION_NAME_FLUSH, po::value<std::string>()->default_value("bulk")->notifier(set_flush_policy), 
+                "Сброс вывода: bulk - после каждого пакета, interval - по интервалу, exit - при завершении")
+            (OPTION_NAME_FLUSH_INTERVAL, po::value<size_t>(&parsed_options.flush_interval_ms)->default_value(1000), 
+                "Интервал сброса вывода в миллисекундах для --flush interval")
+            (OPTION_NAME_LOG_MODE, po::value<std::string>()->default_value("file")->notifier(set_log_mode), 
+                "Журнал: file - файл на каждый пакет, segment - сегменты с ротацией и индексом")
+            (OPTION_NAME_SEGMENT_SIZE, po::value<size_t>(&parsed_options.segment_size)->default_value(size_t(64) << 20), 
+                "Размер сегмента журнала в байтах для --log_mode segment")
+            (OPTION_NAME_SEGMENT_SECONDS, po::value<size_t>(&parsed_options.segment_seconds)->default_value(0), 
+                "Время жизни сегмента журнала в секундах, 0 - без ротации по времени")
+            (OPTION_NAME_LOG_BACKEND, po::value<std::string>()->default_value("stream")->notifier(set_log_backend), 
+                "Запись файлов пакетов: stream - синхронно, uring - через io_uring")
+            (OPTION_NAME_LOG_DIRECT, po::bool_switch(&parsed_options.log_direct), 
+                "Запись файлов пакетов с O_DIRECT для --log_backend uring")
+            (OPTION_NAME_STATS_FILE, po::value<std::string>(&parsed_options.stats_file), 
+                "Файл статистики: метрики строками JSON при завершении, по SIGUSR1 и периодически; - поток ошибок")
+            (OPTION_NAME_STATS_INTERVAL, po::value<size_t>(&parsed_options.stats_interval_ms)->default_value(0), 
+                "Период вывода статистики в миллисекундах, 0 - только при завершении и по SIGUSR1")
+            (OPTION_NAME_SOCKET, po::value<std::string>(&parsed_options.socket_path), 
+                "Режим сервера: прием команд от многих клиентов через Unix-сокет, до SIGINT/SIGTERM")
+            (OPTION_NAME_SERVER_THREADS, po::value<size_t>(&parsed_options.server_threads)->default_value(2), 
+                "Число потоков цикла событий сервера для --socket")
+            (OPTION_NAME_MAX_LATENCY, po::value<size_t>(&parsed_options.max_latency_ms)->default_value(0), 
+                "Предельное время ожидания статического пакета в миллисекундах: пакет выводится досрочно, "
+                "если с получения его первой команды прошло больше. 0 - без ограничения")
+            (OPTION_NAME_LOG_COMPRESS, po::value<std::string>()->default_value("none")->notifier(set_log_compress), 
+                "Сжатие журнала: none, zstd - файлы .zst, сжатие в потоках записи (читаются bulk-cat)")
+            (OPTION_NAME_LOG_COMPRESS_LEVEL, po::value<int>(&parsed_options.log_compress_level)->default_value(3), 
+                "Уровень сжатия журнала")
+            (OPTION_NAME_LOG_DICT, po::value<std::string>(&parsed_options.log_dict), 
+                "Словарь сжатия журнала, обученный bulk-cat --train на характерных командах")
+            (OPTION_NAME_LOG_FORMAT, po::value<std::string>()->default_value("text")->notifier(set_log_format), 
+                "Формат журнала: text, binary - сегменты .blg с индексом по времени (ротация по --segment_size и "
+                "--segment_seconds), читаются bulk-cat")
+            (OPTION_NAME_INTERN, po::bool_switch(&parsed_options.intern), 
+                "Интернирование команд: повторяющиеся команды хранятся в одном буфере (не для --parse_threads)")
+            (OPTION_NAME_INTERN_CAPACITY, po::value<size_t>(&parsed_options.intern_capacity)->default_value(size_t(1) << 16), 
+                "Число ячеек таблицы интернирования; заполненная на 3/4 таблица новые команды не принимает")
+            (OPTION_NAME_DYNAMIC_PIPELINE, po::bool_switch(&parsed_options.dynamic_pipeline), 
+                "Обработка через виртуальные интерфейсы вместо статического конвейера (для сравнения)")
+            (OPTION_NAME_EXEC_THREADS, po::value<size_t>(&parsed_options.exec_threads)->default_value(0), 
+                "Число потоков пула выполнения пакетов (с перехватом задач), 0 - без пула, а при заданных "
+                "--handler - по числу ядер")
+            (OPTION_NAME_HANDLER, po::value<std::vector<std::string>>(&parsed_options.handlers)->composing(), 
+                "Обработчик команд с префиксом: PREFIX=hash[:ROUNDS], PREFIX=regex:PATTERN, PREFIX=plugin:LIB.so; "
+                "команда выводится как \"команда=результат\". Можно указать несколько раз")
+            (OPTION_NAME_EXEC_UNORDERED, po::bool_switch(&parsed_options.exec_unordered), 
+                "Выводить пакеты пула по готовности, без восстановления порядка")
+            (OPTION_NAME_MEMORY_CAP, po::value<size_t>(&parsed_options.memory_cap)->default_value(0), 
+                "Лимит памяти пакетов, ожидающих вывода (читаемый блок и очереди), байт; 0 - без ограничения. "
+                "Текущий и наибольший объем выводятся в --stats_file")
+            (OPTION_NAME_OVERFLOW, po::value<std::string>()->default_value("spill")->notifier(set_overflow), 
+                "Действие при превышении --memory_cap динамическим блоком: stall - ждать вывода очередей, "
+                "spill - выгрузить блок во временный файл, discard - отбросить блок")
+            (OPTION_NAME_SPILL_DIR, po::value<std::string>(&parsed_options.spill_dir), 
+                "Каталог временных файлов выгрузки, по умолчанию TMPDIR или /tmp")
+            (OPTION_NAME_DURABLE, po::bool_switch(&parsed_options.durable), 
+                "Надежный журнал: пакеты пишутся в журнал группами, группа синхронизируется с носителем одним "
+                "вызовом, и только затем пакеты выводятся в консоль")
+            (OPTION_NAME_COMMIT_DELAY, po::value<size_t>(&parsed_options.commit_delay_us)->default_value(0), 
+                "Наибольшая задержка групповой фиксации ради пополнения группы, мкс; 0 - фиксировать сразу, "
+                "группа копится, пока идет предыдущая синхронизация")
+            (OPTION_NAME_CHECKPOINT, po::value<std::string>(&parsed_options.checkpoint_path), 
+                "Файл контрольной точки: смещение ввода, вложенность блоков и номер последнего выведенного пакета")
+            (OPTION_NAME_CHECKPOINT_EVERY, po::value<size_t>(&parsed_options.checkpoint_every)->default_value(1), 
+                "Число пакетов между контрольными точками; после сбоя повторно выводится не больше N - 1 пакетов")
+            (OPTION_NAME_RESUME, po::bool_switch(&parsed_options.resume), 
+                "Продолжить с контрольной точки --checkpoint; ввод (--input или перенаправленный файл) должен "
+                "допускать переход по смещению")
+            (OPTION_NAME_TARGET_P99, po::value<size_t>(&parsed_options.target_p99_us)->default_value(0), 
+                "Подбор размера статического пакета: цель p99 задержки от первой команды пакета до его вывода, мкс. "
+                "Размер пакета из командной строки становится начальным")
+            (OPTION_NAME_MIN_CHUNK, po::value<size_t>(&parsed_options.min_chunk)->default_value(0), 
+                "Подбор размера статического пакета: наименьший размер. Без цели p99 выбирается наименьший размер, "
+                "при котором вывод успевает за вводом")
+            (OPTION_NAME_MAX_CHUNK, po::value<size_t>(&parsed_options.max_chunk)->default_value(4096), 
+                "Наибольший подбираемый размер статического пакета");
 
         po::positional_options_description pos_desc;
         pos_desc.add(OPTION_NAME_CHUNK_SIZE, -1);
@@ -15,6 +15,7 @@ int main(int argc, char const* argv[])
 		if (!parse_command_line(argc, argv, options))
 			return 1;
 		
+		IStatsReporterPtr_t stats = create_stats_reporter(options);
 		IProcessorPtr_t processor = create_processor(options);
 		processor->process();	
 	}	
@@ -1,18 +1,58 @@
 #include <gtest/gtest.h>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <limits>
 #include <list>
+#include <set>
 #include <tuple>
+#include <future>
+#include <filesystem>
 #ifndef __PRETTY_FUNCTION__
 #include "pretty.h"
 #endif
-#include "bulk_internal.h"
+#include "bulk_arena.h"
+#include "bulk_async.h"
+#include "bulk_binlog.h"
+#include "bulk_checkpoint.h"
+#include "bulk_compress.h"
+#include "bulk_durable.h"
+#include "bulk_exec.h"
+#include "bulk_intern.h"
+#include "bulk_memory.h"
+#include "bulk_metrics.h"
+#include "bulk_pipeline.h"
+#include "bulk_server.h"
+#include "bulk_sharded.h"
+#include "bulk_sinks.h"
+#include "bulk_uring.h"
+
+#include <algorithm>
+#include <numeric>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace otus_hw7;
 
 int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
-    return RUN_ALL_TESTS();
+    // процессоры пишут журналы пакетов в текущий каталог: тесты работают во временном, который удаляется после
+    char dir[] = "/tmp/test_bulkXXXXXX";
+    if( !::mkdtemp(dir) || ::chdir(dir) )
+    {
+        std::perror("test_bulk: temp dir");
+        return 1;
+    }
+    int const rc = RUN_ALL_TESTS();
+    std::error_code ec;
+    std::filesystem::current_path(std::filesystem::temp_directory_path(), ec);
+    std::filesystem::remove_all(dir, ec);
+    return rc;
 }
 
 using namespace std::literals::string_literals;
@@ -35,3 +75,1538 @@ TEST(test_bulk, test_create_q)
     ICommandQueuePtr_t cmd_q = create_command_queue();
     EXPECT_TRUE( cmd_q );
 }
+
+TEST(test_bulk, test_bounded_q)
+{
+    BoundedQueue<int> q(2);
+    EXPECT_TRUE(q.push(1));
+    EXPECT_TRUE(q.push(2));
+    EXPECT_EQ(q.size(), 2);
+    int v = 0;
+    EXPECT_TRUE(q.pop(v));
+    EXPECT_EQ(v, 1);
+    q.close();
+    EXPECT_FALSE(q.push(3));
+    EXPECT_TRUE(q.pop(v));
+    EXPECT_EQ(v, 2);
+    EXPECT_FALSE(q.pop(v));
+}
+
+TEST(test_bulk, test_ring_q)
+{
+    SpscQueue<int> spsc(3);
+    EXPECT_EQ(spsc.size(), 0);
+    int items[] = {1, 2, 3, 4};
+    EXPECT_EQ(spsc.push_batch(items, 4), 4);
+    int v = 0;
+    EXPECT_FALSE(spsc.try_push(v));
+    int out[8] = {};
+    EXPECT_EQ(spsc.pop_batch(out, 8), 4);
+    EXPECT_EQ(out[0], 1);
+    EXPECT_EQ(out[3], 4);
+    EXPECT_TRUE(spsc.push(5));
+    spsc.close();
+    EXPECT_FALSE(spsc.push(6));
+    EXPECT_TRUE(spsc.pop(v));
+    EXPECT_EQ(v, 5);
+    EXPECT_FALSE(spsc.pop(v));
+    EXPECT_EQ(spsc.pop_batch(out, 8), 0);
+
+    constexpr int kProducers = 3, kPerProducer = 20000;
+    MpmcQueue<int> mpmc(8, WaitStrategy{4, 2});
+    std::vector<std::thread> producers, consumers;
+    std::vector<long long> sums(2, 0);
+    for( int p = 0; p < kProducers; ++p )
+        producers.emplace_back([&mpmc, p]{ for( int i = 1; i <= kPerProducer; ++i ) mpmc.push(p * kPerProducer + i); });
+    for( size_t c = 0; c < sums.size(); ++c )
+        consumers.emplace_back([&mpmc, &sums, c]{ int batch[4]; while( size_t n = mpmc.pop_batch(batch, 4) ) for( size_t i = 0; i < n; ++i ) sums[c] += batch[i]; });
+    for( auto& t : producers )
+        t.join();
+    mpmc.close();
+    for( auto& t : consumers )
+        t.join();
+    long long const total = static_cast<long long>(kProducers) * kPerProducer;
+    EXPECT_EQ(sums[0] + sums[1], total * (total + 1) / 2);
+}
+
+TEST(test_bulk, test_ring_command_queue)
+{
+    SpscCommandQueue cmd_q(4);
+    cmd_q.push(CommandCreator().create_command("cmd1"));
+    cmd_q.push(CommandCreator().create_command("cmd2"));
+    EXPECT_EQ(cmd_q.size(), 2);
+    ICommandPtr_t cmd;
+    EXPECT_TRUE(cmd_q.pop(cmd));
+    EXPECT_TRUE(cmd);
+    EXPECT_EQ(cmd_q.size(), 1);
+
+    MpmcCommandQueue mpmc_q(2);
+    mpmc_q.push(CommandCreator().create_command("cmd3"));
+    std::thread consumer([&mpmc_q]{ ICommandPtr_t c; while( !mpmc_q.pop(c) ) std::this_thread::yield(); });
+    mpmc_q.push(CommandCreator().create_command("cmd4"));
+    mpmc_q.push(CommandCreator().create_command("cmd5"));
+    consumer.join();
+    mpmc_q.reset();
+    EXPECT_EQ(mpmc_q.size(), 0);
+    EXPECT_FALSE(mpmc_q.pop(cmd));
+}
+
+TEST(test_bulk, test_async_processor)
+{
+    const std::string input = "1\n2\n3\n4\n{\n5\n6\n{\n7\n}\n}\n8\n"s;
+    auto make_parser = [](std::istream& is)
+    {
+        return IInputParserPtr_t{ new InputParser(3, is, ICommandCreatorPtr_t(new CommandCreator)) };
+    };
+
+    std::istringstream sync_is(input);
+    std::ostringstream sync_os;
+    Processor(make_parser(sync_is), create_command_queue(), create_queue_executor(), sync_os).process();
+
+    std::istringstream bulk_is(input);
+    std::ostringstream bulk_os;
+    std::vector<IBulkSinkPtr_t> sinks;
+    sinks.emplace_back(new OstreamBulkSink(bulk_os));
+    BulkProcessor(make_parser(bulk_is), std::move(sinks)).process();
+
+    std::istringstream async_is(input);
+    std::ostringstream async_os, stats_os;
+    std::vector<IBulkSinkPtr_t> log_sinks;
+    log_sinks.emplace_back(new LogFileBulkSink);
+    log_sinks.emplace_back(new LogFileBulkSink);
+    AsyncProcessor(make_parser(async_is), IBulkSinkPtr_t{ new OstreamBulkSink(async_os) }, std::move(log_sinks), 1, stats_os).process();
+
+    EXPECT_EQ(sync_os.str(), "bulk: 1, 2, 3\nbulk: 4\nbulk: 5, 6, 7\nbulk: 8\n"s);
+    EXPECT_EQ(bulk_os.str(), sync_os.str());
+    EXPECT_EQ(async_os.str(), sync_os.str());
+    EXPECT_NE(stats_os.str().find("main - bulks: 4, commands: 8"), std::string::npos);
+    EXPECT_NE(stats_os.str().find("console - bulks: 4, commands: 8"), std::string::npos);
+}
+
+TEST(test_bulk, test_bulk_buffer)
+{
+    BulkBuffer bulk;
+    bulk.push("cmd1");
+    bulk.push("");
+    bulk.push("command3");
+    EXPECT_EQ(bulk.size(), 3);
+    EXPECT_EQ(bulk.bytes(), 12);
+    EXPECT_EQ(bulk[0], "cmd1");
+    EXPECT_EQ(bulk[1], "");
+    EXPECT_EQ(bulk[2], "command3");
+
+    std::string joined;
+    for( auto cmd : bulk )
+        joined.append(cmd.data(), cmd.size()).append("|");
+    EXPECT_EQ(joined, "cmd1||command3|");
+
+    std::string const external = "external";
+    bulk.push_ref(external);
+    EXPECT_EQ(bulk.bytes(), 20);
+    EXPECT_EQ(bulk[3].data(), external.data());
+
+    bulk.clear();
+    EXPECT_TRUE(bulk.empty());
+    EXPECT_EQ(bulk.bytes(), 0);
+}
+
+TEST(test_bulk, test_read_next_bulk_buffer)
+{
+    std::istringstream is("a\nb\n}\n{\nc\n{\nd\n}\ne\n}\nf\n{\ng\n"s);
+    InputParser parser(2, is, ICommandCreatorPtr_t(new CommandCreator));
+    BulkBuffer bulk;
+    std::vector<std::string> bulks;
+    for( IInputParser::Status st; (st = parser.read_next_bulk(bulk)) != IInputParser::Status::kStop; )
+    {
+        if( st != IInputParser::Status::kReady || bulk.empty() )
+            continue;
+        std::string s;
+        for( auto cmd : bulk )
+            s.append(cmd.data(), cmd.size());
+        bulks.push_back(s);
+        bulk.clear();
+    }
+    EXPECT_EQ(bulks, (std::vector<std::string>{"ab", "cde", "f"}));
+    EXPECT_TRUE(bulk.empty());
+}
+
+TEST(test_bulk, test_intern)
+{
+    StringInterner interner(64);
+    EXPECT_EQ(interner.capacity(), 64);
+    std::vector<std::string> vocabulary;
+    for( int i = 0; i < 40; ++i )
+        vocabulary.push_back("command_" + std::to_string(i));
+
+    constexpr size_t kThreads = 4;
+    std::vector<std::vector<const char*>> seen(kThreads, std::vector<const char*>(vocabulary.size()));
+    std::vector<std::thread> threads;
+    for( size_t t = 0; t < kThreads; ++t )
+        threads.emplace_back([&, t]
+        {
+            for( int round = 0; round < 100; ++round )
+                for( size_t i = 0; i < vocabulary.size(); ++i )
+                {
+                    std::string_view ref;
+                    ASSERT_TRUE(interner.intern(vocabulary[i], ref));
+                    ASSERT_EQ(ref, vocabulary[i]);
+                    if( !round )
+                        seen[t][i] = ref.data();
+                    else
+                        ASSERT_EQ(seen[t][i], ref.data());
+                }
+        });
+    for( auto& th : threads )
+        th.join();
+    EXPECT_EQ(interner.size(), vocabulary.size());
+    for( size_t t = 1; t < kThreads; ++t )
+        EXPECT_EQ(seen[t], seen[0]);
+
+    // 40 из 48 допустимых ячеек заняты: поместятся еще 8 строк
+    std::string_view ref;
+    for( int i = 0; i < 8; ++i )
+        EXPECT_TRUE(interner.intern("extra_" + std::to_string(i), ref));
+    EXPECT_FALSE(interner.intern("overflow", ref));
+    EXPECT_TRUE(interner.intern("command_7", ref));
+
+    std::istringstream is("a\nb\na\n{\nb\nb\n}\na\n"s), plain_is(is.str());
+    InputParser parser(2, is, ICommandCreatorPtr_t(new CommandCreator)), plain(2, plain_is, ICommandCreatorPtr_t(new CommandCreator));
+    parser.set_interner(std::make_shared<StringInterner>());
+    BulkBuffer bulk, plain_bulk;
+    std::string text, plain_text;
+    std::vector<const char*> b_refs;
+    while( parser.read_next_bulk(bulk) != IInputParser::Status::kStop )
+    {
+        plain.read_next_bulk(plain_bulk);
+        for( auto cmd : bulk )
+            if( cmd == "b" )
+                b_refs.push_back(cmd.data());
+        format_bulk(bulk, text);
+        format_bulk(plain_bulk, plain_text);
+        bulk.clear();
+        plain_bulk.clear();
+    }
+    EXPECT_EQ(text, plain_text);
+    ASSERT_EQ(b_refs.size(), 3);
+    EXPECT_EQ(b_refs[0], b_refs[1]);
+    EXPECT_EQ(b_refs[0], b_refs[2]);
+}
+
+TEST(test_bulk, test_command_arena)
+{
+    auto pool = std::make_shared<ArenaPool>();
+    {
+        auto creator = std::make_unique<ArenaCommandCreator>(pool);
+        ICommandPtr_t a = creator->create_command("alpha"), b = creator->create_command(std::string(100, 'b'));
+        creator->end_bulk();
+        ICommandPtr_t c = creator->create_command("gamma");
+        EXPECT_EQ(pool->created(), 2);
+        a.reset();
+        EXPECT_EQ(pool->free_count(), 0);
+        b.reset();
+        // все команды первого пакета разрушены - его арена вернулась в пул
+        EXPECT_EQ(pool->free_count(), 1);
+        creator->end_bulk();
+        ICommandPtr_t d = creator->create_command("delta");
+        EXPECT_EQ(pool->created(), 2);
+        EXPECT_EQ(pool->free_count(), 0);
+        c.reset();
+        EXPECT_EQ(pool->free_count(), 1);
+
+        // команды переживают фабрику
+        creator->end_bulk();
+        ICommandPtr_t e = creator->create_command("epsilon");
+        creator.reset();
+        std::ostringstream os;
+        ICommandContext ctx(2, 0, os, 0);
+        d->execute(ctx);
+        ++ctx.cmd_idx_;
+        e->execute(ctx);
+        EXPECT_EQ(os.str(), "bulk: delta, epsilon\n");
+    }
+    EXPECT_EQ(pool->free_count(), 2);
+
+    std::string const input = "1\n2\n3\n{\n4\n{\n5\n}\n6\n}\n7\n8\n"s;
+    std::istringstream arena_is(input), plain_is(input);
+    std::ostringstream arena_os, plain_os;
+    auto arena_creator = new ArenaCommandCreator(pool);
+    Processor(IInputParserPtr_t{ new InputParser(2, arena_is, ICommandCreatorPtr_t(arena_creator)) }, 
+              create_command_queue(), create_queue_executor(), arena_os).process();
+    Processor(IInputParserPtr_t{ new InputParser(2, plain_is, ICommandCreatorPtr_t(new CommandCreator)) }, 
+              create_command_queue(), create_queue_executor(), plain_os).process();
+    EXPECT_EQ(arena_os.str(), plain_os.str());
+    EXPECT_EQ(pool->free_count(), 2);
+    EXPECT_EQ(pool->created(), 2);
+}
+
+TEST(test_bulk, test_handlers)
+{
+    HandlerRegistry handlers;
+    handlers.add("h=hash");
+    handlers.add("heavy=hash:3");
+    handlers.add("re=regex:[0-9]+");
+    EXPECT_EQ(handlers.size(), 3);
+    EXPECT_THROW(handlers.add("x=unknown"), std::runtime_error);
+    EXPECT_THROW(handlers.add("=hash"), std::runtime_error);
+    EXPECT_THROW(handlers.add("x=hash:many"), std::runtime_error);
+
+    std::string out;
+    handlers.apply("h abc", out);
+    EXPECT_EQ(out, "h abc=e71fa2190541574b");      // FNV-1a 64 от "abc"
+    out.clear();
+    handlers.apply("heavy abc", out);
+    EXPECT_EQ(out.size(), "heavy abc="s.size() + 16);
+    EXPECT_NE(out.substr(out.size() - 16), "e71fa2190541574b");
+    out.clear();
+    handlers.apply("re ab12cd345", out);
+    EXPECT_EQ(out, "re ab12cd345=12");
+    out.clear();
+    handlers.apply("re none", out);
+    EXPECT_EQ(out, "re none=-");
+    out.clear();
+    handlers.apply("plain", out);
+    EXPECT_EQ(out, "plain");
+
+#ifdef BULK_TEST_PLUGIN
+    handlers.add("rev=plugin:"s + BULK_TEST_PLUGIN);
+    out.clear();
+    handlers.apply("rev hello", out);
+    EXPECT_EQ(out, "rev hello=olleh");
+    std::string const long_arg(100, 'x');
+    out.clear();
+    handlers.apply("rev " + long_arg, out);
+    EXPECT_EQ(out, "rev " + long_arg + "=" + long_arg);
+    EXPECT_THROW(handlers.add("bad=plugin:/nonexistent/plugin.so"), std::runtime_error);
+#endif
+
+    std::istringstream is("h abc\nx\n"s);
+    std::ostringstream os;
+    auto registry = std::make_shared<HandlerRegistry>(handlers);
+    Processor(IInputParserPtr_t{ new InputParser(2, is, ICommandCreatorPtr_t(new HandlerCommandCreator(registry))) },
+              create_command_queue(), create_queue_executor(), os).process();
+    EXPECT_EQ(os.str(), "bulk: h abc=e71fa2190541574b, x\n");
+}
+
+TEST(test_bulk, test_work_stealing_pool)
+{
+    std::vector<uint64_t> order;
+    ReorderBuffer<uint64_t> reorder([&](uint64_t& v){ order.push_back(v); });
+    for( uint64_t seq : {3, 1, 2, 5, 4} )
+        reorder.put(seq, seq * 10);
+    EXPECT_EQ(order, (std::vector<uint64_t>{10, 20, 30, 40, 50}));
+    EXPECT_EQ(reorder.max_held(), 1);
+
+    std::atomic<size_t> done{0};
+    {
+        WorkStealingPool pool(3);
+        EXPECT_EQ(pool.size(), 3);
+        // задачи, порождающие задачи, попадают в деку своего потока
+        for( int i = 0; i < 50; ++i )
+            pool.submit([&]
+            {
+                for( int j = 0; j < 10; ++j )
+                    pool.submit([&]{ done.fetch_add(1); });
+                done.fetch_add(1);
+            });
+        pool.wait_idle();
+        EXPECT_EQ(done.load(), 550);
+        pool.submit([&]{ done.fetch_add(1); });
+    }
+    EXPECT_EQ(done.load(), 551);
+}
+
+TEST(test_bulk, test_parallel_exec)
+{
+    std::string input;
+    for( int i = 0; i < 300; ++i )
+        input += (i % 3 ? "h cmd" : "other") + std::to_string(i) + "\n";
+    auto handlers = std::make_shared<HandlerRegistry>();
+    handlers->add("h=hash:50");
+
+    std::string expected;
+    {
+        BulkBuffer bulk;
+        std::istringstream is(input);
+        InputParser parser(4, is, ICommandCreatorPtr_t(new CommandCreator));
+        while( parser.read_next_bulk(bulk) != IInputParser::Status::kStop )
+        {
+            format_bulk(bulk, *handlers, expected);
+            bulk.clear();
+        }
+    }
+
+    auto pool = std::make_shared<WorkStealingPool>(4);
+    for( bool ordered : {true, false} )
+    {
+        std::istringstream is(input);
+        std::ostringstream os;
+        std::vector<IBulkSinkPtr_t> out;
+        out.emplace_back(new OstreamBulkSink(os));
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new ParallelBulkSink(pool, handlers, std::move(out), ordered, 8));
+        BulkProcessor(IInputParserPtr_t{ new InputParser(4, is, ICommandCreatorPtr_t(new CommandCreator)) }, std::move(sinks)).process();
+        if( ordered )
+            EXPECT_EQ(os.str(), expected);
+        else
+        {
+            std::istringstream got_is(os.str()), expected_is(expected);
+            std::multiset<std::string> got_lines, expected_lines;
+            for( std::string line; std::getline(got_is, line); )
+                got_lines.insert(line);
+            for( std::string line; std::getline(expected_is, line); )
+                expected_lines.insert(line);
+            EXPECT_EQ(got_lines, expected_lines);
+        }
+    }
+
+    std::istringstream seq_is(input), par_is(input);
+    std::ostringstream seq_os, par_os;
+    Processor(IInputParserPtr_t{ new InputParser(4, seq_is, ICommandCreatorPtr_t(new HandlerCommandCreator(handlers))) },
+              create_command_queue(), create_queue_executor(), seq_os).process();
+    Processor(IInputParserPtr_t{ new InputParser(4, par_is, ICommandCreatorPtr_t(new HandlerCommandCreator(handlers))) },
+              create_command_queue(), IQueueExecutorPtr_t{ new ParallelQueueExecutor(pool, true, 8) }, par_os).process();
+    EXPECT_EQ(par_os.str(), seq_os.str());
+    EXPECT_EQ(par_os.str(), expected);
+}
+
+TEST(test_bulk, test_memory_budget)
+{
+    std::string input = "1\n2\n{\n";
+    std::string block = "bulk: ";
+    for( int i = 0; i < 40; ++i )
+    {
+        input += "cmd" + std::to_string(i) + "\n";
+        block += (i ? ", cmd" : "cmd") + std::to_string(i);
+    }
+    input += "}\n3\n{\na\nb\n}\n4\n";
+    block += "\n";
+
+    struct Parts
+    {
+        std::vector<std::pair<uint64_t, BulkPart>>  parts_;
+        std::set<std::string>                       stems_;
+    };
+    struct PartSink : IBulkSink
+    {
+        explicit PartSink(Parts& parts) : parts_(parts) {}
+        void write(BulkBuffer const& bulk, std::string_view) override
+        {
+            parts_.parts_.emplace_back(bulk.seq_, bulk.part_);
+            parts_.stems_.insert(get_bulk_file_stem(bulk));
+        }
+        Parts& parts_;
+    };
+    auto run = [&input](MemoryBudgetPtr_t budget, std::ostream& os, Parts* parts = nullptr)
+    {
+        std::istringstream is(input);
+        auto parser = std::make_unique<InputParser>(3, is, ICommandCreatorPtr_t(new CommandCreator));
+        if( budget )
+            parser->set_budget(std::move(budget));
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new OstreamBulkSink(os));
+        if( parts )
+        {
+            sinks.emplace_back(new LogFileBulkSink);
+            sinks.emplace_back(new PartSink(*parts));
+        }
+        BulkProcessor(std::move(parser), std::move(sinks)).process();
+    };
+    std::ostringstream expected;
+    run(nullptr, expected);
+    ASSERT_NE(expected.str().find(block), std::string::npos);
+
+    for( auto policy : {OverflowPolicy::kSpill, OverflowPolicy::kStall} )
+    {
+        auto budget = std::make_shared<MemoryBudget>(64, policy);
+        std::ostringstream os;
+        Parts parts;
+        run(budget, os, &parts);
+        EXPECT_EQ(os.str(), expected.str());
+        EXPECT_GT(budget->peak(), budget->cap());
+
+        size_t block_parts = 0;
+        for( auto const& [seq, part] : parts.parts_ )
+        {
+            EXPECT_EQ(part == BulkPart::kWhole, seq != 2);
+            block_parts += seq == 2;
+        }
+        EXPECT_GT(block_parts, 2u);
+        EXPECT_EQ(parts.parts_.size(), block_parts + 4);
+        EXPECT_EQ(parts.stems_.size(), 5u);
+        for( auto const& stem : parts.stems_ )
+        {
+            if( stem.back() == '2' )
+            {
+                std::ifstream log(stem + ".log");
+                std::ostringstream text;
+                text << log.rdbuf();
+                EXPECT_EQ(text.str(), block);
+            }
+            std::remove((stem + ".log").c_str());
+        }
+    }
+
+    std::ostringstream discarded;
+    run(std::make_shared<MemoryBudget>(64, OverflowPolicy::kDiscard), discarded);
+    std::string without_block = expected.str();
+    without_block.erase(without_block.find(block), block.size());
+    EXPECT_EQ(discarded.str(), without_block);
+
+    MemoryBudget budget(150, OverflowPolicy::kStall);
+    EXPECT_FALSE(budget.wait_for_room(200));
+    budget.charge(100);
+    EXPECT_TRUE(budget.over(60));
+    std::atomic<bool> woke{false};
+    std::thread waiter([&]{ EXPECT_TRUE(budget.wait_for_room(100)); woke = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(woke);
+    budget.release(100);
+    waiter.join();
+    EXPECT_TRUE(woke);
+    EXPECT_EQ(budget.queued(), 0u);
+    EXPECT_EQ(budget.peak(), 160u);
+}
+
+TEST(test_bulk, test_memory_budget_release)
+{
+    // release освобождает место и без метрик (-DWITH_METRICS=OFF): зависание считается ошибкой, а не ждется
+    MemoryBudget budget(100, OverflowPolicy::kStall);
+    for( int round = 0; round < 3; ++round )
+    {
+        budget.charge(80);
+        auto waiter = std::async(std::launch::async, [&budget]{ return budget.wait_for_room(50); });
+        EXPECT_EQ(waiter.wait_for(std::chrono::milliseconds(20)), std::future_status::timeout);
+        budget.release(80);
+        ASSERT_EQ(waiter.wait_for(std::chrono::seconds(5)), std::future_status::ready) << "round " << round;
+        EXPECT_TRUE(waiter.get());
+        EXPECT_EQ(budget.queued(), 0u);
+    }
+}
+
+TEST(test_bulk, test_push_parser)
+{
+    for( std::string const& input : {"1\n2\n3\n4\n{\n5\n6\n{\n7\n}\n}\n8\n"s, "1\n2\n}\n3\n{\n4\n"s, "a\n\nb\nc"s, "{\nx\n}\n{\n}\ny\n"s} )
+    {
+        std::istringstream is(input);
+        std::ostringstream expected;
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new OstreamBulkSink(expected));
+        BulkProcessor(IInputParserPtr_t{ new InputParser(3, is, ICommandCreatorPtr_t(new CommandCreator)) }, std::move(sinks)).process();
+
+        for( size_t step : {size_t(1), size_t(2), input.size()} )
+        {
+            std::string actual;
+            PushParser parser(3, [&actual](BulkBuffer& bulk){ format_bulk(bulk, actual); });
+            for( size_t pos = 0; pos < input.size(); pos += step )
+                parser.feed(input.data() + pos, std::min(step, input.size() - pos));
+            parser.finish();
+            EXPECT_EQ(actual, expected.str()) << "input: " << input << ", step: " << step;
+        }
+    }
+}
+
+TEST(test_bulk, test_bulk_feeder)
+{
+    for( std::string const& input : {"1\n2\n3\n4\n{\n5\n6\n{\n7\n}\n}\n8\n"s, "1\n2\n}\n3\n{\n4\n"s, "a\n\nb\nc"s, "{\nx\n}\n{\n}\ny\n"s} )
+    {
+        std::istringstream is(input);
+        std::ostringstream expected;
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new OstreamBulkSink(expected));
+        BulkProcessor(IInputParserPtr_t{ new InputParser(3, is, ICommandCreatorPtr_t(new CommandCreator)) }, std::move(sinks)).process();
+
+        for( size_t step : {size_t(1), size_t(2), input.size()} )
+        {
+            std::string actual;
+            uint64_t last_seq = 0;
+            IBulkFeederPtr_t feeder = create_feeder(3, [&](BulkBuffer const& bulk)
+            {
+                format_bulk(bulk, actual);
+                EXPECT_EQ(bulk.seq_, ++last_seq);
+            });
+            for( size_t pos = 0; pos < input.size(); pos += step )
+                feeder->feed(input.data() + pos, std::min(step, input.size() - pos));
+            feeder->finish();
+            EXPECT_EQ(actual, expected.str()) << "input: " << input << ", step: " << step;
+        }
+    }
+
+    // команды пакетов, завершенных порцией, ссылаются на порцию; остальные копируются
+    std::string const input = "a\nb\nc\n{\nd\ne\n}\nf";
+    std::string tail = "\ng\n";
+    std::string actual;
+    size_t borrowed = 0;
+    IBulkFeederPtr_t feeder = create_feeder(3, [&](BulkBuffer const& bulk)
+    {
+        format_bulk(bulk, actual);
+        for( auto cmd : bulk )
+            borrowed += cmd.data() >= input.data() && cmd.data() < input.data() + input.size();
+    });
+    feeder->feed(input.data(), input.size());
+    EXPECT_EQ(actual, "bulk: a, b, c\nbulk: d, e\n");
+    feeder->feed(tail.data(), tail.size());
+    tail.assign(tail.size(), 'X');
+    feeder->finish();
+    EXPECT_EQ(actual, "bulk: a, b, c\nbulk: d, e\nbulk: f, g\n");
+    EXPECT_EQ(borrowed, 5u);
+}
+
+TEST(test_bulk, test_static_pipeline)
+{
+    for( std::string const& input : {"1\n2\n3\n4\n{\n5\n6\n{\n7\n}\n}\n8\n"s, "1\n2\n}\n3\n{\n4\n"s, "a\n\nb\nc"s, "{\nx\n}\n{\n}\ny\n"s} )
+    {
+        std::istringstream is(input);
+        std::ostringstream expected;
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new OstreamBulkSink(expected));
+        BulkProcessor(IInputParserPtr_t{ new InputParser(3, is, ICommandCreatorPtr_t(new CommandCreator)) }, std::move(sinks)).process();
+
+        std::istringstream pipeline_is(input);
+        std::ostringstream console, log;
+        using Console_t = Timed<OstreamBulkSink, MetricStage::kConsoleWrite>;
+        using Sink_t = Tee<Console_t, Console_t>;
+        Pipeline<IstreamLineSource, Sink_t> pipeline(3, std::make_unique<IstreamLineSource>(pipeline_is),
+                                                     Sink_t(Console_t(std::make_unique<OstreamBulkSink>(console)), 
+                                                            Console_t(std::make_unique<OstreamBulkSink>(log))),
+                                                     std::make_shared<StringInterner>());
+        IProcessor& processor = pipeline;
+        processor.process();
+        EXPECT_EQ(console.str(), expected.str()) << "input: " << input;
+        EXPECT_EQ(log.str(), expected.str()) << "input: " << input;
+    }
+
+    Options options{};
+    options.cmd_chunk_sz = 3;
+    options.log_threads = 2;
+    EXPECT_FALSE(create_static_pipeline(options));
+}
+
+TEST(test_bulk, test_line_source)
+{
+    std::istringstream is("first\n\na rather long third line\n{\nlast"s);
+    IstreamLineSource src(is, 4);
+    std::vector<std::string> lines;
+    for( std::string_view line; src.next_line(line); )
+        lines.emplace_back(line);
+    EXPECT_EQ(lines, (std::vector<std::string>{"first", "", "a rather long third line", "{", "last"}));
+
+    std::string_view line;
+    EXPECT_FALSE(src.next_line(line));
+}
+
+TEST(test_bulk, test_mapped_line_source)
+{
+    std::string content;
+    for( size_t i = 0; i < 3000; ++i )
+        content += "cmd" + std::to_string(i) + (i % 500 == 0 ? std::string(9000, 'x') : std::string()) + "\n";
+    content += "{\n}\ntail";
+
+    const std::string path = "test_mapped_line_source.txt";
+    std::ofstream(path, std::ios::binary) << content;
+
+    std::istringstream is(content);
+    IstreamLineSource expected_src(is);
+    MappedLineSource mapped_src(path, 1);
+    std::string_view expected, mapped;
+    size_t lines = 0;
+    for( bool more = true; more; ++lines )
+    {
+        more = expected_src.next_line(expected);
+        EXPECT_EQ(mapped_src.next_line(mapped), more);
+        if( more )
+        {
+            EXPECT_EQ(mapped, expected);
+        }
+    }
+    EXPECT_EQ(lines, 3004);
+    std::remove(path.c_str());
+}
+
+TEST(test_bulk, test_sharded_parser)
+{
+    std::string content;
+    unsigned seed = 12345;
+    auto next_rand = [&seed]{ seed = seed * 1103515245u + 12345u; return (seed >> 16) % 100; };
+    for( size_t i = 0; i < 5000; ++i )
+    {
+        auto const r = next_rand();
+        content += r < 8 ? "{" : r < 16 ? "}" : "c" + std::to_string(i);
+        content += "\n";
+    }
+
+    const std::string path = "test_sharded_parser.txt";
+    for( auto const& tail : {"last"s, "{\nopen block at eof\n"s} )
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << content << tail;
+        for( size_t chunk : {1, 3, 7} )
+        {
+            std::ifstream seq_is(path, std::ios::binary);
+            std::ostringstream seq_os;
+            std::vector<IBulkSinkPtr_t> seq_sinks;
+            seq_sinks.emplace_back(new OstreamBulkSink(seq_os));
+            BulkProcessor(IInputParserPtr_t{ new InputParser(chunk, seq_is, ICommandCreatorPtr_t(new CommandCreator)) },
+                          std::move(seq_sinks)).process();
+
+            std::ostringstream par_os;
+            std::vector<IBulkSinkPtr_t> par_sinks;
+            par_sinks.emplace_back(new OstreamBulkSink(par_os));
+            BulkProcessor(IInputParserPtr_t{ new ShardedInputParser(chunk, path, 3, 64) }, std::move(par_sinks)).process();
+
+            EXPECT_FALSE(seq_os.str().empty());
+            EXPECT_EQ(par_os.str(), seq_os.str()) << "chunk " << chunk << ", tail " << tail;
+        }
+    }
+    std::remove(path.c_str());
+}
+
+TEST(test_bulk, test_flush_policy)
+{
+    BulkBuffer bulk;
+    bulk.push("a");
+    bulk.push("b");
+    std::string text;
+    format_bulk(bulk, text);
+    EXPECT_EQ(text, "bulk: a, b\n");
+
+    auto pending = [](int fd)
+    {
+        char buf[256];
+        auto const n = ::read(fd, buf, sizeof(buf));
+        return n > 0 ? std::string(buf, static_cast<size_t>(n)) : std::string();
+    };
+
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    ::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    {
+        FdBulkSink per_bulk(fds[1]);
+        per_bulk.write(bulk, text);
+        EXPECT_EQ(pending(fds[0]), text);
+
+        FlushOptions on_exit;
+        on_exit.policy_ = FlushPolicy::kOnExit;
+        FdBulkSink deferred(fds[1], on_exit);
+        deferred.write(bulk, text);
+        deferred.write(bulk, text);
+        EXPECT_EQ(pending(fds[0]), "");
+        deferred.flush();
+        EXPECT_EQ(pending(fds[0]), text + text);
+
+        on_exit.max_buffered_ = 2 * text.size();
+        FdBulkSink capped(fds[1], on_exit);
+        capped.write(bulk, text);
+        EXPECT_EQ(pending(fds[0]), "");
+        capped.write(bulk, text);
+        EXPECT_EQ(pending(fds[0]), text + text);
+
+        // сброс по интервалу делает таймер, без следующего пакета
+        TimedFlushSink timed(std::make_unique<FdBulkSink>(fds[1], on_exit), std::chrono::milliseconds(20));
+        timed.write(bulk, text);
+        std::string flushed;
+        for( int i = 0; i < 200 && flushed.empty(); ++i )
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            flushed = pending(fds[0]);
+        }
+        EXPECT_EQ(flushed, text);
+    }
+    ::close(fds[0]);
+    ::close(fds[1]);
+
+    // ошибка сброса по таймеру выбрасывается следующим вызовом, а в деструкторе приемника только выводится
+    TimedFlushSink broken(std::make_unique<FdBulkSink>(-1, FlushOptions{FlushPolicy::kOnExit}), std::chrono::milliseconds(20));
+    bool thrown = false;
+    for( int i = 0; i < 200 && !thrown; ++i )
+    {
+        try
+        {
+            broken.write(bulk, text);
+        }
+        catch(const std::system_error&)
+        {
+            thrown = true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_TRUE(thrown);
+}
+
+TEST(test_bulk, test_max_latency)
+{
+    using namespace std::chrono;
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    auto send = [&fds](std::string const& data){ return ::write(fds[1], data.data(), data.size()) == ssize_t(data.size()); };
+
+    InputParser parser(5, ILineSourcePtr_t{ new FdLineSource(fds[0]) }, ICommandCreatorPtr_t(new CommandCreator), milliseconds(50));
+    BulkBuffer bulk;
+    ASSERT_TRUE(send("1\n2\n"));
+    auto const started = steady_clock::now();
+    EXPECT_EQ(parser.read_next_bulk(bulk), IInputParser::Status::kReady);
+    EXPECT_GE(steady_clock::now() - started, milliseconds(40));
+    EXPECT_EQ(bulk.size(), 2);
+    bulk.clear();
+
+    ASSERT_TRUE(send("{\n3\n"));
+    ASSERT_TRUE(send("4\n}\n5"));
+    EXPECT_EQ(parser.read_next_bulk(bulk), IInputParser::Status::kReady);
+    EXPECT_EQ(bulk.size(), 0);
+    EXPECT_EQ(parser.read_next_bulk(bulk), IInputParser::Status::kReady);
+    EXPECT_EQ(bulk.size(), 2);
+    bulk.clear();
+
+    ASSERT_TRUE(send("\n6\n7"));
+    EXPECT_EQ(parser.read_next_bulk(bulk), IInputParser::Status::kReady);
+    ASSERT_EQ(bulk.size(), 2);
+    EXPECT_EQ(bulk[0], "5");
+    EXPECT_EQ(bulk[1], "6");
+    bulk.clear();
+    ::close(fds[1]);
+    EXPECT_EQ(parser.read_next_bulk(bulk), IInputParser::Status::kReady);
+    ASSERT_EQ(bulk.size(), 1);
+    EXPECT_EQ(bulk[0], "7");
+    bulk.clear();
+    EXPECT_EQ(parser.read_next_bulk(bulk), IInputParser::Status::kStop);
+    ::close(fds[0]);
+
+    std::string out;
+    PushParser push(5, [&out](BulkBuffer& b){ format_bulk(b, out); }, milliseconds(50));
+    EXPECT_EQ(push.deadline(), PushParser::clock_t::time_point::max());
+    push.feed("a\nb\n{\nc\n", 8);
+    EXPECT_EQ(out, "bulk: a, b\n");
+    EXPECT_EQ(push.deadline(), PushParser::clock_t::time_point::max());
+    push.feed("}\nd\n", 4);
+    auto const deadline = push.deadline();
+    EXPECT_NE(deadline, PushParser::clock_t::time_point::max());
+    push.expire(deadline - milliseconds(1));
+    EXPECT_EQ(out, "bulk: a, b\nbulk: c\n");
+    push.expire(deadline);
+    EXPECT_EQ(out, "bulk: a, b\nbulk: c\nbulk: d\n");
+}
+
+TEST(test_bulk, test_segment_log)
+{
+    std::vector<std::string> stems;
+    {
+        SegmentOptions seg_opts;
+        seg_opts.max_bytes_ = 32;
+        SegmentLogSink sink(seg_opts);
+        BulkBuffer bulk;
+        bulk.created_at_ = 1517223860;
+        bulk.created_us_ = 1517223860000042;
+        for( uint64_t seq = 1; seq <= 3; ++seq )
+        {
+            bulk.clear();
+            bulk.seq_ = seq;
+            bulk.push("cmd" + std::to_string(seq));
+            bulk.push("long_command");
+            std::string text;
+            format_bulk(bulk, text);
+            sink.write(bulk, text);
+            stems.push_back(get_bulk_file_stem(bulk));
+        }
+    }
+    EXPECT_EQ(stems[0], "bulk1517223860_000042_1");
+
+    auto read_file = [](std::string const& nm)
+    {
+        std::ifstream is(nm, std::ios::binary);
+        std::ostringstream oss;
+        oss << is.rdbuf();
+        return oss.str();
+    };
+    for( auto const& stem : stems )
+    {
+        EXPECT_EQ(read_file(stem + ".seg"), "bulk: cmd" + stem.substr(stem.size() - 1) + ", long_command\n");
+        EXPECT_EQ(read_file(stem + ".idx"), stem.substr(stem.size() - 1) + " 1517223860000042 0 25\n");
+        std::remove((stem + ".seg").c_str());
+        std::remove((stem + ".idx").c_str());
+    }
+}
+
+TEST(test_bulk, test_binary_log)
+{
+    uint64_t const base_us = 1517223860000000;
+    BulkBuffer bulk;
+    std::string stem;
+    std::vector<std::string> texts;
+    auto write_bulks = [&](BinaryLogSink& sink, uint64_t from, uint64_t to)
+    {
+        for( uint64_t seq = from; seq <= to; ++seq )
+        {
+            bulk.clear();
+            bulk.seq_ = seq;
+            // время не монотонно: индекс должен быть упорядочен по времени, а не по записи
+            bulk.created_us_ = base_us + (seq % 2 ? seq : 100 - seq) * 1000;
+            bulk.created_at_ = static_cast<time_t>(bulk.created_us_ / 1000000);
+            bulk.push("cmd" + std::to_string(seq));
+            if( seq % 3 == 0 )
+                bulk.push(std::string(seq, 'x'));
+            std::string text;
+            format_bulk(bulk, text);
+            sink.write(bulk, text);
+            texts.push_back(text);
+            if( stem.empty() )
+                stem = get_bulk_file_stem(bulk);
+        }
+    };
+
+    {
+        BinaryLogSink sink(SegmentOptions{});
+        write_bulks(sink, 1, 20);
+        sink.flush();
+
+        BinaryLogReader unindexed(stem + ".blg");
+        EXPECT_FALSE(unindexed.indexed());
+        EXPECT_EQ(unindexed.size(), 20);
+        write_bulks(sink, 21, 40);
+    }
+
+    BinaryLogReader reader(stem + ".blg");
+    EXPECT_TRUE(reader.indexed());
+    ASSERT_EQ(reader.size(), 40);
+    for( size_t pos = 1; pos < reader.size(); ++pos )
+        EXPECT_LE(reader.entry(pos - 1).created_us_, reader.entry(pos).created_us_);
+
+    // пакеты со временем base + [10, 20] мс: нечетные 11..19, четные лежат в 60..98 мс
+    auto range = reader.find_range(base_us + 10000, base_us + 20000);
+    EXPECT_EQ(range.second - range.first, 5);
+    std::string text;
+    for( size_t pos = range.first; pos < range.second; ++pos )
+    {
+        reader.read_bulk(pos, bulk);
+        EXPECT_EQ(bulk.seq_ % 2, 1);
+        EXPECT_GE(bulk.created_us_, base_us + 10000);
+        EXPECT_LE(bulk.created_us_, base_us + 20000);
+        text.clear();
+        format_bulk(bulk, text);
+        EXPECT_EQ(text, texts[bulk.seq_ - 1]);
+    }
+    range = reader.find_range(base_us + 1000000, base_us + 2000000);
+    EXPECT_EQ(range.first, range.second);
+    range = reader.find_range(0, std::numeric_limits<uint64_t>::max());
+    EXPECT_EQ(range.second - range.first, 40);
+
+    std::remove((stem + ".blg").c_str());
+    EXPECT_THROW(BinaryLogReader("test_bulk.cpp.missing"), std::system_error);
+}
+
+#ifdef BULK_ZSTD
+TEST(test_bulk, test_compressed_log)
+{
+    std::vector<std::string> samples;
+    for( int i = 0; i < 2000; ++i )
+        samples.push_back("bulk: get user_" + std::to_string(i % 97) + ", set session_" + std::to_string(i) + " active\n");
+    std::string const dict = train_log_dictionary(samples, 4096);
+    EXPECT_FALSE(dict.empty());
+
+    auto decompress_file = [&dict](std::string const& nm, std::string& text)
+    {
+        std::ifstream is(nm, std::ios::binary);
+        std::ostringstream oss;
+        bool const complete = decompress_log(is, oss, dict);
+        text = oss.str();
+        return complete;
+    };
+
+    BulkBuffer bulk;
+    bulk.stamp_now();
+    std::string stem, expected, text;
+    {
+        SegmentLogSink sink(SegmentOptions{}, FlushOptions{}, ILogEncoderPtr_t(new ZstdLogEncoder(3, dict)));
+        for( uint64_t seq = 1; seq <= 50; ++seq )
+        {
+            bulk.clear();
+            bulk.seq_ = 2000 + seq;
+            bulk.push("get user_" + std::to_string(seq));
+            bulk.push("set session_" + std::to_string(seq) + " active");
+            text.clear();
+            format_bulk(bulk, text);
+            sink.write(bulk, text);
+            expected += text;
+            if( stem.empty() )
+                stem = get_bulk_file_stem(bulk);
+        }
+        std::string partial;
+        EXPECT_FALSE(decompress_file(stem + ".seg.zst", partial));
+        EXPECT_EQ(partial, expected);
+    }
+    EXPECT_TRUE(decompress_file(stem + ".seg.zst", text));
+    EXPECT_EQ(text, expected);
+    std::ifstream idx(stem + ".idx");
+    EXPECT_EQ(std::count(std::istreambuf_iterator<char>(idx), std::istreambuf_iterator<char>(), '\n'), 50);
+    std::remove((stem + ".seg.zst").c_str());
+    std::remove((stem + ".idx").c_str());
+
+    {
+        LogFileBulkSink sink(FlushOptions{}, ILogEncoderPtr_t(new ZstdLogEncoder(3, dict)));
+        bulk.clear();
+        bulk.seq_ = 2100;
+        bulk.push("get user_1");
+        text.clear();
+        format_bulk(bulk, text);
+        sink.write(bulk, text);
+    }
+    std::string const log_nm = get_bulk_file_stem(bulk) + ".log.zst";
+    std::string decoded;
+    EXPECT_TRUE(decompress_file(log_nm, decoded));
+    EXPECT_EQ(decoded, text);
+    std::remove(log_nm.c_str());
+
+    std::istringstream garbage("not a zstd frame");
+    std::ostringstream sink_os;
+    EXPECT_THROW(decompress_log(garbage, sink_os), std::runtime_error);
+}
+#endif
+
+TEST(test_bulk, test_uring_log)
+{
+    for( bool direct : {false, true} )
+    {
+        std::unique_ptr<UringLogSink> sink;
+        try
+        {
+            UringOptions opts;
+            opts.entries_ = 2;
+            opts.buffer_size_ = 4096;
+            opts.direct_ = direct;
+            sink.reset(new UringLogSink(opts));
+        }
+        catch(const std::system_error&)
+        {
+            GTEST_SKIP() << "io_uring is unavailable";
+        }
+        IoUring ring(1);
+        EXPECT_TRUE(ring.supports({IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE}));
+        EXPECT_FALSE(ring.supports({IORING_OP_WRITE, 255}));
+
+        std::vector<std::pair<std::string, std::string>> files;
+        BulkBuffer bulk;
+        bulk.stamp_now();
+        for( uint64_t seq = 1; seq <= 5; ++seq )
+        {
+            bulk.clear();
+            bulk.seq_ = 1000 * direct + seq;
+            bulk.push("uring" + std::to_string(seq));
+            if( seq == 5 )
+                bulk.push(std::string(10000, 'z'));
+            std::string text;
+            format_bulk(bulk, text);
+            sink->write(bulk, text);
+            files.emplace_back(get_bulk_file_stem(bulk) + ".log", text);
+        }
+        sink->flush();
+        EXPECT_EQ(sink->completed(), 5);
+
+        for( auto const& f : files )
+        {
+            std::ifstream is(f.first, std::ios::binary);
+            std::ostringstream oss;
+            oss << is.rdbuf();
+            EXPECT_EQ(oss.str(), f.second);
+            std::remove(f.first.c_str());
+        }
+    }
+}
+
+TEST(test_bulk, test_group_commit)
+{
+    // журнал помечает пакеты записанными на носитель только в sync, вывод проверяет, что пакет уже там
+    struct State
+    {
+        std::vector<uint64_t>   logged;
+        size_t                  durable = 0, syncs = 0;
+        std::string             released;
+        bool                    early = false, fail = false;
+    };
+    struct LogSink : IBulkSink
+    {
+        explicit LogSink(State& state) : state_(state) {}
+        void write(BulkBuffer const& bulk, std::string_view) override { state_.logged.push_back(bulk.seq_); }
+        void flush() override {}
+        void sync() override
+        {
+            if( state_.fail )
+                throw std::runtime_error("sync failed");
+            state_.durable = state_.logged.size();
+            ++state_.syncs;
+        }
+        State& state_;
+    };
+    struct ReleaseSink : IBulkSink
+    {
+        explicit ReleaseSink(State& state) : state_(state) {}
+        void write(BulkBuffer const& bulk, std::string_view text) override
+        {
+            auto const end = state_.logged.begin() + static_cast<std::ptrdiff_t>(state_.durable);
+            if( std::find(state_.logged.begin(), end, bulk.seq_) == end )
+                state_.early = true;
+            state_.released.append(text.data(), text.size());
+        }
+        void flush() override {}
+        State& state_;
+    };
+    auto make_sink = [](State& state, GroupCommitOptions const& opts)
+    {
+        std::vector<IBulkSinkPtr_t> log_sinks, release_sinks;
+        log_sinks.emplace_back(new LogSink(state));
+        release_sinks.emplace_back(new ReleaseSink(state));
+        return std::make_unique<GroupCommitSink>(std::move(log_sinks), std::move(release_sinks), opts);
+    };
+    auto write_bulks = [](IBulkSink& sink, size_t n, std::string& expected)
+    {
+        BulkBuffer bulk;
+        for( size_t i = 1; i <= n; ++i )
+        {
+            bulk.clear();
+            bulk.seq_ = i;
+            bulk.push("cmd" + std::to_string(i));
+            std::string text;
+            format_bulk(bulk, text);
+            sink.write(bulk, text);
+            expected += text;
+        }
+    };
+
+    {
+        State state;
+        std::string expected;
+        auto sink = make_sink(state, {});
+        write_bulks(*sink, 100, expected);
+        sink->flush();
+        EXPECT_EQ(state.released, expected);
+        EXPECT_FALSE(state.early);
+        GroupCommitStats const stats = sink->stats();
+        EXPECT_EQ(stats.bulks_, 100u);
+        EXPECT_EQ(stats.commits_, state.syncs);
+        EXPECT_LE(stats.commits_, stats.bulks_);
+    }
+    {
+        // группа копится до max_delay или max_batch, сброс фиксирует неполную группу сразу
+        State state;
+        std::string expected;
+        GroupCommitOptions opts;
+        opts.max_delay_ = std::chrono::seconds(10);
+        opts.max_batch_ = 4;
+        auto sink = make_sink(state, opts);
+        write_bulks(*sink, 10, expected);
+        sink->flush();
+        EXPECT_EQ(state.released, expected);
+        EXPECT_FALSE(state.early);
+        GroupCommitStats const stats = sink->stats();
+        EXPECT_EQ(stats.commits_, 3u);
+        EXPECT_EQ(stats.max_batch_, 4u);
+    }
+    {
+        // оставшиеся пакеты фиксируются при разрушении
+        State state;
+        std::string expected;
+        GroupCommitOptions opts;
+        opts.max_delay_ = std::chrono::seconds(10);
+        write_bulks(*make_sink(state, opts), 5, expected);
+        EXPECT_EQ(state.released, expected);
+        EXPECT_EQ(state.syncs, 1u);
+    }
+    {
+        // ошибка синхронизации не выпускает пакеты и бросается из flush
+        State state;
+        state.fail = true;
+        std::string expected;
+        auto sink = make_sink(state, {});
+        write_bulks(*sink, 3, expected);
+        EXPECT_THROW(sink->flush(), std::runtime_error);
+        EXPECT_TRUE(state.released.empty());
+    }
+    {
+        SegmentOptions seg_opts;
+        seg_opts.durable_ = true;
+        SegmentLogSink sink(seg_opts);
+        BulkBuffer bulk;
+        bulk.seq_ = 1;
+        bulk.created_us_ = 1517223860000077;
+        bulk.push("cmd");
+        std::string text;
+        format_bulk(bulk, text);
+        sink.write(bulk, text);
+        EXPECT_NO_THROW(sink.sync());
+        std::string const stem = get_bulk_file_stem(bulk);
+        std::remove((stem + ".seg").c_str());
+        std::remove((stem + ".idx").c_str());
+    }
+}
+
+TEST(test_bulk, test_checkpoint)
+{
+    std::string input;
+    for( int i = 0; i < 40; ++i )
+    {
+        if( i % 9 == 4 )
+            input += "{\n";
+        input += "cmd" + std::to_string(i) + "\n";
+        if( i % 9 == 7 )
+            input += "{\ninner\n}\n}\n";
+    }
+    input += "{\nlost\n";
+
+    // источники строк переходят по смещению, разобранному до границы
+    {
+        std::istringstream is(input);
+        IstreamLineSource src(is, 8);
+        std::string_view line;
+        ASSERT_TRUE(src.next_line(line));
+        ASSERT_TRUE(src.next_line(line));
+        EXPECT_EQ(src.consumed(), 10u);
+        src.seek(5);
+        ASSERT_TRUE(src.next_line(line));
+        EXPECT_EQ(line, "cmd1");
+    }
+
+    // дублирующий файлы журнала пакет помечается номером: номера должны идти без повторов
+    struct SeqSink : IBulkSink
+    {
+        explicit SeqSink(std::vector<uint64_t>& seqs) : seqs_(seqs) {}
+        void write(BulkBuffer const& bulk, std::string_view) override { seqs_.push_back(bulk.seq_); }
+        void flush() override {}
+        std::vector<uint64_t>& seqs_;
+    };
+    // сбой после limit пакетов, до их вывода
+    struct CrashSink : IBulkSink
+    {
+        explicit CrashSink(size_t limit) : limit_(limit) {}
+        void write(BulkBuffer const&, std::string_view) override
+        {
+            if( !limit_-- )
+                throw std::runtime_error("crash");
+        }
+        void flush() override {}
+        size_t limit_;
+    };
+    std::string const ckpt_path = "test_checkpoint.ckpt";
+    auto make_processor = [&](std::istream& is, std::ostream& os, std::vector<uint64_t>& seqs, size_t crash_after, size_t every)
+    {
+        std::vector<IBulkSinkPtr_t> sinks;
+        sinks.emplace_back(new CrashSink(crash_after));
+        sinks.emplace_back(new OstreamBulkSink(os));
+        sinks.emplace_back(new SeqSink(seqs));
+        return std::make_unique<CheckpointProcessor>(std::make_unique<InputParser>(3, ILineSourcePtr_t{new IstreamLineSource(is)},
+                                                                                   ICommandCreatorPtr_t{new CommandCreator}),
+                                                     std::move(sinks), std::make_unique<CheckpointFile>(ckpt_path), every);
+    };
+
+    std::string expected;
+    size_t bulks = 0;
+    {
+        std::remove(ckpt_path.c_str());
+        std::istringstream is(input);
+        std::ostringstream os;
+        std::vector<uint64_t> seqs;
+        auto processor = make_processor(is, os, seqs, size_t(-1), 1);
+        EXPECT_FALSE(processor->resume());
+        processor->process();
+        expected = os.str();
+        bulks = seqs.size();
+        Checkpoint ckpt;
+        ASSERT_TRUE(CheckpointFile(ckpt_path).load(ckpt));
+        // блок, оборванный концом ввода, при продолжении читается заново с его начала
+        EXPECT_EQ(ckpt.offset_, input.size() - 5);
+        EXPECT_EQ(ckpt.depth_, 1u);
+        EXPECT_EQ(ckpt.seq_, bulks);
+
+        // повторный запуск с контрольной точкой ничего не выводит
+        std::istringstream again_is(input);
+        std::ostringstream again_os;
+        std::vector<uint64_t> again_seqs;
+        auto again = make_processor(again_is, again_os, again_seqs, size_t(-1), 1);
+        EXPECT_TRUE(again->resume());
+        again->process();
+        EXPECT_TRUE(again_os.str().empty());
+    }
+    ASSERT_GT(bulks, 10u);
+
+    for( size_t every : {1, 4} )
+        for( size_t crash = 0; crash < bulks; ++crash )
+        {
+            std::remove(ckpt_path.c_str());
+            std::istringstream first_is(input), second_is(input);
+            std::ostringstream first_os, second_os;
+            std::vector<uint64_t> seqs;
+            auto first = make_processor(first_is, first_os, seqs, crash, every);
+            first->reset();
+            EXPECT_THROW(first->process(), std::runtime_error);
+            first.reset();
+
+            auto second = make_processor(second_is, second_os, seqs, size_t(-1), every);
+            EXPECT_TRUE(second->resume());
+            second->process();
+            if( every == 1 )
+            {
+                EXPECT_EQ(first_os.str() + second_os.str(), expected) << "crash after " << crash;
+                std::vector<uint64_t> ordered(seqs.size());
+                std::iota(ordered.begin(), ordered.end(), 1);
+                EXPECT_EQ(seqs, ordered);
+            }
+            else
+            {
+                // повторяются только пакеты после последней контрольной точки
+                std::string const out = first_os.str() + second_os.str();
+                EXPECT_LE(seqs.size(), bulks + every - 1);
+                EXPECT_EQ(out.substr(out.size() - second_os.str().size()), expected.substr(expected.size() - second_os.str().size()));
+            }
+        }
+
+    {
+        std::ofstream os(ckpt_path, std::ios::binary | std::ios::trunc);
+        os << std::string(CheckpointFile::kRecordSize, 'x');
+    }
+    Checkpoint ckpt;
+    EXPECT_THROW(CheckpointFile(ckpt_path).load(ckpt), std::runtime_error);
+    std::remove(ckpt_path.c_str());
+}
+
+TEST(test_bulk, test_chunk_controller)
+{
+    using clock_t = ChunkController::clock_t;
+    using us = std::chrono::microseconds;
+    // ввод с постоянным темпом и вывод стоимостью overhead + per_cmd * N в модельном времени:
+    // пока пакет выводится, ввод копится, и следующий пакет начинает читаться из накопленного
+    struct Result { size_t chunk; uint64_t p99_us; double busy; };
+    auto simulate = [](ChunkController& ctl, double arrival_us, double overhead_us, double per_cmd_us, size_t bulks)
+    {
+        clock_t::time_point const start{};
+        auto at = [&](double t_us){ return start + std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double, std::micro>(t_us)); };
+        double now = 0, busy = 0, waited = 0;
+        size_t next_cmd = 0;
+        for( size_t i = 0; i < bulks; ++i )
+        {
+            size_t const n = ctl.chunk();
+            double const first = std::max(now, double(next_cmd) * arrival_us);
+            double const ready = std::max(first, double(next_cmd + n - 1) * arrival_us);
+            next_cmd += n;
+            waited += ready - now;
+            double const cost = overhead_us + per_cmd_us * double(n);
+            ctl.bulk_ready(n, at(first), at(ready), static_cast<uint64_t>(waited * 1000));
+            now = ready + cost;
+            busy += cost;
+            ctl.bulk_done(at(now));
+        }
+        return Result{ctl.chunk(), ctl.p99_us(), busy / now};
+    };
+
+    {
+        // дорогой пакет на быстром вводе: размер растет, пока вывод не начнет успевать
+        ChunkTargets targets;
+        ChunkController ctl(targets, 1);
+        Result const r = simulate(ctl, 1, 100, 0.1, 2000);
+        EXPECT_GE(r.chunk, 143u);
+        EXPECT_LT(r.busy, 0.95);
+        EXPECT_GT(ctl.input_rate(), 9e5);
+    }
+    {
+        // цель p99 разрешает пакет крупнее необходимого для пропускной способности
+        ChunkTargets targets;
+        targets.p99_ = us(1000);
+        ChunkController ctl(targets, 3);
+        Result const r = simulate(ctl, 1, 100, 0.1, 2000);
+        EXPECT_GT(r.chunk, 300u);
+        EXPECT_LE(r.p99_us, 1100u);
+    }
+    {
+        // на медленном вводе пакет сжимается до наименьшего размера
+        ChunkTargets targets;
+        targets.p99_ = us(5000);
+        targets.min_ = 2;
+        ChunkController ctl(targets, 100);
+        Result const r = simulate(ctl, 1000, 10, 0.1, 400);
+        EXPECT_LE(r.chunk, 6u);
+        EXPECT_GE(r.chunk, 2u);
+        EXPECT_LE(r.p99_us, 6000u);
+    }
+
+    // динамические блоки не режутся подобранным размером и не учитываются контроллером
+    {
+        ChunkTargets targets;
+        targets.min_ = targets.max_ = 2;
+        auto ctl = std::make_shared<ChunkController>(targets, 2);
+        std::istringstream is("a\nb\nc\n{\n1\n2\n3\n4\n5\n}\nd\ne\n");
+        InputParser parser(100, is, ICommandCreatorPtr_t(new CommandCreator));
+        parser.set_chunk_controller(ctl);
+        std::vector<size_t> sizes;
+        BulkBuffer bulk;
+        while( parser.read_next_bulk(bulk) != IInputParser::Status::kStop )
+        {
+            if( !bulk.empty() )
+                sizes.push_back(bulk.size());
+            ctl->bulk_done(clock_t::now());
+            bulk.clear();
+        }
+        EXPECT_EQ(sizes, (std::vector<size_t>{2, 1, 5, 2}));
+    }
+}
+
+TEST(test_bulk, test_histogram)
+{
+    for( uint64_t v : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull, ~0ull} )
+    {
+        size_t const idx = Histogram::bucket_of(v);
+        ASSERT_LT(idx, Histogram::kBuckets);
+        EXPECT_LE(Histogram::lower_bound(idx), v);
+        if( idx + 1 < Histogram::kBuckets )
+        {
+            EXPECT_GT(Histogram::lower_bound(idx + 1), v);
+        }
+    }
+    EXPECT_EQ(Histogram::bucket_of(Histogram::kSubCount - 1) + 1, Histogram::bucket_of(Histogram::kSubCount));
+
+    Histogram h;
+    for( uint64_t v = 1; v <= 1000; ++v )
+        h.record(v);
+    HistogramSnapshot snap;
+    h.merge_into(snap);
+    EXPECT_EQ(snap.count_, 1000);
+    EXPECT_EQ(snap.max_, 1000);
+    EXPECT_DOUBLE_EQ(snap.mean(), 500.5);
+    EXPECT_GE(snap.percentile(0.5), 500);
+    EXPECT_LE(snap.percentile(0.5), 500 + 500 / Histogram::kSubCount);
+    EXPECT_GE(snap.percentile(0.99), 990);
+    EXPECT_EQ(snap.percentile(1.0), 1000);
+}
+
+#ifdef BULK_METRICS
+TEST(test_bulk, test_metrics)
+{
+    MetricsSnapshot const before = MetricsRegistry::instance().snapshot();
+
+    std::istringstream is("1\n2\n3\n{\n4\n}\n5\n"s);
+    std::vector<IBulkSinkPtr_t> sinks;
+    std::ostringstream os;
+    sinks.emplace_back(new TimedBulkSink(IBulkSinkPtr_t{ new OstreamBulkSink(os) }, MetricStage::kConsoleWrite));
+    BulkProcessor(IInputParserPtr_t{ new InputParser(2, is, ICommandCreatorPtr_t(new CommandCreator)) }, std::move(sinks)).process();
+
+    MetricsSnapshot const after = MetricsRegistry::instance().snapshot();
+    auto delta = [&](MetricCounter c){ return after.counters_[size_t(c)] - before.counters_[size_t(c)]; };
+    EXPECT_EQ(delta(MetricCounter::kLinesRead), 7);
+    EXPECT_EQ(delta(MetricCounter::kBulksEmitted), 4);
+    EXPECT_EQ(delta(MetricCounter::kCommandsEmitted), 5);
+    EXPECT_EQ(after.bulk_size_.count_ - before.bulk_size_.count_, 4);
+    EXPECT_GT(after.stages_[size_t(MetricStage::kParse)].count_, before.stages_[size_t(MetricStage::kParse)].count_);
+    EXPECT_GT(after.stages_[size_t(MetricStage::kConsoleWrite)].count_, before.stages_[size_t(MetricStage::kConsoleWrite)].count_);
+
+    char stats_nm[] = "/tmp/test_bulk_statsXXXXXX";
+    int const fd = ::mkstemp(stats_nm);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+    auto read_stats = [&stats_nm]
+    {
+        std::ifstream in(stats_nm);
+        std::ostringstream oss;
+        oss << in.rdbuf();
+        return oss.str();
+    };
+    {
+        StatsReporter reporter(stats_nm, std::chrono::milliseconds(0));
+        std::raise(SIGUSR1);
+        for( int i = 0; i < 200 && read_stats().find("\"reason\":\"signal\"") == std::string::npos; ++i )
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::string const stats = read_stats();
+    std::remove(stats_nm);
+    EXPECT_NE(stats.find("\"reason\":\"signal\""), std::string::npos);
+    EXPECT_NE(stats.find("\"reason\":\"exit\""), std::string::npos);
+    EXPECT_NE(stats.find("\"lines_read\":"), std::string::npos);
+    EXPECT_NE(stats.find("\"queue_wait\":{\"count\":"), std::string::npos);
+    EXPECT_EQ(std::count(stats.begin(), stats.end(), '\n'), 2);
+}
+#endif
+
+#ifdef __linux__
+TEST(test_bulk, test_socket_server)
+{
+    std::string const path = "/tmp/test_bulk_" + std::to_string(::getpid()) + ".sock";
+    std::ostringstream os;
+    std::vector<IBulkSinkPtr_t> sinks;
+    sinks.emplace_back(new OstreamBulkSink(os));
+    ServerOptions opts;
+    opts.path_ = path;
+    opts.threads_ = 2;
+    opts.chunk_size_ = 2;
+    BulkServer server(opts, std::move(sinks));
+    std::thread server_thread([&server]{ server.process(); });
+
+    auto send_client = [&path](std::string const& data)
+    {
+        int const fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path.c_str());
+        if( ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 )
+            for( size_t pos = 0; pos < data.size(); pos += 3 )
+                if( ::write(fd, data.data() + pos, std::min<size_t>(3, data.size() - pos)) < 0 )
+                    break;
+        ::close(fd);
+    };
+
+    constexpr int kClients = 4;
+    std::vector<std::thread> clients;
+    for( int c = 0; c < kClients; ++c )
+    {
+        std::string const id = std::to_string(c);
+        clients.emplace_back(send_client, "a" + id + "\nb" + id + "\nc" + id + "\n{\nd" + id + "\n{\ne" + id + "\n}\n}\nf" + id + "\n{\ng" + id + "\n");
+    }
+    for( auto& t : clients )
+        t.join();
+    for( int i = 0; i < 500 && server.bulks() < 4 * kClients; ++i )
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    server.stop();
+    server_thread.join();
+
+    EXPECT_EQ(server.connections(), kClients);
+    EXPECT_EQ(server.bulks(), 4 * kClients);
+    std::string const out = os.str();
+    for( int c = 0; c < kClients; ++c )
+    {
+        std::string const id = std::to_string(c);
+        size_t const p1 = out.find("bulk: a" + id + ", b" + id + "\n");
+        size_t const p2 = out.find("bulk: c" + id + "\n");
+        size_t const p3 = out.find("bulk: d" + id + ", e" + id + "\n");
+        size_t const p4 = out.find("bulk: f" + id + "\n");
+        ASSERT_NE(p1, std::string::npos);
+        ASSERT_NE(p4, std::string::npos);
+        EXPECT_LT(p1, p2);
+        EXPECT_LT(p2, p3);
+        EXPECT_LT(p3, p4);
+        EXPECT_EQ(out.find("g" + id), std::string::npos);
+    }
+}
+
+TEST(test_bulk, test_socket_server_error)
+{
+    // ошибка записи приемника в цикле событий не завершает процесс, а выбрасывается из process()
+    struct FailingSink : IBulkSink
+    {
+        void write(BulkBuffer const&, std::string_view) override
+        {
+            throw std::system_error(ENOSPC, std::generic_category(), "write");
+        }
+    };
+    std::string const path = "/tmp/test_bulk_err_" + std::to_string(::getpid()) + ".sock";
+    std::vector<IBulkSinkPtr_t> sinks;
+    sinks.emplace_back(new FailingSink);
+    ServerOptions opts;
+    opts.path_ = path;
+    opts.threads_ = 3;
+    opts.chunk_size_ = 2;
+    BulkServer server(opts, std::move(sinks));
+    auto result = std::async(std::launch::async, [&server]{ server.process(); });
+
+    int const fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(::write(fd, "a\nb\n", 4), 4);
+    ::close(fd);
+
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_THROW(result.get(), std::system_error);
+}
+#endif
@@ -0,0 +1,9 @@
+#include <cstddef>
+
+/// @brief Обработчик команд для проверки PluginHandler: результат - аргумент задом наперед
+extern "C" size_t bulk_handle(const char* arg, size_t arg_len, char* out, size_t out_cap)
+{
+    for( size_t i = 0; i < arg_len && i < out_cap; ++i )
+        out[i] = arg[arg_len - 1 - i];
+    return arg_len;
+}